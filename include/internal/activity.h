@@ -18,25 +18,27 @@
 #ifndef _ACTIVITY_H_
 #define _ACTIVITY_H_
 
+#include "clock.h"
+
 bool PwrEventActivityStart(const char *activity_id, int duration_ms);
 void PwrEventActivityStop(const char *activity_id);
 
 void PwrEventActivityPrint(void);
 
-void PwrEventActivityPrintFrom(struct timespec *start);
+void PwrEventActivityPrintFrom(ClockNs from);
 
-bool PwrEventActivityCanSleep(struct timespec *now);
+bool PwrEventActivityCanSleep(ClockNs now);
 
-void PwrEventActivityRemoveExpired(struct timespec *now);
+void PwrEventActivityRemoveExpired(ClockNs now);
 
-int PwrEventActivityCount(struct timespec *from);
+int PwrEventActivityCount(ClockNs from);
 
-bool PwrEventActivityCanSleep(struct timespec *now);
-bool PwrEventFreezeActivities(struct timespec *now);
+bool PwrEventActivityCanSleep(ClockNs now);
+bool PwrEventFreezeActivities(ClockNs now);
 void PwrEventThawActivities(void);
 
-bool PwrEventActivityCheckActivitiesActive(struct timespec *now);
+bool PwrEventActivityCheckActivitiesActive(ClockNs now);
 
-long PwrEventActivityGetMaxDuration(struct timespec *now);
+long PwrEventActivityGetMaxDuration(ClockNs now);
 
 #endif
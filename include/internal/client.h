@@ -20,18 +20,24 @@
 
 #include <stdbool.h>
 #include <glib.h>
+#include <luna-service2/lunaservice.h>
 
 struct PwrEventClientInfo
 {
     char *clientName;
     char *clientId;
     char *applicationName;
+    char *serviceName;
 
-    bool requireSuspendRequest;
-    bool requirePrepareSuspend;
+    /* identify subscription, used to reach the client directly */
+    LSMessage *message;
 
-    int ackSuspendRequest;
-    int ackPrepareSuspend;
+    /* dense index into the vote bitsets, stable while registered */
+    int slot;
+
+    /* CLIENT_SNAPSHOT_* registrations of a placeholder restored from the
+     * client snapshot, handed over when the client identifies again */
+    guint restoredFlags;
 
     int num_NACK_suspendRequest;
     int num_NACK_prepareSuspend;
@@ -41,16 +47,28 @@ struct PwrEventClientInfo
 #define PWREVENT_CLIENT_NACK  0
 #define PWREVENT_CLIENT_NORSP -1
 
+typedef enum
+{
+    kPwrEventVoteSuspendRequest,
+    kPwrEventVotePrepareSuspend,
+} PwrEventVoteRound;
+
 // hash is client_id -> PwrEventClientInfo
 GHashTable *PwrEventClientGetTable(void);
 
 typedef const char *ClientUID;
 
 struct PwrEventClientInfo *PwrEventClientLookup(ClientUID uid);
+struct PwrEventClientInfo *PwrEventClientLookupByName(const char *clientName);
 
 bool PwrEventClientRegister(ClientUID uid);
 
 bool PwrEventClientUnregister(ClientUID uid);
+void PwrEventClientSetName(struct PwrEventClientInfo *info, const char *clientName);
+void PwrEventClientRestore(ClientUID uid, const char *clientName,
+                           const char *applicationName, const char *serviceName,
+                           guint flags);
+void PwrEventClientSnapshot(GByteArray *buf);
 bool PwrEventClientPrepareSuspendRegister(ClientUID uid, bool reg);
 
 void PwrEventClientTableCreate(void);
@@ -78,4 +96,6 @@ bool PwrEventClientsApprovePrepareSuspend(void);
 
 bool PwrEventClientUnregisterByName(char *clientName);
 
+int PwrEventClientsNotify(PwrEventVoteRound round, const char *payload);
+
 #endif // _PWREVENTS_CLIENT_H_
@@ -0,0 +1,45 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _CLIENT_SNAPSHOT_H_
+#define _CLIENT_SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+typedef enum
+{
+    kClientSnapshotPwrEvent,
+    kClientSnapshotShutdownApp,
+    kClientSnapshotShutdownService,
+    kClientSnapshotLast
+} ClientSnapshotKind;
+
+#define CLIENT_SNAPSHOT_SUSPEND_REQUEST  (1 << 0)
+#define CLIENT_SNAPSHOT_PREPARE_SUSPEND  (1 << 1)
+
+/* Client ids of restored registrations are this prefix followed by the client name */
+#define CLIENT_SNAPSHOT_RESTORED_PREFIX  "restored:"
+
+void ClientSnapshotAppend(GByteArray *buf, ClientSnapshotKind kind, guint flags,
+                          const char *name, const char *appName,
+                          const char *serviceName);
+
+void ClientSnapshotSchedule(void);
+void ClientSnapshotRestore(void);
+
+#endif // _CLIENT_SNAPSHOT_H_
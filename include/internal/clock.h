@@ -40,4 +40,59 @@ long ClockGetMs(struct timespec *ts);
 
 void ClockClear(struct timespec *a);
 
+/**
+ * @brief Monotonic time in nanoseconds.
+ *
+ * Comparing and adding ClockNs values is plain integer arithmetic, use it
+ * where times are compared often and convert to struct timespec at the edges.
+ */
+typedef gint64 ClockNs;
+
+#define CLOCK_NS_PER_MS  G_GINT64_CONSTANT(1000000)
+#define CLOCK_NS_PER_SEC G_GINT64_CONSTANT(1000000000)
+
+static inline ClockNs
+ClockNsFromTimespec(const struct timespec *ts)
+{
+    return (ClockNs)ts->tv_sec * CLOCK_NS_PER_SEC + ts->tv_nsec;
+}
+
+static inline void
+ClockNsToTimespec(ClockNs t, struct timespec *ts)
+{
+    ts->tv_sec = t / CLOCK_NS_PER_SEC;
+    ts->tv_nsec = t % CLOCK_NS_PER_SEC;
+}
+
+static inline ClockNs
+ClockNsFromMs(gint64 ms)
+{
+    return ms * CLOCK_NS_PER_MS;
+}
+
+static inline gint64
+ClockNsToMs(ClockNs t)
+{
+    return t / CLOCK_NS_PER_MS;
+}
+
+static inline ClockNs
+ClockNsGet(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ClockNsFromTimespec(&ts);
+}
+
+/**
+ * @brief Now on the clock ClockGetTime() reads.
+ */
+static inline ClockNs
+ClockNsNow(void)
+{
+    return ClockNsGet(CLOCK_MONOTONIC);
+}
+
 #endif  // _CLOCK_H_
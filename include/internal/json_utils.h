@@ -19,6 +19,7 @@
 
 #include <json.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 bool get_json_string(struct json_object *object, const char *key,
                      const char **value);
@@ -27,4 +28,41 @@ bool get_json_boolean(struct json_object *object, const char *key, bool *value);
 bool get_json_object_as_string(struct json_object *object, const char *key,
                                const char **value);
 
+/*
+ * Fast path for small flat payloads such as {"clientId":"...","ack":true}.
+ * json_flat_parse() fills in the requested fields without allocating and
+ * returns false for anything it does not handle; callers then fall back to
+ * json_tokener_parse() and the get_json_* helpers above.
+ */
+
+#define JSON_FLAT_STRING_MAX 128
+
+typedef enum
+{
+    kJsonFlatString,
+    kJsonFlatInt,
+    kJsonFlatBoolean,
+} JsonFlatType;
+
+typedef struct
+{
+    const char   *key;
+    JsonFlatType  type;
+
+    /* kJsonFlatString: NUL terminated copy of the value */
+    char         *str;
+    size_t        str_size;
+
+    int           num;
+    bool          boolean;
+
+    bool          found;
+} JsonFlatField;
+
+#define JSON_FLAT_STRING(k, buf)  { .key = (k), .type = kJsonFlatString, .str = (buf), .str_size = sizeof(buf) }
+#define JSON_FLAT_INT(k)          { .key = (k), .type = kJsonFlatInt }
+#define JSON_FLAT_BOOLEAN(k)      { .key = (k), .type = kJsonFlatBoolean }
+
+bool json_flat_parse(const char *payload, JsonFlatField *fields, int num_fields);
+
 #endif
@@ -86,12 +86,16 @@
 #define MSGID_DB_OPEN_ERR                         "DB_OPEN_ERR"                    //Failed to open database
 #define MSGID_DB_CREATE_ERR                       "DB_CREATE_ERR"                  //could not create database
 #define MSGID_INDEX_CREATE_FAIL                   "INDEX_CREATE_FAIL"              //could not create index
+#define MSGID_DB_UPGRADE_FAIL                     "DB_UPGRADE_FAIL"                //could not upgrade the timeout table
 #define MSGID_CATEGORY_REG_FAIL                   "CATEGORY_REG_FAIL"              //could not register category
 #define MSGID_METHOD_REG_ERR                      "METHOD_REG_ERR"                 //could not register for suspend resume signal
 #define MSGID_UPDATE_REFERENCE_FAIL               "UPDATE_REFERENCE_FAIL"          //could not update reference clock
 #define MSGID_ALARM_TIMEOUT_INSERT                "ALARM_TIMEOUT_INSERT"           //Insert into AlarmTimeout failed
 #define MSGID_SELECT_ALL_FROM_TIMEOUT             "SELECT_ALL_FROM_TIMEOUT"        //timeout read failed
 
+/** timeout_delivery.c */
+#define MSGID_TIMEOUT_DEAD_LETTER                 "TIMEOUT_DEAD_LETTER"            //timeout dropped after its retries
+
 /** init.c */
 #define MSGID_HOOKINIT_FAIL                       "HOOKINIT_FAIL"                  //Failed to initialize
 #define MSGID_NAMED_INIT_FUNC_OOM                 "NAMED_INIT_FUNC_OOM"            //Out of memory on initialization
@@ -100,6 +104,10 @@
 /** timesaver.c */
 #define MSGID_TIME_NOT_SAVED                      "TIME_NOT_SAVED"                //time not be saved to temp file before battery was pulledout
 
+/** client_snapshot.c */
+#define MSGID_CLIENT_SNAPSHOT_SAVE_FAIL           "CLIENT_SNAPSHOT_SAVE_FAIL" // Could not save the client registrations
+#define MSGID_CLIENT_SNAPSHOT_CORRUPT             "CLIENT_SNAPSHOT_CORRUPT"   // Client registration snapshot is unreadable
+
 /** activity.c */
 
 /** machine.c */
@@ -114,9 +122,13 @@
 #define MSGID_SHUTDOWN_REPLY_FAIL                 "SHUTDOWN_REPLY_FAIL"      // Could not send shutdown success message
 #define MSGID_LSMSG_REPLY_FAIL                    "LSMSG_REPLY_FAIL"         // Could not send reply to caller
 #define MSGID_LSSUBSCRI_ADD_FAIL                  "LSSUBSCRI_ADD_FAIL"       // LSSubscriptionAdd failed
+#define MSGID_SHUTDOWN_DURATION                   "SHUTDOWN_DURATION"        // Time taken to get ready for shutdown
+#define MSGID_SHUTDOWN_LATENCY_SAVE_FAIL          "SHUTDOWN_LATENCY_SAVE_FAIL" // Could not save learned client ack times
+#define MSGID_SHUTDOWN_REPORT_SAVE_FAIL           "SHUTDOWN_REPORT_SAVE_FAIL" // Could not save the shutdown timing report
 
 /** suspend.c */
 #define MSGID_PTHREAD_CREATE_FAIL                 "PTHREAD_CREATE_FAIL"      // Could not create SuspendThread
+#define MSGID_EVENTFD_CREATE_FAIL                 "EVENTFD_CREATE_FAIL"      // Could not create the suspend vote events
 #define MSGID_NYX_DEV_OPEN_FAIL                   "NYX_DEV_OPEN_FAIL"        // Unable to open the nyx device led controller
 #define MSGID_SUBSCRIBE_DISP_MGR_FAIL             "SUBSCRIBE_DISP_MGR_FAIL"  // Failed to subscribe for display manager updates
 
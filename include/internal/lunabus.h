@@ -0,0 +1,58 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _LUNABUS_H_
+#define _LUNABUS_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#define LUNABUS_MAX_NAMES 2
+
+/**
+ * One service name a category is published under.
+ */
+typedef struct
+{
+    LSHandle   *sh;
+    const char *service;
+    const char *category;
+} LunaBusName;
+
+/**
+ * A category that is published under the legacy and the new service names.
+ */
+typedef struct
+{
+    LunaBusName names[LUNABUS_MAX_NAMES];
+    int         num_names;
+} LunaBusCategory;
+
+bool LunaBusCategoryAddName(LunaBusCategory *cat, LSHandle *sh,
+                            const char *service, const char *category);
+bool LunaBusRegisterCategory(LunaBusCategory *cat, LSMethod *methods,
+                             LSSignal *signals, LSError *lserror);
+
+bool LunaBusSignalSend(LunaBusCategory *cat, const char *subscription_key,
+                       const char *signal, const char *payload);
+void LunaBusAccountDirect(LunaBusCategory *cat, const char *subscription_key,
+                          int sent);
+
+gchar *LunaBusGetStats(void);
+
+#endif // _LUNABUS_H_
@@ -18,8 +18,26 @@
 #ifndef __LUNASERVICE_UTILS_H__
 #define __LUNASERVICE_UTILS_H__
 
+#include <stdarg.h>
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 
+/* Constant reply payloads, shared by every handler */
+extern const char kLSReplySuccess[];
+extern const char kLSReplyFailure[];
+extern const char kLSReplyErrorUnknown[];
+extern const char kLSReplyErrorInvalidParams[];
+extern const char kLSReplyErrorBadJSON[];
+
+GString *LSReplyBuffer(void);
+void LSReplyAppendPrintf(GString *reply, const char *format, ...)
+G_GNUC_PRINTF(2, 3);
+void LSReplyAppendVprintf(GString *reply, const char *format, va_list args);
+void LSReplyAppendEscaped(GString *reply, const char *str);
+
+bool LSMessageReplyConst(LSHandle *sh, LSMessage *message, const char *payload);
+bool LSMessageReplyBuffer(LSHandle *sh, LSMessage *message, GString *reply);
+
 void LSMessageReplyErrorUnknown(LSHandle *sh, LSMessage *message);
 void LSMessageReplyErrorInvalidParams(LSHandle *sh, LSMessage *message);
 void LSMessageReplyErrorBadJSON(LSHandle *sh, LSMessage *message);
@@ -18,7 +18,16 @@
 #ifndef _SHUTDOWN_H_
 #define _SHUTDOWN_H_
 
+#include <stdbool.h>
+#include <glib.h>
+
 void shutdown_client_cancel_registration(const char *clientId);
 void shutdown_client_cancel_registration_by_name(const char *clientId);
 
+void shutdown_client_restore(bool application, const char *uid,
+                             const char *clientName, const char *serviceName);
+bool shutdown_client_present(bool application, const char *uid);
+void shutdown_client_drop(bool application, const char *uid);
+void shutdown_client_snapshot(GByteArray *buf);
+
 #endif
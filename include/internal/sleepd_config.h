@@ -33,18 +33,42 @@ typedef struct
     int wait_prepare_suspend_ms;
     int after_resume_idle_ms;
     int wait_alarms_s;
+    int suspend_backoff_max_ms;
+    int suspend_break_even_ratio;
+    int client_restore_grace_ms;
+
+    int shutdown_apps_timeout_ms;
+    int shutdown_services_timeout_ms;
+    int shutdown_client_deadline_pct;
+    int shutdown_client_deadline_min_ms;
+    bool shutdown_overlap_phases;
 
     bool suspend_with_charger;
     bool enable_idle_check_thread;
     bool visual_leds_suspend;
+    bool direct_signal_delivery;
 
     int debug;
     bool use_syslog;
 
+    /* Timers tolerating this much delay share wakeups, see timerwheel.c */
+    int timer_coalesce_ms;
+
     bool disable_rtc_alarms;
 
+    /* Delivery of fired timeouts, see timeout_delivery.c */
+    int alarm_delivery_max_inflight;
+    int alarm_delivery_retries;
+    int alarm_delivery_backoff_ms;
+
     const char *preference_dir;
 
+    /* Where to look for the source of a wakeup, see wakeup.c */
+    const char *wakeup_event_list_path;
+    const char *wakeup_sources_path;
+    const char *wakeup_class_dir;
+    const char *batterycheck_wakeup_path;
+
     /* These aren't really config, they are runtime parameters */
     int is_running;
     bool fasthalt;
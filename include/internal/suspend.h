@@ -18,6 +18,7 @@
 #ifndef _SUSPEND_H_
 #define _SUSPEND_H_
 
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 /**
  * @brief If from batterycheck, the reason why we woke up.
@@ -42,6 +43,10 @@ typedef int PowerEvent;
 void ScheduleIdleCheck(int interval_ms, bool fromPoll);
 void TriggerSuspend(const char *cause, PowerEvent power_event);
 void TriggerResume(const char *cause, PowerEvent power_event);
+void SuspendRequestVotesDone(void);
+void PrepareSuspendVotesDone(void);
+void SuspendBackoffReset(const char *reason);
+gchar *SuspendGetBackoffState(void);
 bool GetSuspendSettings(LSHandle *sh, LSMessage *message, void *ctx);
 int com_palm_suspend_lunabus_init(void);
 bool IsSuspended(void);
@@ -51,6 +51,18 @@ typedef struct _AlarmTimeoutNonConst
     time_t      expiry;
 } _AlarmTimeoutNonConst;
 
+/*
+ * Alarms of the deprecated com.palm.sleep/time interface are stored as
+ * timeouts of this app_id and uri, and handed back to alarm.c when they
+ * expire instead of being sent over the bus.
+ */
+#define ALARM_TIMEOUT_APP_ID    "com.palm.sleep"
+#define ALARM_TIMEOUT_URI       "luna://com.palm.sleep/time/internalAlarmFired"
+
+bool alarm_timeout_fired(const char *params);
+
+typedef void (*_TimeoutFunc)(const _AlarmTimeout *timeout, void *data);
+
 void _timeout_create(_AlarmTimeout *timeout,
                      const char *app_id, const char *key,
                      const char *uri, const char *params,
@@ -68,6 +80,11 @@ bool _timeout_clear(const char *app_id, const char *key, bool public_bus);
 
 bool _timeout_delete(const char *app_id, const char *key, bool public_bus);
 
+void _timeout_delivered(const char *table_id);
+
+bool _timeout_foreach(const char *app_id, bool public_bus, _TimeoutFunc func,
+                      void *data);
+
 /**
  * Request RTC alarm for next wakeup timeout.
  *
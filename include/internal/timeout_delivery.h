@@ -0,0 +1,34 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _TIMEOUT_DELIVERY_H_
+#define _TIMEOUT_DELIVERY_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "timeout_alarm.h"
+#include "clock.h"
+
+bool timeout_delivery_queued(const char *table_id);
+
+void timeout_delivery_push(const _AlarmTimeout *timeout);
+
+void timeout_delivery_log_resume(ClockNs resume_time);
+
+gchar *timeout_delivery_get_stats(void);
+
+#endif // _TIMEOUT_DELIVERY_H_
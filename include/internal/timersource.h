@@ -19,11 +19,15 @@
 #define _TIMERSOURCE_H_
 
 #include <stdbool.h>
+#include <time.h>
 
 typedef struct _GTimerSource GTimerSource;
 
 GTimerSource *g_timer_source_new(guint interval_ms, guint granularity_ms);
 
+GTimerSource *g_timer_source_new_clock(guint interval_ms, guint granularity_ms,
+                                       clockid_t clock);
+
 GTimerSource *g_timer_source_new_seconds(guint interval_seconds);
 
 void g_timer_source_set_interval_seconds(GTimerSource *tsource,
@@ -0,0 +1,45 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+typedef struct _TimerWheelTimer TimerWheelTimer;
+
+TimerWheelTimer *TimerWheelAdd(GMainContext *context, guint interval_ms,
+                               guint granularity_ms, GSourceFunc func,
+                               gpointer data);
+
+TimerWheelTimer *TimerWheelAddSeconds(GMainContext *context,
+                                      guint interval_sec, GSourceFunc func,
+                                      gpointer data);
+
+void TimerWheelSetInterval(TimerWheelTimer *timer, guint interval_ms,
+                           bool from_poll);
+
+void TimerWheelSetIntervalSeconds(TimerWheelTimer *timer, guint interval_sec,
+                                  bool from_poll);
+
+guint TimerWheelGetInterval(TimerWheelTimer *timer);
+
+void TimerWheelRemove(TimerWheelTimer *timer);
+
+gchar *TimerWheelGetStats(void);
+
+#endif // _TIMERWHEEL_H_
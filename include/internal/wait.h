@@ -21,6 +21,7 @@
 #define _GNU_SOURCE
 #include <pthread.h>
 #include <stdbool.h>
+#include <glib.h>
 
 typedef struct
 {
@@ -49,4 +50,19 @@ void WaitObjectBroadcastUnlocked(WaitObj *obj);
 
 bool WaitObjectIsLocked(WaitObj *obj);
 
+typedef struct
+{
+    int fd;                                   /* eventfd */
+} WaitEvent;
+
+bool WaitEventInit(WaitEvent *event);
+void WaitEventDestroy(WaitEvent *event);
+
+void WaitEventSignal(WaitEvent *event);
+bool WaitEventClear(WaitEvent *event);
+
+int WaitEventWait(WaitEvent *event, int ms);
+
+GSource *WaitEventSourceNew(WaitEvent *event);
+
 #endif
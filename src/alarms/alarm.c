@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 #include <luna-service2/lunaservice.h>
 
 #include <json.h>
@@ -61,13 +62,32 @@
  * @{
  */
 
+/*
+ * The alarms are stored in the timeout table of timeout_alarm.c, one
+ * (ALARM_TIMEOUT_APP_ID, "key-id") row each, which also rebases and expires
+ * them. The row's params carry what is needed to deliver the alarm:
+ *
+ * {"alarmId":1,"key":"appkey","serviceName":"com.palm.X",
+ *  "applicationName":"com.palm.app.x"}
+ *
+ * This file keeps an index of them by id and by serviceName/key, rebuilt
+ * from the table on start, and the subscriptions that cannot be persisted.
+ *
+ * Older versions kept their own copy of the alarms in alarms.xml. It is
+ * moved into the timeout table on the first start, and removed once every
+ * alarm in it made it there.
+ */
+
 /**
 * @brief A single alarm.
 */
 typedef struct
 {
     int         id;
-    time_t      expiry;    /*< Number of seconds since 1/1/1970 epoch */
+    time_t      expiry;    /*< Number of seconds since 1/1/1970 epoch, as
+                            *  requested. The timeout table has the expiry
+                            *  after time changes.
+                            */
 
     bool        calendar;  /*< If true, Alarm represents a calendar time.
                             *  (i.e. Jan 5, 2009, 10:00am).
@@ -84,32 +104,37 @@ typedef struct
 } _Alarm;
 
 /**
-* @brief Alarm queue.
+* @brief Key of the serviceName/key index.
 */
 typedef struct
 {
+    char       *serviceName;
+    char       *key;
+} _AlarmKey;
 
-    GSequence *alarms;
+/**
+* @brief Alarm queue.
+*/
+typedef struct
+{
     uint32_t seq_id;   // points to the next available id
 
-    char *alarm_db;
+    GHashTable *by_id;     // id -> _Alarm
+    GHashTable *by_key;    // _AlarmKey -> GList of _Alarm, for alarmQuery
+
+    char *alarm_db;    // alarms.xml, only read to migrate it
 } _AlarmQueue;
 
 _AlarmQueue *gAlarmQueue = NULL;
 
-static bool alarm_queue_add(uint32_t id, const char *key,
-                            bool calendar, time_t expiry,
-                            const char *serviceName, const char *applicationName,
-                            bool subscribe, LSMessage *message);
-
 bool alarm_queue_new(const char *key, bool calendar, time_t expiry,
                      const char *serviceName, const char *applicationName,
                      bool subscribe, LSMessage *message,
                      int *ret_id);
 
-static bool alarm_write_db(void);
-static void notify_alarms(void);
-static void update_alarms(void);
+static gint alarm_expiry_cmp_func(_Alarm *a, _Alarm *b);
+static void alarm_queue_remove(_Alarm *alarm);
+static char *alarm_timeout_key(_Alarm *alarm);
 
 
 /**
@@ -216,48 +241,19 @@ alarmAdd(LSHandle *sh, LSMessage *message, void *ctx)
         goto error;
     }
 
-    /*****************
-     * Use new timeout API
-     */
-    {
-        char *timeout_key = g_strdup_printf("%s-%d", key, alarm_id);
-        _AlarmTimeout timeout;
-        _timeout_create(&timeout, "com.palm.sleep", timeout_key,
-                        "luna://com.palm.sleep/time/internalAlarmFired",
-                        "{}",
-                        false /*public bus*/,
-                        true /*wakeup*/,
-                        "" /*activity_id*/,
-                        0 /*activity_duration_ms*/,
-                        false /*calendar*/,
-                        alarm_time);
-
-        retVal = _timeout_set(&timeout);
-
-        g_free(timeout_key);
-
-        if (!retVal)
-        {
-            goto error;
-        }
-    }
-    /*****************/
-
     /* Send alarm id of sucessful alarm add. */
-    GString *reply = g_string_sized_new(512);
-    g_string_append_printf(reply, "{\"alarmId\":%d", alarm_id);
+    GString *reply = LSReplyBuffer();
+    LSReplyAppendPrintf(reply, "{\"alarmId\":%d", alarm_id);
 
     if (subscribe_json)
     {
-        g_string_append_printf(reply, ",\"subscribed\":%s",
-                               subscribe ? "true" : "false");
+        LSReplyAppendPrintf(reply, ",\"subscribed\":%s",
+                            subscribe ? "true" : "false");
     }
 
-    g_string_append_printf(reply, "}");
+    g_string_append_c(reply, '}');
 
     retVal = LSMessageReply(sh, message, reply->str, &lserror);
-
-    g_string_free(reply, TRUE);
     goto cleanup;
 error:
     retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
@@ -429,49 +425,20 @@ alarmAddCalendar(LSHandle *sh, LSMessage *message, void *ctx)
         goto error;
     }
 
-    /*****************
-     * Use new timeout API
-     */
-    {
-        char *timeout_key = g_strdup_printf("%s-%d", key, alarm_id);
-        _AlarmTimeout timeout;
-        _timeout_create(&timeout, "com.palm.sleep", timeout_key,
-                        "luna://com.palm.sleep/time/internalAlarmFired",
-                        "{}",
-                        false /*public bus*/,
-                        true /*wakeup*/,
-                        "" /*activity_id*/,
-                        0 /*activity_duration_ms*/,
-                        true /*calendar*/,
-                        alarm_time);
-
-        retVal = _timeout_set(&timeout);
-
-        g_free(timeout_key);
-
-        if (!retVal)
-        {
-            goto error;
-        }
-    }
-    /*****************/
-
     /* Send alarm id of sucessful alarm add. */
-    GString *reply = g_string_sized_new(512);
-    g_string_append_printf(reply, "{\"alarmId\":%d", alarm_id);
+    GString *reply = LSReplyBuffer();
+    LSReplyAppendPrintf(reply, "{\"alarmId\":%d", alarm_id);
 
     if (subscribe_json)
     {
-        g_string_append_printf(reply, ",\"subscribed\":%s",
-                               subscribe ? "true" : "false");
+        LSReplyAppendPrintf(reply, ",\"subscribed\":%s",
+                            subscribe ? "true" : "false");
     }
 
-    g_string_append_printf(reply, "}");
+    g_string_append_c(reply, '}');
 
     retVal = LSMessageReply(sh, message, reply->str, &lserror);
 
-    g_string_free(reply, TRUE);
-
     goto cleanup;
 error:
     retVal = LSMessageReply(sh, message, "{\"returnValue\":false,"
@@ -524,8 +491,7 @@ alarmQuery(LSHandle *sh, LSMessage *message, void *ctx)
     bool retVal;
     const char *serviceName, *key;
     struct json_object *object;
-    GString *alarm_str = NULL;
-    GString *buf = NULL;
+    GString *reply;
 
     object = json_tokener_parse(LSMessageGetPayload(message));
 
@@ -544,41 +510,35 @@ alarmQuery(LSHandle *sh, LSMessage *message, void *ctx)
         goto invalid_format;
     }
 
-    alarm_str = g_string_sized_new(512);
-
-    if (!alarm_str)
-    {
-        goto cleanup;
-    }
+    reply = LSReplyBuffer();
+    g_string_append(reply, "{\"alarms\": [");
 
     bool first = true;
-    GSequenceIter *iter = g_sequence_get_begin_iter(gAlarmQueue->alarms);
+    _AlarmKey lookup = { (char *)serviceName, (char *)key };
+    GList *alarms = g_list_copy(g_hash_table_lookup(gAlarmQueue->by_key, &lookup));
+    GList *iter;
 
-    while (!g_sequence_iter_is_end(iter))
-    {
-        _Alarm *alarm = (_Alarm *)g_sequence_get(iter);
-        GSequenceIter *next = g_sequence_iter_next(iter);
+    /* Report them in the order they expire */
+    alarms = g_list_sort(alarms, (GCompareFunc)alarm_expiry_cmp_func);
 
-        if (alarm && alarm->serviceName && alarm->key &&
-                (strcmp(alarm->serviceName, serviceName) == 0) &&
-                (strcmp(alarm->key, key) == 0))
-        {
-            g_string_append_printf(alarm_str,
-                                   "%s{\"alarmId\":%d,\"key\":\"%s\"}",
-                                   first ? "" : "\n,",
-                                   alarm->id, alarm->key);
-            first = false;
-        }
+    for (iter = alarms; iter; iter = iter->next)
+    {
+        _Alarm *alarm = (_Alarm *)iter->data;
 
-        iter = next;
+        LSReplyAppendPrintf(reply, "%s{\"alarmId\":%d,\"key\":\"",
+                            first ? "" : "\n,", alarm->id);
+        LSReplyAppendEscaped(reply, alarm->key);
+        g_string_append(reply, "\"}");
+        first = false;
     }
 
-    buf = g_string_sized_new(512);
-    g_string_append_printf(buf, "{\"alarms\": [%s]}", alarm_str->str);
+    g_list_free(alarms);
+
+    g_string_append(reply, "]}");
 
     LSError lserror;
     LSErrorInit(&lserror);
-    retVal = LSMessageReply(sh, message, buf->str, &lserror);
+    retVal = LSMessageReply(sh, message, reply->str, &lserror);
 
     if (!retVal)
     {
@@ -597,16 +557,6 @@ malformed_json:
     goto cleanup;
 cleanup:
 
-    if (alarm_str)
-    {
-        g_string_free(alarm_str, TRUE);
-    }
-
-    if (buf)
-    {
-        g_string_free(buf, TRUE);
-    }
-
     if (object)
     {
         json_object_put(object);
@@ -652,37 +602,29 @@ alarmRemove(LSHandle *sh, LSMessage *message, void *ctx)
     int alarmId =
         json_object_get_int(json_object_object_get(object, "alarmId"));
 
-    GSequenceIter *iter = g_sequence_get_begin_iter(gAlarmQueue->alarms);
+    _Alarm *alarm = g_hash_table_lookup(gAlarmQueue->by_id,
+                                        GINT_TO_POINTER(alarmId));
 
-    while (!g_sequence_iter_is_end(iter))
+    if (alarm)
     {
-        _Alarm *alarm = (_Alarm *)g_sequence_get(iter);
-        GSequenceIter *next = g_sequence_iter_next(iter);
-
-        if (alarm && alarm->id == alarmId)
-        {
-            char *timeout_key = g_strdup_printf("%s-%d", alarm->key, alarm->id);
-            _timeout_clear("com.palm.sleep", timeout_key,
-                           false /*public_bus*/);
-            g_free(timeout_key);
-
-            g_sequence_remove(iter);
-            found = true;
-        }
+        char *timeout_key = alarm_timeout_key(alarm);
+        _timeout_clear(ALARM_TIMEOUT_APP_ID, timeout_key,
+                       false /*public_bus*/);
+        g_free(timeout_key);
 
-        iter = next;
+        alarm_queue_remove(alarm);
+        found = true;
     }
 
     const char *response;
 
     if (found)
     {
-        alarm_write_db();
-        response = "{\"returnValue\":true}";
+        response = kLSReplySuccess;
     }
     else
     {
-        response = "{\"returnValue\":false}";
+        response = kLSReplyFailure;
     }
 
     retVal = LSMessageReply(sh, message, response, &lserror);
@@ -707,22 +649,6 @@ cleanup:
     return true;
 }
 
-/**
-* @brief Called when a RTC alarm is fired.
-*
-* @param  sh
-* @param  message
-* @param  ctx
-*
-* @retval
-*/
-static bool
-internalAlarmFired(LSHandle *sh, LSMessage *message, void *ctx)
-{
-    update_alarms();
-    return true;
-}
-
 LSMethod time_methods[] =
 {
 
@@ -730,7 +656,6 @@ LSMethod time_methods[] =
     { "alarmAdd", alarmAdd },
     { "alarmQuery", alarmQuery },
     { "alarmRemove", alarmRemove },
-    { "internalAlarmFired", internalAlarmFired },
     { },
 };
 
@@ -739,6 +664,7 @@ alarm_free(_Alarm *a)
 {
     SLEEPDLOG_DEBUG("Freeing alarm with id %d", a->id);
 
+    g_free(a->key);
     g_free(a->serviceName);
     g_free(a->applicationName);
 
@@ -751,19 +677,49 @@ alarm_free(_Alarm *a)
 }
 
 static gint
-alarm_cmp_func(_Alarm *a, _Alarm *b, gpointer data)
+alarm_expiry_cmp_func(_Alarm *a, _Alarm *b)
+{
+    if (a->expiry != b->expiry)
+    {
+        return (a->expiry < b->expiry) ? -1 : 1;
+    }
+
+    return (a->id < b->id) ? -1 :
+           (a->id == b->id) ? 0 : 1;
+}
+
+static guint
+alarm_key_hash(const _AlarmKey *k)
+{
+    return g_str_hash(k->serviceName) * 31 + g_str_hash(k->key);
+}
+
+static gboolean
+alarm_key_equal(const _AlarmKey *a, const _AlarmKey *b)
+{
+    return !strcmp(a->serviceName, b->serviceName) && !strcmp(a->key, b->key);
+}
+
+static void
+alarm_key_free(_AlarmKey *k)
 {
-    return (a->expiry < b->expiry) ? -1 :
-           (a->expiry == b->expiry) ? 0 : 1;
+    g_free(k->serviceName);
+    g_free(k->key);
+    g_free(k);
 }
 
 static int
 alarm_queue_create(void)
 {
     gAlarmQueue = g_new0(_AlarmQueue, 1);
-    gAlarmQueue->alarms = g_sequence_new((GDestroyNotify)alarm_free);
     gAlarmQueue->seq_id = 0;
 
+    gAlarmQueue->by_id = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                         NULL, (GDestroyNotify)alarm_free);
+    gAlarmQueue->by_key = g_hash_table_new_full((GHashFunc)alarm_key_hash,
+                          (GEqualFunc)alarm_key_equal,
+                          (GDestroyNotify)alarm_key_free, NULL);
+
     gAlarmQueue->alarm_db =
         g_build_filename(gSleepConfig.preference_dir, "alarms.xml", NULL);
 
@@ -787,278 +743,180 @@ alarm_print(_Alarm *a)
                     a->id, buf);
 }
 
-static void
-alarm_read_db(void)
+static _Alarm *
+alarm_new(uint32_t id, const char *key, bool calendar_time, time_t expiry,
+          const char *serviceName, const char *applicationName)
 {
-    bool retVal;
+    _Alarm *alarm = g_new0(_Alarm, 1);
 
-    xmlDocPtr db = xmlReadFile(gAlarmQueue->alarm_db, NULL, 0);
+    alarm->key = g_strdup(key);
+    alarm->id = id;
+    alarm->calendar = calendar_time;
+    alarm->expiry = expiry;
+    alarm->serviceName = g_strdup(serviceName);
+    alarm->applicationName = g_strdup(applicationName);
 
-    if (!db)
-    {
-        return;
-    }
+    return alarm;
+}
 
-    xmlNodePtr cur = xmlDocGetRootElement(db);
-    xmlNodePtr sub;
+/**
+* @brief Put an alarm into the indexes. An alarm with the same id is replaced.
+*/
+static void
+alarm_queue_insert(_Alarm *alarm)
+{
+    _Alarm *old = g_hash_table_lookup(gAlarmQueue->by_id,
+                                      GINT_TO_POINTER(alarm->id));
 
-    if (!cur)
+    if (old)
     {
-        return;
+        alarm_queue_remove(old);
     }
 
-    sub = cur->children;
-
-    while (sub != NULL)
+    if (alarm->id >= gAlarmQueue->seq_id)
     {
-        if (!xmlStrcmp(sub->name, (const xmlChar *)"alarm"))
-        {
-            xmlChar *id = xmlGetProp(sub, (const xmlChar *)"id");
-            xmlChar *key = xmlGetProp(sub, (const xmlChar *)"key");
-            xmlChar *expiry = xmlGetProp(sub, (const xmlChar *)"expiry");
-            xmlChar *calendar = xmlGetProp(sub, (const xmlChar *)"calendar");
-            xmlChar *service = xmlGetProp(sub, (const xmlChar *)"serviceName");
-            xmlChar *app = xmlGetProp(sub, (const xmlChar *)"applicationName");
-
-            if (!id || !expiry)
-            {
-                goto clean_round;
-            }
-
-            unsigned long expiry_secs = 0;
-            uint32_t alarmId = 0;
-            bool isCalendar = false;
-
-            if (expiry)
-            {
-                expiry_secs = atol((const char *)expiry);
-            }
-
-            if (id)
-            {
-                alarmId = atoi((const char *)id);
-            }
-
-            if (calendar)
-            {
-                isCalendar = atoi((const char *)calendar) > 0;
-            }
+        gAlarmQueue->seq_id = alarm->id + 1;
+    }
 
-            retVal = alarm_queue_add(alarmId, (const char *)key,
-                                     isCalendar, expiry_secs,
-                                     (const char *)service,
-                                     (const char *)app, false, NULL);
+    g_hash_table_insert(gAlarmQueue->by_id, GINT_TO_POINTER(alarm->id), alarm);
 
-            if (!retVal)
-            {
-                SLEEPDLOG_WARNING(MSGID_ALARM_NOT_SET, 3, PMLOGKFV(ALARM_ID, "%d", alarmId),
-                                  PMLOGKS(SRVC_NAME, service), PMLOGKS(APP_NAME, app), "could not add alarm");
-            }
+    if (alarm->serviceName && alarm->key)
+    {
+        _AlarmKey lookup = { alarm->serviceName, alarm->key };
+        _AlarmKey *k = &lookup;
+        GList *list = NULL;
+        gpointer orig_key, value;
 
-clean_round:
-            xmlFree(expiry);
-            xmlFree(service);
-            xmlFree(app);
+        if (g_hash_table_lookup_extended(gAlarmQueue->by_key, &lookup,
+                                         &orig_key, &value))
+        {
+            k = orig_key;
+            list = value;
+        }
+        else
+        {
+            k = g_new(_AlarmKey, 1);
+            k->serviceName = g_strdup(alarm->serviceName);
+            k->key = g_strdup(alarm->key);
         }
 
-        sub = sub->next;
+        g_hash_table_steal(gAlarmQueue->by_key, k);
+        g_hash_table_insert(gAlarmQueue->by_key, k, g_list_prepend(list, alarm));
     }
-
-    xmlFreeDoc(db);
 }
 
+/**
+* @brief Take an alarm out of the indexes, and free it.
+*/
 static void
-alarm_save(_Alarm *a, FILE *file)
+alarm_queue_remove(_Alarm *alarm)
 {
-    char buf[STD_ASCTIME_BUF_SIZE];
-    struct tm tm;
-
-    gmtime_r(&a->expiry, &tm);
-
-    asctime_r(&tm, buf);
-    g_strchomp(buf);
-
-    fprintf(file, "<alarm id='%d' expiry='%ld' calendar='%d'"
-            " key='%s'"
-            " expiry_text='%s'"
-            " serviceName='%s'"
-            " applicationName='%s'/>\n",
-            a->id, a->expiry, a->calendar,
-            a->key, buf, a->serviceName ? : "", a->applicationName ? : "");
-}
+    if (alarm->serviceName && alarm->key)
+    {
+        _AlarmKey lookup = { alarm->serviceName, alarm->key };
+        gpointer orig_key, value;
 
-static bool
-alarm_write_db(void)
-{
-    bool retVal = false;
+        if (g_hash_table_lookup_extended(gAlarmQueue->by_key, &lookup,
+                                         &orig_key, &value))
+        {
+            GList *list = g_list_remove(value, alarm);
 
-    FILE *file = fopen(gAlarmQueue->alarm_db, "w");
+            g_hash_table_steal(gAlarmQueue->by_key, orig_key);
 
-    if (!file)
-    {
-        goto cleanup;
+            if (list)
+            {
+                g_hash_table_insert(gAlarmQueue->by_key, orig_key, list);
+            }
+            else
+            {
+                alarm_key_free(orig_key);
+            }
+        }
     }
 
-    fprintf(file, "<alarms>\n");
-    g_sequence_foreach(gAlarmQueue->alarms, (GFunc)alarm_save, file);
-    fprintf(file, "</alarms>\n");
-    fclose(file);
-
-    retVal = true;
-cleanup:
-    return retVal;
+    g_hash_table_remove(gAlarmQueue->by_id, GINT_TO_POINTER(alarm->id));
 }
 
 /**
-* @brief Create a new alarm and assign it an new id.
-*
-* @param  key
-* @param  calendar_time
-* @param  expiry
-* @param  serviceName
-* @param  applicationName
-* @param  subscribe
-* @param  message
-* @param ret_id
-*
+* @brief Key of the alarm's row in the timeout table.
 */
-bool
-alarm_queue_new(const char *key, bool calendar_time, time_t expiry,
-                const char *serviceName,
-                const char *applicationName,
-                bool subscribe, LSMessage *message, int *ret_id)
+static char *
+alarm_timeout_key(_Alarm *alarm)
 {
-    bool retVal;
-    uint32_t id = gAlarmQueue->seq_id++;
-
-    if (ret_id)
-    {
-        *ret_id = id;
-    }
-
-    retVal = alarm_queue_add(id, key, calendar_time, expiry,
-                             serviceName, applicationName,
-                             subscribe, message);
-
-    if (retVal)
-    {
-        alarm_write_db();
-    }
-
-    return retVal;
+    return g_strdup_printf("%s-%d", alarm->key, alarm->id);
 }
 
-/**
-* @brief Obtain the next alarm that will fire.
-*
-*/
-_Alarm *
-alarm_queue_get_first(void)
+static void
+alarm_timeout_append_string(GString *params, const char *name,
+                            const char *value)
 {
-    GSequenceIter *seq =
-        g_sequence_get_begin_iter(gAlarmQueue->alarms);
-
-    if (g_sequence_iter_is_end(seq))
+    if (value)
     {
-        return NULL;
+        g_string_append_printf(params, ",\"%s\":\"", name);
+        LSReplyAppendEscaped(params, value);
+        g_string_append_c(params, '"');
     }
-
-    _Alarm *alarm = (_Alarm *)g_sequence_get(seq);
-    return alarm;
 }
 
 /**
-* @brief Adjusts the alarm when a time set occurs and the wall clock
-*        and rtc clock diverge.
-*
-* This should also be called on init, in case of a crash before we
-* were able to adjust the alarms successfully.
-*
+* @brief Store the alarm in the timeout table, which schedules it.
 */
-void
-recalculate_alarms(time_t delta)
+static bool
+alarm_timeout_set(_Alarm *alarm)
 {
-    if (delta)
-    {
-        /* Adjust each fixed time alarm by the delta.
-         * i.e. 5 seconds in the future + delta = T + 5 + delta
-         */
-        GSequenceIter *iter = g_sequence_get_begin_iter(gAlarmQueue->alarms);
-
-        while (!g_sequence_iter_is_end(iter))
-        {
-            _Alarm *alarm = (_Alarm *)g_sequence_get(iter);
-            GSequenceIter *next = g_sequence_iter_next(iter);
-
-            if (alarm && !alarm->calendar)
-            {
-                alarm->expiry += delta;
-            }
-
-            iter = next;
-        }
+    char *timeout_key = alarm_timeout_key(alarm);
+    GString *params = g_string_sized_new(128);
+    _AlarmTimeout timeout;
+    bool retVal;
 
-        /* resort */
-        g_sequence_sort(gAlarmQueue->alarms,
-                        (GCompareDataFunc)alarm_cmp_func, NULL);
+    g_string_append_printf(params, "{\"alarmId\":%d", alarm->id);
+    alarm_timeout_append_string(params, "key", alarm->key);
+    alarm_timeout_append_string(params, "serviceName", alarm->serviceName);
+    alarm_timeout_append_string(params, "applicationName",
+                                alarm->applicationName);
+    g_string_append_c(params, '}');
 
-        /* persist */
-        alarm_write_db();
-    }
+    alarm_print(alarm);
 
-    return;
-}
+    _timeout_create(&timeout, ALARM_TIMEOUT_APP_ID, timeout_key,
+                    ALARM_TIMEOUT_URI,
+                    params->str,
+                    false /*public bus*/,
+                    true /*wakeup*/,
+                    "" /*activity_id*/,
+                    0 /*activity_duration_ms*/,
+                    alarm->calendar,
+                    alarm->expiry);
 
-void
-update_alarms_delta(time_t delta)
-{
-    /* If the time changed, we need to readjust alarms,
-     * and persist the changes.
-     */
-    if (delta)
-    {
-        recalculate_alarms(delta);
-    }
+    retVal = _timeout_set(&timeout);
 
-    /* Trigger any pending alarms and remove them from the queue.
-     */
-    notify_alarms();
-}
+    g_string_free(params, TRUE);
+    g_free(timeout_key);
 
-/**
-* @brief Set the next alarm.
-*/
-static void
-update_alarms(void)
-{
-    update_alarms_delta(0);
+    return retVal;
 }
 
 /**
-* @brief Add a new alarm to the queue.
+* @brief Create a new alarm, assign it a new id and schedule it.
 *
-* @param  id
+* @param  key
 * @param  calendar_time
 * @param  expiry
 * @param  serviceName
 * @param  applicationName
+* @param  subscribe
+* @param  message
+* @param ret_id
 *
-* @retval
 */
-static bool
-alarm_queue_add(uint32_t id, const char *key, bool calendar_time,
-                time_t expiry, const char *serviceName,
+bool
+alarm_queue_new(const char *key, bool calendar_time, time_t expiry,
+                const char *serviceName,
                 const char *applicationName,
-                bool subscribe, LSMessage *message)
+                bool subscribe, LSMessage *message, int *ret_id)
 {
-    _Alarm *alarm = g_new0(_Alarm, 1);
-
-    alarm->key = g_strdup(key);
-    alarm->id = id;
-    alarm->calendar = calendar_time;
-    alarm->expiry = expiry;
-    alarm->serviceName = g_strdup(serviceName);
-    alarm->applicationName = g_strdup(applicationName);
+    uint32_t id = gAlarmQueue->seq_id;
+    _Alarm *alarm;
 
     if (subscribe)
     {
@@ -1073,23 +931,37 @@ alarm_queue_add(uint32_t id, const char *key, bool calendar_time,
             LSErrorFree(&lserror);
             goto error;
         }
+    }
+
+    alarm = alarm_new(id, key, calendar_time, expiry, serviceName,
+                      applicationName);
 
+    if (subscribe)
+    {
         LSMessageRef(message);
         alarm->message = message;
     }
 
-    alarm_print(alarm);
+    /* Indexed first, since an alarm that is already due fires right away */
+    alarm_queue_insert(alarm);
 
-    if (alarm->id >= gAlarmQueue->seq_id)
+    if (!alarm_timeout_set(alarm))
     {
-        gAlarmQueue->seq_id = alarm->id + 1;
+        alarm = g_hash_table_lookup(gAlarmQueue->by_id, GINT_TO_POINTER(id));
+
+        if (alarm)
+        {
+            alarm_queue_remove(alarm);
+        }
+
+        goto error;
     }
 
-    g_sequence_insert_sorted(gAlarmQueue->alarms,
-                             alarm, (GCompareDataFunc)alarm_cmp_func,
-                             NULL);
+    if (ret_id)
+    {
+        *ret_id = id;
+    }
 
-    update_alarms();
     return true;
 error:
     return false;
@@ -1106,35 +978,29 @@ static void
 fire_alarm(_Alarm *alarm)
 {
     bool retVal;
-    char buf_alarm[STD_ASCTIME_BUF_SIZE];
-
-    struct tm tm_alarm;
-    time_t rtctime = 0;
-
-    gmtime_r(&alarm->expiry, &tm_alarm);
-    asctime_r(&tm_alarm, buf_alarm);
-
-    nyx_system_query_rtc_time(GetNyxSystemDevice(), &rtctime);
 
-    SLEEPDLOG_DEBUG("fire_alarm() : Alarm (%s %s %s) fired at %s (rtc %ld)",
+    SLEEPDLOG_DEBUG("fire_alarm() : Alarm (%s %s %s) fired",
                     alarm->serviceName,
-                    alarm->applicationName, alarm->key, buf_alarm, rtctime);
+                    alarm->applicationName, alarm->key);
 
-    GString *payload = g_string_sized_new(255);
-    g_string_append_printf(payload, "{\"alarmId\":%d,\"fired\":true", alarm->id);
+    GString *payload = LSReplyBuffer();
+    LSReplyAppendPrintf(payload, "{\"alarmId\":%d,\"fired\":true", alarm->id);
 
     if (alarm->key)
     {
-        g_string_append_printf(payload, ",\"key\":\"%s\"", alarm->key);
+        g_string_append(payload, ",\"key\":\"");
+        LSReplyAppendEscaped(payload, alarm->key);
+        g_string_append_c(payload, '"');
     }
 
     if (alarm->applicationName && strcmp(alarm->applicationName, "") != 0)
     {
-        g_string_append_printf(payload, ",\"applicationName\":\"%s\"",
-                               alarm->applicationName);
+        g_string_append(payload, ",\"applicationName\":\"");
+        LSReplyAppendEscaped(payload, alarm->applicationName);
+        g_string_append_c(payload, '"');
     }
 
-    g_string_append_printf(payload, "}");
+    g_string_append_c(payload, '}');
 
     LSError lserror;
     LSErrorInit(&lserror);
@@ -1165,42 +1031,207 @@ fire_alarm(_Alarm *alarm)
             LSErrorFree(&lserror);
         }
     }
+}
 
-    g_string_free(payload, TRUE);
+static int
+alarm_timeout_id(const char *params)
+{
+    struct json_object *object = json_tokener_parse(params);
+    struct json_object *id;
+    int ret = -1;
+
+    if (object && json_object_object_get_ex(object, "alarmId", &id))
+    {
+        ret = json_object_get_int(id);
+    }
+
+    if (object)
+    {
+        json_object_put(object);
+    }
+
+    return ret;
 }
 
 /**
-* @brief Send message to each expired alarm.
+* @brief Called by the timeout engine when the row of an alarm expired. The
+* engine deletes the row itself once this returns.
+*
+* @param  params
+*
+* @retval false if there is no such alarm
+*/
+bool
+alarm_timeout_fired(const char *params)
+{
+    _Alarm *alarm;
+
+    g_return_val_if_fail(gAlarmQueue != NULL, false);
+
+    alarm = g_hash_table_lookup(gAlarmQueue->by_id,
+                                GINT_TO_POINTER(alarm_timeout_id(params)));
+
+    if (!alarm)
+    {
+        return false;
+    }
+
+    fire_alarm(alarm);
+    alarm_queue_remove(alarm);
+
+    return true;
+}
+
+/**
+* @brief Index an alarm read back from the timeout table.
+*/
+static void
+alarm_timeout_load_one(const _AlarmTimeout *timeout, void *data)
+{
+    struct json_object *object = json_tokener_parse(timeout->params);
+    struct json_object *id;
+
+    /* Rows of older versions carry no params, they are migrated below */
+    if (object && json_object_object_get_ex(object, "alarmId", &id))
+    {
+        alarm_queue_insert(alarm_new(json_object_get_int(id),
+                                     json_object_get_string(
+                                         json_object_object_get(object, "key")),
+                                     timeout->calendar, timeout->expiry,
+                                     json_object_get_string(
+                                         json_object_object_get(object, "serviceName")),
+                                     json_object_get_string(
+                                         json_object_object_get(object, "applicationName"))));
+    }
+
+    if (object)
+    {
+        json_object_put(object);
+    }
+}
+
+/**
+* @brief Add the alarms of an alarms.xml written by older versions.
 */
 static void
-notify_alarms(void)
+alarm_xml_import(GHashTable *alarms)
 {
-    time_t now;
-    bool fired = false;
+    xmlDocPtr db = xmlReadFile(gAlarmQueue->alarm_db, NULL, 0);
 
-    now = reference_time();
+    if (!db)
+    {
+        return;
+    }
 
-    GSequenceIter *iter = g_sequence_get_begin_iter(gAlarmQueue->alarms);
+    xmlNodePtr cur = xmlDocGetRootElement(db);
+    xmlNodePtr sub;
 
-    while (!g_sequence_iter_is_end(iter))
+    if (!cur)
     {
-        _Alarm *alarm = (_Alarm *)g_sequence_get(iter);
-        GSequenceIter *next = g_sequence_iter_next(iter);
+        xmlFreeDoc(db);
+        return;
+    }
+
+    sub = cur->children;
 
-        if (alarm && alarm->expiry <= now)
+    while (sub != NULL)
+    {
+        if (!xmlStrcmp(sub->name, (const xmlChar *)"alarm"))
         {
-            fire_alarm(alarm);
-            g_sequence_remove(iter);
+            xmlChar *id = xmlGetProp(sub, (const xmlChar *)"id");
+            xmlChar *key = xmlGetProp(sub, (const xmlChar *)"key");
+            xmlChar *expiry = xmlGetProp(sub, (const xmlChar *)"expiry");
+            xmlChar *calendar = xmlGetProp(sub, (const xmlChar *)"calendar");
+            xmlChar *service = xmlGetProp(sub, (const xmlChar *)"serviceName");
+            xmlChar *app = xmlGetProp(sub, (const xmlChar *)"applicationName");
+
+            if (!id || !expiry)
+            {
+                goto clean_round;
+            }
 
-            fired = true;
+            uint32_t alarmId = atoi((const char *)id);
+
+            g_hash_table_replace(alarms, GUINT_TO_POINTER(alarmId),
+                                 alarm_new(alarmId, (const char *)key,
+                                           calendar && atoi((const char *)calendar) > 0,
+                                           atol((const char *)expiry),
+                                           (const char *)service,
+                                           (const char *)app));
+
+clean_round:
+            xmlFree(id);
+            xmlFree(key);
+            xmlFree(expiry);
+            xmlFree(calendar);
+            xmlFree(service);
+            xmlFree(app);
         }
 
-        iter = next;
+        sub = sub->next;
+    }
+
+    xmlFreeDoc(db);
+}
+
+static void
+alarm_migrate_insert(gpointer id, _Alarm *alarm, gpointer data)
+{
+    alarm_queue_insert(alarm);
+}
+
+static void
+alarm_migrate_set(gpointer id, _Alarm *alarm, bool *migrated)
+{
+    /* Skip the ones that already fired while scheduling the others */
+    if (g_hash_table_lookup(gAlarmQueue->by_id, id) != alarm)
+    {
+        return;
     }
 
-    if (fired)
+    if (!alarm_timeout_set(alarm))
     {
-        alarm_write_db();
+        *migrated = false;
+
+        SLEEPDLOG_WARNING(MSGID_ALARM_NOT_SET, 3, PMLOGKFV(ALARM_ID, "%d", alarm->id),
+                          PMLOGKS(SRVC_NAME, alarm->serviceName),
+                          PMLOGKS(APP_NAME, alarm->applicationName),
+                          "could not add alarm");
+        alarm_queue_remove(alarm);
+    }
+}
+
+/**
+* @brief Move the alarms of older versions into the timeout table. Their
+* rows there carry no params yet and are replaced. alarms.xml is kept for the
+* next start if any of them could not be stored.
+*/
+static void
+alarm_migrate(void)
+{
+    GHashTable *alarms = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                         NULL, (GDestroyNotify)alarm_free);
+    bool migrated = true;
+
+    alarm_xml_import(alarms);
+
+    if (g_hash_table_size(alarms))
+    {
+        SLEEPDLOG_DEBUG("Moving %d alarms to the timeout table",
+                        g_hash_table_size(alarms));
+
+        /* All of them are indexed before the first is scheduled, which may
+         * fire due ones */
+        g_hash_table_foreach(alarms, (GHFunc)alarm_migrate_insert, NULL);
+        g_hash_table_foreach(alarms, (GHFunc)alarm_migrate_set, &migrated);
+        g_hash_table_steal_all(alarms);
+    }
+
+    g_hash_table_destroy(alarms);
+
+    if (migrated)
+    {
+        unlink(gAlarmQueue->alarm_db);
     }
 }
 
@@ -1221,13 +1252,14 @@ alarm_init(void)
     }
 
     alarm_queue_create();
-    alarm_read_db();
 
-    update_alarms();
+    _timeout_foreach(ALARM_TIMEOUT_APP_ID, false /*public_bus*/,
+                     alarm_timeout_load_one, NULL);
+    alarm_migrate();
+
     return 0;
 error:
     return -1;
 }
 
 /* @} END OF OldInterface */
-
@@ -36,12 +36,16 @@
 #include "smartsql.h"
 
 #include "lunaservice_utils.h"
+#include "lunabus.h"
 #include "json_utils.h"
 
-#include "timersource.h"
+#include "timerwheel.h"
 #include "reference_time.h"
+#include "clock.h"
+#include "activity.h"
 
 #include "timeout_alarm.h"
+#include "timeout_delivery.h"
 #include "sleepd_config.h"
 #include "init.h"
 #include "timesaver.h"
@@ -89,10 +93,22 @@ typedef enum
 } AlarmTimeoutType;
 
 static LSHandle *lsh = NULL, *webos_sh = NULL;
+static LunaBusCategory sTimeoutCategory;
 static sqlite3 *timeout_db = NULL;
-static GTimerSource *sTimerCheck = NULL;
+static TimerWheelTimer *sTimerCheck = NULL;
 static time_t invalid_time = (time_t) - 1;
 
+/* End of the keep-alive activity taken for the last fired timeouts */
+static ClockNs sKeepAliveUntil = 0;
+
+/* The fast path handled the last kernel resume, its resume signal has nothing
+ * left to do */
+static bool sResumeHandled = false;
+
+/* t1key of the delivered timeouts whose rows are not deleted yet */
+static GHashTable *sDelivered = NULL;
+static guint sDeleteSource = 0;
+
 /*
    Database Schema.
 
@@ -103,10 +119,13 @@ static time_t invalid_time = (time_t) - 1;
    expiry is the absolute system time of when the next event is to be
    fired. It is GMT, so all math performed with it needs to be in GMT
    as well.
+
+   t1key is never reused: a fired timeout keeps its row until it is
+   delivered, and is known to timeout_delivery.c by its t1key meanwhile.
    */
 #if CREATE_DB_WITHOUT_ACTIVITY_COLUMNS
 static const char *kSysTimeoutDatabaseCreateSchema = "\
-CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
+CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY AUTOINCREMENT,\
                                          app_id TEXT,\
                                          key TEXT,\
                                          uri TEXT,\
@@ -117,7 +136,7 @@ CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
                                          expiry DATE);";
 #else
 static const char *kSysTimeoutDatabaseCreateSchema = "\
-CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
+CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY AUTOINCREMENT,\
                                          app_id TEXT,\
                                          key TEXT,\
                                          uri TEXT,\
@@ -133,6 +152,17 @@ CREATE TABLE IF NOT EXISTS AlarmTimeout (t1key INTEGER PRIMARY KEY,\
 static const char *kSysTimeoutDatabaseCreateIndex = "\
 CREATE INDEX IF NOT EXISTS expiry_index on AlarmTimeout (expiry);";
 
+/* Tables of older versions may reuse the t1key of a deleted row */
+static const char *kSysTimeoutDatabaseUpgrade[] =
+{
+    "BEGIN TRANSACTION;",
+    "ALTER TABLE AlarmTimeout RENAME TO AlarmTimeoutOld;",
+    NULL,   // kSysTimeoutDatabaseCreateSchema
+    "INSERT INTO AlarmTimeout SELECT * FROM AlarmTimeoutOld;",
+    "DROP TABLE AlarmTimeoutOld;",
+    "COMMIT;",
+};
+
 /**
  * @defgroup NewInterface   New interface
  * @ingroup RTCAlarms
@@ -176,54 +206,55 @@ static void _rtc_alarm_fired(nyx_device_handle_t handle,
 
 
 /**
-* @brief Response to timeout message.
-*
-* @param  sh
-* @param  msg
-* @param  ctx
-*
-* @retval
+* @brief How long the system should stay awake to process the timeout. The
+*        client can provide a specific duration, otherwise we use a common
+*        default.
 */
-static bool
-_timeout_response(LSHandle *sh, LSMessage *message, void *ctx)
+static int
+_timeout_keep_alive_ms(const _AlarmTimeout *timeout)
 {
-    struct json_object *object;
-
-    object = json_tokener_parse(LSMessageGetPayload(message));
-
-    if (!object)
+    if (
+        timeout->activity_id && strlen(timeout->activity_id) &&
+        0 != timeout->activity_duration_ms
+    )
     {
-        goto cleanup;
+        return timeout->activity_duration_ms;
     }
 
-    struct json_object *retValObject;
+    return TIMEOUT_KEEP_ALIVE_MS;
+}
 
-    retValObject = json_object_object_get(object, "returnValue");
+/**
+* @brief Give the system some time to process a batch of fired timeouts before
+*        going to sleep again, with one activity for the whole batch.
+*
+* It lasts as long as the longest any of them asked for, and never ends
+* before the one of the previous batch would have, since starting it again
+* replaces it.
+*
+* @param  duration_ms
+*/
+static void
+_timeout_keep_alive(int duration_ms)
+{
+    ClockNs now = ClockNsNow();
+    ClockNs until = now + ClockNsFromMs(duration_ms);
 
-    if (retValObject)
+    if (until < sKeepAliveUntil)
     {
-        bool retVal = json_object_get_boolean(retValObject);
-
-        if (!retVal)
-        {
-            SLEEPDLOG_WARNING(MSGID_TIMEOUT_MSG_ERR, 1, PMLOGKS(CAUSE,
-                              LSMessageGetPayload(message)),
-                              "Could not send timeout message");
-        }
+        until = sKeepAliveUntil;
+        duration_ms = ClockNsToMs(until - now + CLOCK_NS_PER_MS - 1);
     }
 
-cleanup:
-
-    if (object)
+    if (PwrEventActivityStart(DEFAULT_ACTIVITY_ID, duration_ms))
     {
-        json_object_put(object);
+        sKeepAliveUntil = until;
     }
-
-    return true;
 }
 
 /**
-* @brief Send a message to the (uri, params) associated with the timeout.
+* @brief Queue the timeout's message to the (uri, params) for delivery, see
+*        timeout_delivery.c.
 *
 * @param  timeout
 */
@@ -232,54 +263,11 @@ _timeout_fire(_AlarmTimeout *timeout)
 {
     g_return_if_fail(timeout_db != NULL);
     g_return_if_fail(timeout != NULL);
-    GString *payload = g_string_new("");
 
     SLEEPDLOG_DEBUG("_timeout_fire : %s (%s => %s)", timeout->app_id,
                     timeout->key, timeout->uri);
 
-    LSHandle *sh = NULL;
-    bool retVal;
-    LSError lserror;
-    LSErrorInit(&lserror);
-
-    sh = GetWebosLunaServiceHandle();
-
-    /* Give system some time to process this timeout before
-     * going to sleep again. The client can provide a specific
-     * activity ID and duration. Otherwise we use a common default.
-     */
-    if (
-        timeout->activity_id && strlen(timeout->activity_id) &&
-        0 != timeout->activity_duration_ms
-    )
-    {
-        g_string_append_printf(payload,
-                               "{\"id\":\"%s\","
-                               "\"duration_ms\":%d}", timeout->activity_id, timeout->activity_duration_ms);
-    }
-    else
-    {
-        g_string_append_printf(payload,
-                               "{\"id\":\"%s\","
-                               "\"duration_ms\":%d}", DEFAULT_ACTIVITY_ID, TIMEOUT_KEEP_ALIVE_MS);
-    }
-
-    LSCallOneReply(sh, "palm://com.webos.service.power/suspend/activityStart",
-                   payload->str, NULL, NULL, NULL, NULL);
-
-    // Call Luna-service bus with the uri/params.
-    retVal = LSCallFromApplicationOneReply(sh,
-                                           timeout->uri, timeout->params, timeout->app_id,
-                                           _timeout_response, NULL, NULL, &lserror);
-
-    if (!retVal)
-    {
-        SLEEPDLOG_DEBUG("_timeout_fire() : Could not send (%s %s): %s", timeout->uri,
-                        timeout->params, lserror.message);
-        LSErrorFree(&lserror);
-    }
-
-    g_string_free(payload, TRUE);
+    timeout_delivery_push(timeout);
 }
 
 bool _sql_step_finalize(const char *func, sqlite3_stmt *st)
@@ -307,6 +295,18 @@ bool _sql_step_finalize(const char *func, sqlite3_stmt *st)
     return true;
 }
 
+/**
+* @brief Whether the row is the one of a fired timeout, left in the table until
+*        it is delivered and deleted.
+*/
+static bool
+_timeout_fired(const char *table_id)
+{
+    return timeout_delivery_queued(table_id) ||
+           (sDelivered && g_hash_table_contains(sDelivered,
+                   GINT_TO_POINTER(atoi(table_id))));
+}
+
 /**
 * @brief Adjusts all relative (non-calendar alarms) by the delta amount.
 *
@@ -350,6 +350,12 @@ _recalculate_timeouts(time_t delta)
             const char *table_id = table[base];
             const char *expiry = table[base + 1];
 
+            /* Already due, and on its way */
+            if (_timeout_fired(table_id))
+            {
+                continue;
+            }
+
             time_t new_expiry = atoi(expiry) + delta;
 
             /* Delete the timeout.*/
@@ -376,10 +382,95 @@ _recalculate_timeouts(time_t delta)
 }
 
 /**
-* @brief Trigger all expired timeouts.
+* @brief Delete the rows of the delivered timeouts, in one transaction with one
+*        statement instead of one of each per row.
+*/
+static gboolean
+_delete_delivered(gpointer data)
+{
+    sqlite3_stmt *st = NULL;
+    const char *tail;
+    GHashTableIter iter;
+    gpointer t1key;
+    int rc;
+
+    sDeleteSource = 0;
+
+    rc = sqlite3_prepare_v2(timeout_db,
+                            "DELETE FROM AlarmTimeout WHERE t1key=$1", -1, &st, &tail);
+
+    if (rc != SQLITE_OK)
+    {
+        /* They stay skipped, and go with the next batch */
+        SLEEPDLOG_WARNING(MSGID_SQLITE_PREPARE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
+                          "");
+        return FALSE;
+    }
+
+    smart_sql_exec(timeout_db, "BEGIN TRANSACTION;");
+
+    g_hash_table_iter_init(&iter, sDelivered);
+
+    while (g_hash_table_iter_next(&iter, &t1key, NULL))
+    {
+        sqlite3_bind_int(st, 1, GPOINTER_TO_INT(t1key));
+        rc = sqlite3_step(st);
+
+        if (rc != SQLITE_DONE)
+        {
+            SLEEPDLOG_WARNING(MSGID_SQLITE_STEP_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc), "");
+        }
+
+        sqlite3_reset(st);
+    }
+
+    smart_sql_exec(timeout_db, "COMMIT;");
+
+    sqlite3_finalize(st);
+
+    g_hash_table_remove_all(sDelivered);
+
+    return FALSE;
+}
+
+/**
+* @brief Delete the row of a fired timeout once its delivery is over, either
+*        delivered or dropped as a dead letter.
+*
+* The rows go together from a low priority idle source, so that a batch of
+* deliveries costs one transaction and none of them waits for a write.
+*
+* @param  table_id
+*/
+void
+_timeout_delivered(const char *table_id)
+{
+    g_return_if_fail(timeout_db != NULL);
+    g_return_if_fail(table_id != NULL);
+
+    if (!sDelivered)
+    {
+        sDelivered = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    g_hash_table_add(sDelivered, GINT_TO_POINTER(atoi(table_id)));
+
+    if (!sDeleteSource)
+    {
+        sDeleteSource = g_idle_add_full(G_PRIORITY_LOW, _delete_delivered, NULL,
+                                        NULL);
+    }
+}
+
+/**
+* @brief Trigger all expired timeouts. Their rows stay in the table until
+*        they are delivered, see _timeout_delivered(), so the ones already on
+*        their way are skipped.
+*
+* @param  resume_time  Time of the kernel resume that led here, or NULL
 */
 static void
-_expire_timeouts(void)
+_expire_timeouts(const ClockNs *resume_time)
 {
     int rc;
     char **table;
@@ -388,11 +479,15 @@ _expire_timeouts(void)
     int i;
     time_t now;
     int base;
+    int keep_alive_ms = 0;
+    int noQueued = 0;
     _AlarmTimeout timeout;
 
     now = reference_time();
 
-    /* Find all expired calendar timeouts */
+    /* Find all expired timeouts. The walk runs along expiry_index and stops at
+     * the first timeout still in the future, so it costs as many rows as are
+     * due, whatever the size of the table. */
     char *sqlquery = g_strdup_printf(
                          "SELECT t1key,app_id,key,uri,params,public_bus,activity_id,activity_duration_ms FROM AlarmTimeout "
                          "WHERE expiry<=%ld ORDER BY expiry", now);
@@ -422,6 +517,13 @@ _expire_timeouts(void)
         timeout.params = table[base + 4];
         timeout.public_bus = atoi(table[base + 5]);
 
+        if (_timeout_fired(timeout.table_id))
+        {
+            continue;
+        }
+
+        noQueued++;
+
         /*
           If we have an upgraded db where the activity_id and activity_duration_ms columns were
           added and there were existing rows then these two fields will return NULL.
@@ -433,29 +535,28 @@ _expire_timeouts(void)
         }
 
         timeout.activity_id =
-            table[base + 6]; // _timeout_fire can handle a null activity_id
+            table[base + 6]; // _timeout_keep_alive_ms can handle a null activity_id
         timeout.activity_duration_ms = table[base + 7] ? atoi(table[base + 7]) :
-                                       0; // _timeout_fire will fill-in the default duration
+                                       0; // _timeout_keep_alive_ms will fill-in the default duration
+
+        keep_alive_ms = MAX(keep_alive_ms, _timeout_keep_alive_ms(&timeout));
 
         /* Fire timeout */
         _timeout_fire(&timeout);
+    }
 
-        /* Delete the timeout.*/
-        sqlite3_stmt *st = NULL;
-        const char *tail;
-        rc = sqlite3_prepare_v2(timeout_db,
-                                "DELETE FROM AlarmTimeout WHERE t1key=$1", -1, &st, &tail);
+    if (noQueued)
+    {
+        _timeout_keep_alive(keep_alive_ms);
+    }
 
-        if (rc == SQLITE_OK)
-        {
-            rc = sqlite3_bind_int(st, 1, atoi(timeout.table_id));
-            _sql_step_finalize(__func__, st);
-        }
-        else
-        {
-            SLEEPDLOG_WARNING(MSGID_SQLITE_PREPARE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
-                              "");
-        }
+    if (resume_time && noQueued)
+    {
+        timeout_delivery_log_resume(*resume_time);
+    }
+    else if (resume_time)
+    {
+        SLEEPDLOG_DEBUG("No timeout due on resume");
     }
 
     sqlite3_free_table(table);
@@ -612,7 +713,7 @@ _queue_next_timeout(bool set_callback_fn)
 
     if (!noRows)
     {
-        g_timer_source_set_interval_seconds(sTimerCheck, 60 * 60, true);
+        TimerWheelSetIntervalSeconds(sTimerCheck, 60 * 60, true);
     }
     else
     {
@@ -629,7 +730,7 @@ _queue_next_timeout(bool set_callback_fn)
             wakeInSeconds = MAX_WAKEUP_SECS;
         }
 
-        g_timer_source_set_interval_seconds(sTimerCheck, wakeInSeconds, true);
+        TimerWheelSetIntervalSeconds(sTimerCheck, wakeInSeconds, true);
     }
 
     sqlite3_free_table(table);
@@ -642,23 +743,90 @@ bool queue_next_wakeup()
 }
 
 /**
-* @brief Trigger expired timeouts, and queue up the next one.
+* @brief Shift relative timeouts, legacy alarms included, if the system time
+*        moved against the reference clock.
 */
 static void
-_update_timeouts(void)
+_rebase_timeouts(void)
 {
     time_t delta = update_reference_time(NULL, NULL);
 
     if (delta != invalid_time && delta != 0)
     {
         _recalculate_timeouts(delta);
-        void update_alarms_delta(time_t delta);
-        update_alarms_delta(delta);
     }
+}
+
+/**
+* @brief Trigger expired timeouts, and queue up the next one.
+*/
+static void
+_update_timeouts(void)
+{
+    _rebase_timeouts();
+
+    _expire_timeouts(NULL);
 
-    _expire_timeouts();
+    _queue_next_timeout(true);
+}
 
+/**
+* @brief Low priority part of the resume path: queue up the next RTC alarm
+*        and non-wakeup timer once everything urgent has been dispatched.
+*/
+static gboolean
+_resume_bookkeeping(gpointer data)
+{
     _queue_next_timeout(true);
+    return FALSE;
+}
+
+/**
+* @brief High priority part of the resume path: deliver all due timeouts
+*        before anything else runs on the main loop.
+*
+* @param  data  ClockNs of the kernel resume
+*/
+static gboolean
+_resume_fast_path(gpointer data)
+{
+    sResumeHandled = true;
+
+    _rebase_timeouts();
+
+    _expire_timeouts((const ClockNs *)data);
+
+    g_idle_add_full(G_PRIORITY_LOW, _resume_bookkeeping, NULL, NULL);
+
+    return FALSE;
+}
+
+/**
+* @brief Called by the suspend state machine right after the kernel resumed.
+*
+* Fires due timeouts from a high priority source on the main loop instead of
+* waiting for the resume signal to travel through the hub, and defers the
+* database bookkeeping to a low priority idle source. May be called from the
+* suspend thread, all the work is done on the main loop.
+*/
+bool
+update_timeouts_on_resume(void)
+{
+    if (!timeout_db)
+    {
+        return false;
+    }
+
+    ClockNs *resume_time = g_new(ClockNs, 1);
+    *resume_time = ClockNsNow();
+
+    GSource *source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_HIGH);
+    g_source_set_callback(source, _resume_fast_path, resume_time, g_free);
+    g_source_attach(source, GetMainLoopContext());
+    g_source_unref(source);
+
+    return true;
 }
 
 void _timeout_create(_AlarmTimeout *timeout,
@@ -752,6 +920,8 @@ _free_timeout_fields(_AlarmTimeoutNonConst *timeout)
 *
 * @retval true if at least one row matched
 *
+* Rows of fired timeouts are left out: they are deleted once delivered.
+*
 * Call _free_timeout_fields() with the timeout when done.
 *
 */
@@ -764,6 +934,8 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
     char **table;
     int noRows, noCols;
     char *zErrMsg;
+    int i;
+    int base;
 
     if (!app_id)
     {
@@ -796,30 +968,35 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
     }
     else
     {
-        if (noRows)
+        if (noRows > 1)
+        {
+            SLEEPDLOG_DEBUG("%d rows for (%s, %s, %s)", noRows,
+                            app_id, key, public_bus ? "public" : "private");
+        }
+
+        for (i = 0, base = noCols; i < noRows && !ret; i++, base += noCols)
         {
-            if (noRows > 1)
+            if (_timeout_fired(table[base]))
             {
-                SLEEPDLOG_DEBUG("%d rows for (%s, %s, %s)", noRows,
-                                app_id, key, public_bus ? "public" : "private");
+                continue;
             }
 
-            timeout->table_id               = g_strdup(table[ noCols      ]);
-            timeout->app_id                 = g_strdup(table[ noCols +  1 ]);
-            timeout->key                    = g_strdup(table[ noCols +  2 ]);
-            timeout->uri                    = g_strdup(table[ noCols +  3 ]);
-            timeout->params                 = g_strdup(table[ noCols +  4 ]);
-            timeout->public_bus             = atoi(table[ noCols +  5 ]);
-            timeout->wakeup                 = atoi(table[ noCols +  6 ]);
-            timeout->calendar               = atoi(table[ noCols +  7 ]);
-            timeout->expiry                 = atol(table[ noCols +  8 ]);
+            timeout->table_id               = g_strdup(table[ base      ]);
+            timeout->app_id                 = g_strdup(table[ base +  1 ]);
+            timeout->key                    = g_strdup(table[ base +  2 ]);
+            timeout->uri                    = g_strdup(table[ base +  3 ]);
+            timeout->params                 = g_strdup(table[ base +  4 ]);
+            timeout->public_bus             = atoi(table[ base +  5 ]);
+            timeout->wakeup                 = atoi(table[ base +  6 ]);
+            timeout->calendar               = atoi(table[ base +  7 ]);
+            timeout->expiry                 = atol(table[ base +  8 ]);
 
             // The two "activity" fields could be null if this is an
             // old record where the new columns were inserted.
-            timeout->activity_id            = table[noCols + 9] ? g_strdup(
-                                                  table[noCols +  9]) : g_strdup(DEFAULT_ACTIVITY_ID);
-            timeout->activity_duration_ms   = table[noCols + 10] ? atoi(
-                                                  table[noCols + 10]) : TIMEOUT_KEEP_ALIVE_MS;
+            timeout->activity_id            = table[base + 9] ? g_strdup(
+                                                  table[base +  9]) : g_strdup(DEFAULT_ACTIVITY_ID);
+            timeout->activity_duration_ms   = table[base + 10] ? atoi(
+                                                  table[base + 10]) : TIMEOUT_KEEP_ALIVE_MS;
 
             ret = true;
         }
@@ -831,6 +1008,73 @@ _timeout_read(_AlarmTimeoutNonConst *timeout, const char *app_id,
 
 } // _timeout_read
 
+/**
+* @brief Call func for every timeout of (app_id, public_bus), in expiry order.
+*
+* @param  app_id
+* @param  public_bus
+* @param  func
+* @param  data
+*
+* @retval false if the timeouts could not be read
+*/
+bool
+_timeout_foreach(const char *app_id, bool public_bus, _TimeoutFunc func,
+                 void *data)
+{
+    sqlite3_stmt *st = NULL;
+    const char *tail;
+    _AlarmTimeout timeout;
+    int rc;
+
+    g_return_val_if_fail(timeout_db != NULL, false);
+
+    if (!app_id)
+    {
+        app_id = "";
+    }
+
+    rc = sqlite3_prepare_v2(timeout_db,
+                            "SELECT t1key,app_id,key,uri,params,public_bus,wakeup,calendar,expiry,activity_id,activity_duration_ms FROM AlarmTimeout "
+                            "WHERE app_id=$1 AND public_bus=$2 ORDER BY expiry", -1, &st, &tail);
+
+    if (rc != SQLITE_OK)
+    {
+        SLEEPDLOG_WARNING(MSGID_SQLITE_PREPARE_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc),
+                          "");
+        return false;
+    }
+
+    sqlite3_bind_text(st, 1, app_id, strlen(app_id), SQLITE_STATIC);
+    sqlite3_bind_int(st, 2, public_bus);
+
+    while ((rc = sqlite3_step(st)) == SQLITE_ROW)
+    {
+        timeout.table_id = (const char *)sqlite3_column_text(st, 0);
+        timeout.app_id = (const char *)sqlite3_column_text(st, 1);
+        timeout.key = (const char *)sqlite3_column_text(st, 2);
+        timeout.uri = (const char *)sqlite3_column_text(st, 3);
+        timeout.params = (const char *)sqlite3_column_text(st, 4);
+        timeout.public_bus = sqlite3_column_int(st, 5);
+        timeout.wakeup = sqlite3_column_int(st, 6);
+        timeout.calendar = sqlite3_column_int(st, 7);
+        timeout.expiry = sqlite3_column_int64(st, 8);
+        timeout.activity_id = (const char *)sqlite3_column_text(st, 9);
+        timeout.activity_duration_ms = sqlite3_column_int(st, 10);
+
+        func(&timeout, data);
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        SLEEPDLOG_WARNING(MSGID_SQLITE_STEP_FAIL, 1, PMLOGKFV(ERRCODE, "%d", rc), "");
+    }
+
+    sqlite3_finalize(st);
+
+    return rc == SQLITE_DONE;
+}
+
 /**
 * @brief Delete an existing timeout.
 *
@@ -1198,7 +1442,7 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
     calendar = (timeout_type == AlarmTimeoutCalendar);
 
     bool kept_existing = false;
-    char *payload;
+    GString *reply;
 
     if (keep_existing && _timeout_exists(app_id, key, public_bus))
     {
@@ -1221,29 +1465,26 @@ _alarm_timeout_set(LSHandle *sh, LSMessage *message, void *ctx)
         }
     }
 
-    char *escaped_key = g_strescape(key, NULL);
+    reply = LSReplyBuffer();
+    g_string_append(reply, "{\"returnValue\":true,\"key\":\"");
+    LSReplyAppendEscaped(reply, key);
+    g_string_append_c(reply, '"');
 
     if (keep_existing_provided)
     {
-        payload = g_strdup_printf(
-                      "{\"returnValue\":true,\"key\":\"%s\",\"kept_existing\":%s}", escaped_key,
-                      kept_existing ? "true" : "false");
-    }
-    else
-    {
-        payload = g_strdup_printf(
-                      "{\"returnValue\":true,\"key\":\"%s\"}", escaped_key);
+        LSReplyAppendPrintf(reply, ",\"kept_existing\":%s",
+                            kept_existing ? "true" : "false");
     }
 
-    retVal = LSMessageReply(sh, message, payload, NULL);
+    g_string_append_c(reply, '}');
+
+    retVal = LSMessageReply(sh, message, reply->str, NULL);
 
     if (!retVal)
     {
         SLEEPDLOG_WARNING(MSGID_LSMESSAGE_REPLY_FAIL, 0, "could not send reply");
     }
 
-    g_free(payload);
-    g_free(escaped_key);
     goto cleanup;
 
 activity_duration_too_short:
@@ -1357,19 +1598,18 @@ _alarm_timeout_clear(LSHandle *sh, LSMessage *message, void *ctx)
     }
     else
     {
-        char *escaped_key = g_strescape(key, NULL);
-        char *payload = g_strdup_printf(
-                            "{\"returnValue\":true,\"key\":\"%s\"}", escaped_key);
+        GString *reply = LSReplyBuffer();
 
-        retVal = LSMessageReply(sh, message, payload, &lserror);
+        g_string_append(reply, "{\"returnValue\":true,\"key\":\"");
+        LSReplyAppendEscaped(reply, key);
+        g_string_append(reply, "\"}");
+
+        retVal = LSMessageReply(sh, message, reply->str, &lserror);
 
         if (!retVal)
         {
             LSErrorPrint(&lserror, stderr);
         }
-
-        g_free(payload);
-        g_free(escaped_key);
     }
 
     goto cleanup;
@@ -1412,10 +1652,62 @@ static LSMethod timeout_methods[] =
 static bool
 _resume_callback(LSHandle *sh, LSMessage *message, void *ctx)
 {
+    /* The fast path is dispatched before the signal is back from the hub */
+    if (sResumeHandled)
+    {
+        sResumeHandled = false;
+        return true;
+    }
+
     _update_timeouts();
     return true;
 }
 
+/**
+* @brief Move a table of older versions, whose t1key may be reused, to the
+*        current schema. It is left as it is if that fails.
+*/
+static void
+_timeout_db_upgrade(void)
+{
+    char **table;
+    int noRows, noCols;
+    char *zErrMsg;
+    bool upgrade;
+    int rc;
+    int i;
+
+    rc = sqlite3_get_table(timeout_db,
+                           "SELECT sql FROM sqlite_master WHERE type='table' AND name='AlarmTimeout'",
+                           &table, &noRows, &noCols, &zErrMsg);
+
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_free(zErrMsg);
+        return;
+    }
+
+    upgrade = noRows && table[1] && !strstr(table[1], "AUTOINCREMENT");
+    sqlite3_free_table(table);
+
+    if (!upgrade)
+    {
+        return;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(kSysTimeoutDatabaseUpgrade); i++)
+    {
+        if (!smart_sql_exec(timeout_db, kSysTimeoutDatabaseUpgrade[i] ? :
+                            kSysTimeoutDatabaseCreateSchema))
+        {
+            SLEEPDLOG_WARNING(MSGID_DB_UPGRADE_FAIL, 0,
+                              "could not upgrade the timeout table");
+            smart_sql_exec(timeout_db, "ROLLBACK;");
+            return;
+        }
+    }
+}
+
 static int
 _alarms_timeout_init(void)
 {
@@ -1445,6 +1737,8 @@ _alarms_timeout_init(void)
 
     g_free(timeout_db_name);
 
+    _timeout_db_upgrade();
+
     retVal = smart_sql_exec(timeout_db, kSysTimeoutDatabaseCreateSchema);
 
     if (!retVal)
@@ -1468,13 +1762,12 @@ _alarms_timeout_init(void)
     LSError lserror;
     LSErrorInit(&lserror);
 
-    // Registering as "/timeout" category with com.palm.sleep (to be deprecated soon)
-    if (!LSRegisterCategory(lsh, "/timeout", timeout_methods, NULL, NULL,
-                            &lserror))
+    // "/timeout" on com.palm.sleep (to be deprecated soon)
+    if (!LunaBusCategoryAddName(&sTimeoutCategory, lsh, "com.palm.sleep",
+                                "/timeout"))
     {
-        SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 1, PMLOGKS(ERRTEXT, lserror.message),
-                        "could not register category");
-        LSErrorFree(&lserror);
+        SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 0,
+                        "could not publish /timeout, service not registered");
         goto error;
     }
 
@@ -1507,15 +1800,12 @@ _alarms_timeout_init(void)
 
         if (retVal)
         {
-
-            if (!LSRegisterCategory(webos_sh,
-                                    "/", timeout_methods, NULL, NULL,
-                                    &lserror))
+            // "/" on com.webos.service.alarm
+            if (!LunaBusCategoryAddName(&sTimeoutCategory, webos_sh,
+                                        "com.webos.service.alarm", "/"))
             {
-                SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 1, PMLOGKS(ERRTEXT, lserror.message),
-                                "could not register category");
-                LSErrorFree(&lserror);
-                goto error;
+                SLEEPDLOG_WARNING(MSGID_CATEGORY_REG_FAIL, 0,
+                                  "could not publish / on com.webos.service.alarm");
             }
         }
     }
@@ -1526,6 +1816,15 @@ _alarms_timeout_init(void)
         LSErrorFree(&lserror);
     }
 
+    if (!LunaBusRegisterCategory(&sTimeoutCategory, timeout_methods, NULL,
+                                 &lserror))
+    {
+        SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 1, PMLOGKS(ERRTEXT, lserror.message),
+                        "could not register category");
+        LSErrorFree(&lserror);
+        goto error;
+    }
+
     retVal = (update_reference_time(NULL, NULL) != invalid_time);
 
     if (!retVal)
@@ -1534,16 +1833,13 @@ _alarms_timeout_init(void)
     }
 
 #ifndef WITHOUT_RTC_WATCHDOG
-    GTimerSource *timer_rtc_check = g_timer_source_new_seconds(5 * 60);
-    g_source_set_callback((GSource *)timer_rtc_check,
-                          (GSourceFunc)_rtc_check, NULL, NULL);
-    g_source_attach((GSource *)timer_rtc_check, GetMainLoopContext());
+    /* The watchdog only catches a drifting RTC, it can wait for a shared wakeup */
+    TimerWheelAdd(GetMainLoopContext(), 5 * 60 * 1000, 30 * 1000,
+                  (GSourceFunc)_rtc_check, NULL);
 #endif
 
-    sTimerCheck = g_timer_source_new_seconds(60 * 60);
-    g_source_set_callback((GSource *)sTimerCheck,
-                          (GSourceFunc)_timer_check, NULL, NULL);
-    g_source_attach((GSource *)sTimerCheck, GetMainLoopContext());
+    sTimerCheck = TimerWheelAddSeconds(GetMainLoopContext(), 60 * 60,
+                                       _timer_check, NULL);
 
     /** To support the deprecated interface */
     int alarm_init(void);
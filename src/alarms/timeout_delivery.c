@@ -0,0 +1,475 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file timeout_delivery.c
+ *
+ * @brief Deliver fired timeouts from the main loop, apart from the expiry pass.
+ *
+ * The expiry pass only queues what is due. Deliveries are then sent from an
+ * idle source, with at most alarm_delivery_max_inflight calls waiting for
+ * their reply. The deliveries of one app_id go out one at a time in the order
+ * they expired. A delivery its target refuses (returnValue false, or no reply)
+ * is sent again after alarm_delivery_backoff_ms, doubled on each attempt, and
+ * dropped as a dead letter after alarm_delivery_retries retries.
+ *
+ * The row of a timeout stays in the table until its delivery is over, so
+ * the ones still queued or waiting for a retry are sent again after a
+ * restart. An activity keeps the system awake for the retries due soon.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "logging.h"
+#include "sleepd_config.h"
+#include "clock.h"
+#include "activity.h"
+#include "timeout_delivery.h"
+
+#define LOG_DOMAIN "ALARMS-DELIVERY: "
+
+/* A target that neither replies nor disconnects counts as refusing */
+#define DELIVERY_REPLY_TIMEOUT_MS   30000
+
+#define DELIVERY_BACKOFF_MAX_MS     (10 * 60 * 1000)
+
+#define DELIVERY_ACTIVITY_ID        "com.webos.service.alarm.timeout_retry"
+
+/* Longest a retry keeps the system awake, and the time it is given to send */
+#define DELIVERY_HOLD_MAX_MS        30000
+#define DELIVERY_HOLD_SEND_MS       1000
+
+/* Beyond this many doublings the backoff is at its maximum anyway */
+#define DELIVERY_BACKOFF_MAX_SHIFT  31
+
+/**
+ * @brief A fired timeout on its way to its target.
+ */
+typedef struct
+{
+    char       *table_id;   /*< t1key of its row */
+    char       *app_id;     /*< May be NULL */
+    char       *key;
+    char       *uri;
+    char       *params;
+    int         attempts;
+} _Delivery;
+
+/**
+ * @brief The deliveries of one app_id.
+ */
+typedef struct
+{
+    char       *app_id;     /*< "" for the timeouts without one */
+    GQueue      pending;    /*< _Delivery, in expiry order */
+    bool        busy;       /*< Its head is in flight or waiting for a retry */
+} _DeliveryApp;
+
+static GHashTable *sApps = NULL;   // app_id -> _DeliveryApp
+static GHashTable *sQueued = NULL;   // table_id -> _Delivery
+static GQueue sReady = G_QUEUE_INIT;   // _DeliveryApp that can send their next
+static guint sDispatchSource = 0;
+static guint sInFlight = 0;
+static guint sRetrying = 0;   // deliveries that failed at least once
+static ClockNs sRetryHoldUntil = 0;
+static ClockNs sResumeTime = 0;   // kernel resume whose first send is not logged yet
+
+static guint64 sNumQueued = 0;
+static guint64 sNumDelivered = 0;
+static guint64 sNumRetried = 0;
+static guint64 sNumDeadLetters = 0;
+
+static void _delivery_send(_DeliveryApp *app, _Delivery *delivery);
+
+static void
+_delivery_free(_Delivery *delivery)
+{
+    g_free(delivery->table_id);
+    g_free(delivery->app_id);
+    g_free(delivery->key);
+    g_free(delivery->uri);
+    g_free(delivery->params);
+    g_free(delivery);
+}
+
+static void
+_delivery_app_free(_DeliveryApp *app)
+{
+    g_queue_foreach(&app->pending, (GFunc)_delivery_free, NULL);
+    g_queue_clear(&app->pending);
+    g_free(app->app_id);
+    g_free(app);
+}
+
+static guint
+_delivery_max_inflight(void)
+{
+    return MAX(gSleepConfig.alarm_delivery_max_inflight, 1);
+}
+
+/**
+ * @brief Send the heads of ready apps while there is room in flight. Sends at
+ * most one round of alarm_delivery_max_inflight per iteration of the main
+ * loop, so a large batch does not hold it up.
+ */
+static gboolean
+_delivery_dispatch(gpointer data)
+{
+    guint budget = _delivery_max_inflight();
+
+    while (budget && sInFlight < _delivery_max_inflight() &&
+            !g_queue_is_empty(&sReady))
+    {
+        _DeliveryApp *app = g_queue_pop_head(&sReady);
+
+        app->busy = true;
+        _delivery_send(app, g_queue_peek_head(&app->pending));
+        budget--;
+    }
+
+    if (sInFlight < _delivery_max_inflight() && !g_queue_is_empty(&sReady))
+    {
+        return TRUE;
+    }
+
+    sDispatchSource = 0;
+    return FALSE;
+}
+
+static void
+_delivery_schedule(void)
+{
+    if (!sDispatchSource && !g_queue_is_empty(&sReady) &&
+            sInFlight < _delivery_max_inflight())
+    {
+        sDispatchSource = g_idle_add(_delivery_dispatch, NULL);
+    }
+}
+
+/**
+ * @brief Keep the system awake until a retry in backoff_ms is sent, for at
+ * most DELIVERY_HOLD_MAX_MS. A retry further out goes once the system is
+ * awake again, its row keeps it meanwhile. Never shortens the hold of an
+ * earlier retry.
+ */
+static void
+_delivery_retry_hold(guint backoff_ms)
+{
+    ClockNs now = ClockNsNow();
+    ClockNs until = now + ClockNsFromMs(MIN(backoff_ms + DELIVERY_HOLD_SEND_MS,
+                                            DELIVERY_HOLD_MAX_MS));
+
+    if (until > sRetryHoldUntil &&
+            PwrEventActivityStart(DELIVERY_ACTIVITY_ID, ClockNsToMs(until - now)))
+    {
+        sRetryHoldUntil = until;
+    }
+}
+
+/**
+ * @brief Done with the head of the app, move on to its next delivery. Its row
+ * goes now that it no longer needs to survive a restart.
+ */
+static void
+_delivery_next(_DeliveryApp *app)
+{
+    _Delivery *delivery = g_queue_pop_head(&app->pending);
+
+    g_hash_table_remove(sQueued, delivery->table_id);
+    _timeout_delivered(delivery->table_id);
+
+    if (delivery->attempts > 1 && --sRetrying == 0)
+    {
+        PwrEventActivityStop(DELIVERY_ACTIVITY_ID);
+        sRetryHoldUntil = 0;
+    }
+
+    _delivery_free(delivery);
+    app->busy = false;
+
+    if (g_queue_is_empty(&app->pending))
+    {
+        g_hash_table_remove(sApps, app->app_id);
+    }
+    else
+    {
+        g_queue_push_tail(&sReady, app);
+    }
+
+    _delivery_schedule();
+}
+
+static gboolean
+_delivery_retry(gpointer data)
+{
+    _DeliveryApp *app = data;
+
+    g_queue_push_tail(&sReady, app);
+    _delivery_schedule();
+
+    return FALSE;
+}
+
+/**
+ * @brief The head of the app was sent, or refused.
+ */
+static void
+_delivery_done(_DeliveryApp *app, bool delivered)
+{
+    _Delivery *delivery = g_queue_peek_head(&app->pending);
+
+    if (delivered)
+    {
+        sNumDelivered++;
+    }
+    else if (delivery->attempts <= gSleepConfig.alarm_delivery_retries)
+    {
+        int shift = MIN(delivery->attempts - 1, DELIVERY_BACKOFF_MAX_SHIFT);
+        guint backoff_ms = MIN((guint64)MAX(gSleepConfig.alarm_delivery_backoff_ms, 0)
+                               << shift, DELIVERY_BACKOFF_MAX_MS);
+
+        SLEEPDLOG_DEBUG("Retrying (%s, %s) in %u ms", delivery->app_id,
+                        delivery->key, backoff_ms);
+
+        if (delivery->attempts == 1)
+        {
+            sRetrying++;
+        }
+
+        sNumRetried++;
+        _delivery_retry_hold(backoff_ms);
+        g_timeout_add(backoff_ms, _delivery_retry, app);
+        return;
+    }
+    else
+    {
+        sNumDeadLetters++;
+        SLEEPDLOG_WARNING(MSGID_TIMEOUT_DEAD_LETTER, 3,
+                          PMLOGKS(APP_NAME, delivery->app_id),
+                          PMLOGKS("Uri", delivery->uri),
+                          PMLOGKFV("Attempts", "%d", delivery->attempts),
+                          "Dropping a timeout its target keeps refusing");
+    }
+
+    _delivery_next(app);
+}
+
+/**
+ * @brief Reply of the target to a delivery.
+ */
+static bool
+_delivery_response(LSHandle *sh, LSMessage *message, void *ctx)
+{
+    _DeliveryApp *app = ctx;
+    struct json_object *object;
+    struct json_object *retValObject;
+    bool retVal = false;
+
+    object = json_tokener_parse(LSMessageGetPayload(message));
+
+    if (object && json_object_object_get_ex(object, "returnValue", &retValObject))
+    {
+        retVal = json_object_get_boolean(retValObject);
+    }
+    else
+    {
+        /* Targets that do not bother with a returnValue got the message */
+        retVal = object != NULL;
+    }
+
+    if (!retVal)
+    {
+        SLEEPDLOG_WARNING(MSGID_TIMEOUT_MSG_ERR, 1, PMLOGKS(CAUSE,
+                          LSMessageGetPayload(message)),
+                          "Could not send timeout message");
+    }
+
+    if (object)
+    {
+        json_object_put(object);
+    }
+
+    sInFlight--;
+    _delivery_done(app, retVal);
+
+    return true;
+}
+
+/**
+ * @brief Log how long after the kernel resume the first delivery went out.
+ */
+static void
+_delivery_log_resume(const _Delivery *delivery)
+{
+    if (sResumeTime)
+    {
+        SLEEPDLOG_DEBUG("First timeout (\"%s\", \"%s\") sent %" G_GINT64_FORMAT
+                        " ms after resume", delivery->app_id, delivery->key,
+                        ClockNsToMs(ClockNsNow() - sResumeTime));
+        sResumeTime = 0;
+    }
+}
+
+/**
+* @brief Send a message to the (uri, params) associated with the timeout.
+*/
+static void
+_delivery_send(_DeliveryApp *app, _Delivery *delivery)
+{
+    LSHandle *sh = GetWebosLunaServiceHandle();
+    LSMessageToken token;
+    bool retVal;
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    delivery->attempts++;
+
+    SLEEPDLOG_DEBUG("_delivery_send : %s (%s => %s), attempt %d", delivery->app_id,
+                    delivery->key, delivery->uri, delivery->attempts);
+
+    if (!strcmp(delivery->uri, ALARM_TIMEOUT_URI))
+    {
+        /* Alarm of the old interface, alarm.c knows whom to tell */
+        if (!alarm_timeout_fired(delivery->params))
+        {
+            SLEEPDLOG_DEBUG("_delivery_send : No alarm for (%s %s)", delivery->key,
+                            delivery->params);
+        }
+
+        _delivery_log_resume(delivery);
+        _delivery_done(app, true);
+        return;
+    }
+
+    // Call Luna-service bus with the uri/params.
+    retVal = LSCallFromApplicationOneReply(sh,
+                                           delivery->uri, delivery->params, delivery->app_id,
+                                           _delivery_response, app, &token, &lserror);
+
+    if (!retVal)
+    {
+        SLEEPDLOG_DEBUG("_delivery_send : Could not send (%s %s): %s", delivery->uri,
+                        delivery->params, lserror.message);
+        LSErrorFree(&lserror);
+        _delivery_done(app, false);
+        return;
+    }
+
+    sInFlight++;
+    _delivery_log_resume(delivery);
+
+    if (!LSCallSetTimeout(sh, token, DELIVERY_REPLY_TIMEOUT_MS, &lserror))
+    {
+        LSErrorFree(&lserror);
+    }
+}
+
+/**
+ * @brief Whether the row table_id fired and is not delivered yet.
+ */
+bool
+timeout_delivery_queued(const char *table_id)
+{
+    return sQueued && g_hash_table_lookup(sQueued, table_id);
+}
+
+/**
+ * @brief Queue a fired timeout for delivery. Its row is deleted with
+ * _timeout_delivered() once the delivery is over.
+ */
+void
+timeout_delivery_push(const _AlarmTimeout *timeout)
+{
+    const char *app_id = timeout->app_id ? timeout->app_id : "";
+    _Delivery *delivery = g_new0(_Delivery, 1);
+    _DeliveryApp *app;
+
+    delivery->table_id = g_strdup(timeout->table_id);
+    delivery->app_id = g_strdup(timeout->app_id);
+    delivery->key = g_strdup(timeout->key);
+    delivery->uri = g_strdup(timeout->uri);
+    delivery->params = g_strdup(timeout->params);
+
+    if (!sApps)
+    {
+        sApps = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                      (GDestroyNotify)_delivery_app_free);
+        sQueued = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    app = g_hash_table_lookup(sApps, app_id);
+
+    if (!app)
+    {
+        app = g_new0(_DeliveryApp, 1);
+        app->app_id = g_strdup(app_id);
+        g_queue_init(&app->pending);
+        g_hash_table_insert(sApps, app->app_id, app);
+    }
+
+    /* An app already waiting sends this one after the ones before it */
+    if (!app->busy && g_queue_is_empty(&app->pending))
+    {
+        g_queue_push_tail(&sReady, app);
+    }
+
+    g_queue_push_tail(&app->pending, delivery);
+    g_hash_table_insert(sQueued, delivery->table_id, delivery);
+    sNumQueued++;
+
+    _delivery_schedule();
+}
+
+/**
+ * @brief Log when the first delivery after the kernel resume at resume_time
+ * goes out.
+ */
+void
+timeout_delivery_log_resume(ClockNs resume_time)
+{
+    sResumeTime = resume_time;
+}
+
+static void
+_delivery_count_pending(gpointer app_id, _DeliveryApp *app, guint *pending)
+{
+    *pending += g_queue_get_length(&app->pending);
+}
+
+/**
+ * @brief Delivery counters as a JSON string.
+ */
+gchar *
+timeout_delivery_get_stats(void)
+{
+    guint pending = 0;
+
+    if (sApps)
+    {
+        g_hash_table_foreach(sApps, (GHFunc)_delivery_count_pending, &pending);
+    }
+
+    return g_strdup_printf("{\"returnValue\":true,\"queued\":%" G_GUINT64_FORMAT
+                           ",\"delivered\":%" G_GUINT64_FORMAT ",\"retried\":%"
+                           G_GUINT64_FORMAT ",\"deadLetters\":%" G_GUINT64_FORMAT
+                           ",\"pending\":%u,\"inFlight\":%u,\"maxInFlight\":%u}",
+                           sNumQueued, sNumDelivered, sNumRetried, sNumDeadLetters,
+                           pending, sInFlight, _delivery_max_inflight());
+}
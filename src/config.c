@@ -51,16 +51,35 @@ SleepConfiguration gSleepConfig =
     .wait_prepare_suspend_ms = 5000,
     .after_resume_idle_ms = 1000,
     .wait_alarms_s  = 5,
+    .suspend_backoff_max_ms = 60000,
+    .suspend_break_even_ratio = 2,
+    .client_restore_grace_ms = 30000,
+
+    .shutdown_apps_timeout_ms = 15000,
+    .shutdown_services_timeout_ms = 15000,
+    .shutdown_client_deadline_pct = 200,
+    .shutdown_client_deadline_min_ms = 1000,
+    .shutdown_overlap_phases = false,
 
     .suspend_with_charger = 0,
     .enable_idle_check_thread = 0,
+    .direct_signal_delivery = true,
     .disable_rtc_alarms = 0,
+    .alarm_delivery_max_inflight = 8,
+    .alarm_delivery_retries = 3,
+    .alarm_delivery_backoff_ms = 1000,
 
     .is_running = 1,
     .debug = 0,
+    .timer_coalesce_ms = 1000,
 
     .preference_dir = WEBOS_INSTALL_LOCALSTATEDIR "/preferences/com.palm.sleep",
 
+    .wakeup_event_list_path = "/sys/power/wakeup_event_list",
+    .wakeup_sources_path = "/sys/kernel/debug/wakeup_sources",
+    .wakeup_class_dir = "/sys/class/wakeup",
+    .batterycheck_wakeup_path = "/sys/power/batterycheck_wakeup",
+
     .fasthalt = false
 };
 
@@ -89,6 +108,18 @@ do {                                                            \
     else { g_error_free(gerror); }                              \
 } while (0)
 
+#define CONFIG_GET_STRING(keyfile,cat,name,var)                 \
+do {                                                            \
+    char *strVal;                                               \
+    GError *gerror = NULL;                                      \
+    strVal = g_key_file_get_string(keyfile,cat,name,&gerror);   \
+    if (!gerror) {                                              \
+        var = strVal;                                           \
+        SLEEPDLOG_DEBUG(#var " = %s", strVal);                          \
+    }                                                           \
+    else { g_error_free(gerror); }                              \
+} while (0)
+
 static int
 config_init(void)
 {
@@ -122,6 +153,14 @@ config_init(void)
 
         /// [general]
         CONFIG_GET_INT(config_file, "general", "debug", gSleepConfig.debug);
+        CONFIG_GET_INT(config_file, "general", "timer_coalesce_ms",
+                       gSleepConfig.timer_coalesce_ms);
+        CONFIG_GET_INT(config_file, "general", "alarm_delivery_max_inflight",
+                       gSleepConfig.alarm_delivery_max_inflight);
+        CONFIG_GET_INT(config_file, "general", "alarm_delivery_retries",
+                       gSleepConfig.alarm_delivery_retries);
+        CONFIG_GET_INT(config_file, "general", "alarm_delivery_backoff_ms",
+                       gSleepConfig.alarm_delivery_backoff_ms);
 
 
         /// [suspend]
@@ -135,17 +174,46 @@ config_init(void)
                        gSleepConfig.wait_prepare_suspend_ms);
         CONFIG_GET_BOOL(config_file, "suspend", "wait_alarms_ms",
                         gSleepConfig.wait_alarms_s);
+        CONFIG_GET_INT(config_file, "suspend", "suspend_backoff_max_ms",
+                       gSleepConfig.suspend_backoff_max_ms);
+        CONFIG_GET_INT(config_file, "suspend", "suspend_break_even_ratio",
+                       gSleepConfig.suspend_break_even_ratio);
+        CONFIG_GET_INT(config_file, "suspend", "client_restore_grace_ms",
+                       gSleepConfig.client_restore_grace_ms);
 
         CONFIG_GET_BOOL(config_file, "suspend", "suspend_with_charger",
                         gSleepConfig.suspend_with_charger);
 
         CONFIG_GET_BOOL(config_file, "suspend", "enable_idle_check_thread",
                         gSleepConfig.enable_idle_check_thread);
+        CONFIG_GET_BOOL(config_file, "suspend", "direct_signal_delivery",
+                        gSleepConfig.direct_signal_delivery);
         CONFIG_GET_BOOL(config_file, "suspend", "disable_rtc_alarms",
                         gSleepConfig.disable_rtc_alarms);
 
         CONFIG_GET_BOOL(config_file, "suspend", "fasthalt",
                         gSleepConfig.fasthalt);
+
+        CONFIG_GET_STRING(config_file, "suspend", "wakeup_event_list_path",
+                          gSleepConfig.wakeup_event_list_path);
+        CONFIG_GET_STRING(config_file, "suspend", "wakeup_sources_path",
+                          gSleepConfig.wakeup_sources_path);
+        CONFIG_GET_STRING(config_file, "suspend", "wakeup_class_dir",
+                          gSleepConfig.wakeup_class_dir);
+        CONFIG_GET_STRING(config_file, "suspend", "batterycheck_wakeup_path",
+                          gSleepConfig.batterycheck_wakeup_path);
+
+        /// [shutdown]
+        CONFIG_GET_INT(config_file, "shutdown", "apps_timeout_ms",
+                       gSleepConfig.shutdown_apps_timeout_ms);
+        CONFIG_GET_INT(config_file, "shutdown", "services_timeout_ms",
+                       gSleepConfig.shutdown_services_timeout_ms);
+        CONFIG_GET_INT(config_file, "shutdown", "client_deadline_pct",
+                       gSleepConfig.shutdown_client_deadline_pct);
+        CONFIG_GET_INT(config_file, "shutdown", "client_deadline_min_ms",
+                       gSleepConfig.shutdown_client_deadline_min_ms);
+        CONFIG_GET_BOOL(config_file, "shutdown", "overlap_phases",
+                        gSleepConfig.shutdown_overlap_phases);
     }
     else
     {
@@ -75,8 +75,8 @@
 
 typedef struct
 {
-    struct timespec start_time;
-    struct timespec end_time;
+    ClockNs start_time;
+    ClockNs end_time;
     int duration_ms;
 
     char *activity_id;
@@ -127,12 +127,9 @@ _activity_new(const char *activity_id, int duration_ms)
     activity->duration_ms = duration_ms;
 
     // end += duration
-    ClockGetTime(&activity->start_time);
-
-    activity->end_time.tv_sec = activity->start_time.tv_sec;
-    activity->end_time.tv_nsec = activity->start_time.tv_nsec;
-
-    ClockAccumMs(&activity->end_time, activity->duration_ms);
+    activity->start_time = ClockNsNow();
+    activity->end_time = activity->start_time +
+                         ClockNsFromMs(activity->duration_ms);
 
     return activity;
 }
@@ -168,7 +165,7 @@ _activity_free(Activity *activity)
 static int
 _activity_compare(Activity *a, Activity *b)
 {
-    if (ClockTimeIsGreater(&a->end_time, &b->end_time))
+    if (a->end_time > b->end_time)
     {
         return 1;
     }
@@ -180,14 +177,14 @@ _activity_compare(Activity *a, Activity *b)
 
 
 /**
- * @brief Count the number of activities beyond the timespec passed as argument
+ * @brief Count the number of activities ending after the time passed as argument
  *
  * @param from Start counting activities from this time
  *
  * @retval The number of activities beyond "from"
  */
 static int
-_activity_count(struct timespec *from)
+_activity_count(ClockNs from)
 {
     int count = 0;
 
@@ -200,7 +197,7 @@ _activity_count(struct timespec *from)
         Activity *a = (Activity *)iter->data;
 
         // now > activity.end_time
-        if (ClockTimeIsGreater(from, &a->end_time))
+        if (from > a->end_time)
         {
             continue;
         }
@@ -286,10 +283,10 @@ _activity_remove_id(const char *activity_id)
  */
 
 static bool
-_activity_expired(Activity *a, struct timespec *now)
+_activity_expired(Activity *a, ClockNs now)
 {
     // end > now
-    return ClockTimeIsGreater(now, &a->end_time);
+    return now > a->end_time;
 }
 
 
@@ -304,7 +301,7 @@ _activity_expired(Activity *a, struct timespec *now)
  */
 
 static Activity *
-_activity_obtain_unlocked(struct timespec *now, bool getmax)
+_activity_obtain_unlocked(ClockNs now, bool getmax)
 {
     Activity *ret_activity = NULL;
     GList *iter;
@@ -352,7 +349,7 @@ end:
  * @retval Activity
  */
 static Activity *
-_activity_obtain_min_unlocked(struct timespec *now)
+_activity_obtain_min_unlocked(ClockNs now)
 {
     return _activity_obtain_unlocked(now, false);
 }
@@ -367,7 +364,7 @@ _activity_obtain_min_unlocked(struct timespec *now)
  */
 
 static Activity *
-_activity_obtain_max_unlocked(struct timespec *now)
+_activity_obtain_max_unlocked(ClockNs now)
 {
     return _activity_obtain_unlocked(now, true);
 }
@@ -381,7 +378,7 @@ _activity_obtain_max_unlocked(struct timespec *now)
  */
 
 static Activity *
-_activity_obtain_min(struct timespec *now)
+_activity_obtain_min(ClockNs now)
 {
     Activity *ret_activity = NULL;
 
@@ -404,7 +401,7 @@ _activity_obtain_min(struct timespec *now)
 
 
 static Activity *
-_activity_obtain_max(struct timespec *now)
+_activity_obtain_max(ClockNs now)
 {
     Activity *max_activity = NULL;
 
@@ -427,9 +424,8 @@ _activity_obtain_max(struct timespec *now)
  */
 
 static void
-_activity_print(struct timespec *from, struct timespec *now)
+_activity_print(ClockNs from, ClockNs now)
 {
-    struct timespec diff;
     int diff_ms;
 
     pthread_mutex_lock(&activity_mutex);
@@ -441,15 +437,13 @@ _activity_print(struct timespec *from, struct timespec *now)
         Activity *a = (Activity *)iter->data;
 
         // now > activity.end_time
-        if (ClockTimeIsGreater(from, &a->end_time))
+        if (from > a->end_time)
         {
             continue;
         }
 
         // end_time - now
-        ClockDiff(&diff, &a->end_time, now);
-
-        diff_ms = diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+        diff_ms = ClockNsToMs(a->end_time - now);
 
         SLEEPDLOG_DEBUG("_activity_print() : (%s) for %d ms, expiry in %d ms",
                         a->activity_id, a->duration_ms,
@@ -584,6 +578,8 @@ PwrEventActivityStart(const char *activity_id, int duration_ms)
 
     if (retVal)
     {
+        SuspendBackoffReset("activity start");
+
         /*
             Force IdleCheck to run in case this activity is the same as
             the current "long pole" activity but with a shorter life.
@@ -608,6 +604,8 @@ PwrEventActivityStop(const char *activity_id)
 
     _activity_stop(activity_id);
 
+    SuspendBackoffReset("activity end");
+
     ScheduleIdleCheck(0, false);
 }
 
@@ -618,7 +616,7 @@ PwrEventActivityStop(const char *activity_id)
 * @param  now
 */
 void
-PwrEventActivityRemoveExpired(struct timespec *now)
+PwrEventActivityRemoveExpired(ClockNs now)
 {
     pthread_mutex_lock(&activity_mutex);
 
@@ -666,7 +664,7 @@ PwrEventActivityRemoveExpired(struct timespec *now)
  */
 
 int
-PwrEventActivityCount(struct timespec *from)
+PwrEventActivityCount(ClockNs from)
 {
     return _activity_count(from);
 }
@@ -678,12 +676,9 @@ PwrEventActivityCount(struct timespec *from)
 * @param  from
 */
 void
-PwrEventActivityPrintFrom(struct timespec *start)
+PwrEventActivityPrintFrom(ClockNs from)
 {
-    struct timespec now;
-    ClockGetTime(&now);
-
-    _activity_print(start, &now);
+    _activity_print(from, ClockNsNow());
 }
 
 /*
@@ -692,10 +687,9 @@ PwrEventActivityPrintFrom(struct timespec *start)
 void
 PwrEventActivityPrint(void)
 {
-    struct timespec now;
-    ClockGetTime(&now);
+    ClockNs now = ClockNsNow();
 
-    _activity_print(&now, &now);
+    _activity_print(now, now);
 }
 
 /**
@@ -706,7 +700,7 @@ PwrEventActivityPrint(void)
 * @retval
 */
 bool
-PwrEventActivityCanSleep(struct timespec *now)
+PwrEventActivityCanSleep(ClockNs now)
 {
     Activity *a = _activity_obtain_min(now);
     return NULL == a;
@@ -721,7 +715,7 @@ PwrEventActivityCanSleep(struct timespec *now)
  *
  */
 long
-PwrEventActivityGetMaxDuration(struct timespec *now)
+PwrEventActivityGetMaxDuration(ClockNs now)
 {
     Activity *a = _activity_obtain_max(now);
 
@@ -730,15 +724,11 @@ PwrEventActivityGetMaxDuration(struct timespec *now)
         return 0;
     }
 
-    struct timespec diff;
-
-    ClockDiff(&diff, &a->end_time, now);
-
-    return ClockGetMs(&diff);
+    return ClockNsToMs(a->end_time - now);
 }
 
 bool
-PwrEventActivityCheckActivitiesActive(struct timespec *now)
+PwrEventActivityCheckActivitiesActive(ClockNs now)
 {
     if (_activity_obtain_min_unlocked(now) != NULL)
     {
@@ -755,7 +745,7 @@ PwrEventActivityCheckActivitiesActive(struct timespec *now)
  * @param now
  */
 bool
-PwrEventFreezeActivities(struct timespec *now)
+PwrEventFreezeActivities(ClockNs now)
 {
     bool result = true;
 #if 0
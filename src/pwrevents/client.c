@@ -31,6 +31,7 @@
 #include "logging.h"
 #include "sleepd_debug.h"
 #include "client.h"
+#include "client_snapshot.h"
 
 #define LOG_DOMAIN "PWREVENT-CLIENT: "
 
@@ -52,6 +53,44 @@
  */
 static GHashTable    *sClientList = NULL;
 
+/**
+ * @brief Index from client name to client, used by PwrEventClientUnregisterByName.
+ * Keys are owned by the client info.
+ */
+static GHashTable    *sClientNames = NULL;
+
+/**
+ * @brief Dense slot -> client map. Every registered client owns one slot, which
+ * is its bit position in the vote bitsets below. Freed slots are reused.
+ */
+static GPtrArray     *sClientSlots = NULL;
+static GArray        *sFreeSlots = NULL;
+
+#define VOTE_BITS_PER_WORD  64
+
+/**
+ * @brief Bitset indexed by client slot.
+ *
+ * Round-scoped sets (acks/nacks) carry a per-word epoch stamp: a word whose
+ * stamp is older than sVoteEpoch reads as zero, so starting a new voting round
+ * only bumps the epoch instead of touching every client.
+ */
+typedef struct
+{
+    guint64 *words;
+    guint   *stamps;
+    guint    nwords;
+} VoteBitset;
+
+static guint sVoteEpoch = 1;
+
+static VoteBitset sSuspendRequestRequired;
+static VoteBitset sPrepareSuspendRequired;
+static VoteBitset sSuspendRequestAcked;
+static VoteBitset sSuspendRequestNacked;
+static VoteBitset sPrepareSuspendAcked;
+static VoteBitset sPrepareSuspendNacked;
+
 static int sNumSuspendRequest = 0;
 static int sNumSuspendRequestAck = 0;
 static int sNumPrepareSuspend  = 0;
@@ -59,6 +98,178 @@ static int sNumPrepareSuspendAck  = 0;
 
 static int sNumNACK = 0;
 
+static void
+VoteBitsetGrow(VoteBitset *set, guint nwords, bool round_scoped)
+{
+    if (set->nwords >= nwords)
+    {
+        return;
+    }
+
+    set->words = g_renew(guint64, set->words, nwords);
+    memset(set->words + set->nwords, 0, (nwords - set->nwords) * sizeof(guint64));
+
+    if (round_scoped)
+    {
+        set->stamps = g_renew(guint, set->stamps, nwords);
+        memset(set->stamps + set->nwords, 0, (nwords - set->nwords) * sizeof(guint));
+    }
+
+    set->nwords = nwords;
+}
+
+static guint64
+VoteBitsetWord(const VoteBitset *set, guint i)
+{
+    if (i >= set->nwords)
+    {
+        return 0;
+    }
+
+    if (set->stamps && set->stamps[i] != sVoteEpoch)
+    {
+        return 0;
+    }
+
+    return set->words[i];
+}
+
+static bool
+VoteBitsetTest(const VoteBitset *set, int slot)
+{
+    return (VoteBitsetWord(set, slot / VOTE_BITS_PER_WORD) >>
+            (slot % VOTE_BITS_PER_WORD)) & 1;
+}
+
+static void
+VoteBitsetAssign(VoteBitset *set, int slot, bool value)
+{
+    guint i = slot / VOTE_BITS_PER_WORD;
+    guint64 mask = (guint64)1 << (slot % VOTE_BITS_PER_WORD);
+
+    if (i >= set->nwords)
+    {
+        return;
+    }
+
+    if (set->stamps && set->stamps[i] != sVoteEpoch)
+    {
+        set->stamps[i] = sVoteEpoch;
+        set->words[i] = 0;
+    }
+
+    if (value)
+    {
+        set->words[i] |= mask;
+    }
+    else
+    {
+        set->words[i] &= ~mask;
+    }
+}
+
+static int
+VoteBitsetCount(const VoteBitset *set)
+{
+    int count = 0;
+    guint i;
+
+    for (i = 0; i < set->nwords; i++)
+    {
+        count += __builtin_popcountll(VoteBitsetWord(set, i));
+    }
+
+    return count;
+}
+
+/**
+ * @brief Response of the client in the given slot for the current round.
+ */
+static int
+ClientVoteState(int slot, const VoteBitset *acked, const VoteBitset *nacked)
+{
+    if (VoteBitsetTest(acked, slot))
+    {
+        return PWREVENT_CLIENT_ACK;
+    }
+
+    if (VoteBitsetTest(nacked, slot))
+    {
+        return PWREVENT_CLIENT_NACK;
+    }
+
+    return PWREVENT_CLIENT_NORSP;
+}
+
+/**
+ * @brief Hand out the lowest free slot, growing the bitsets when all are in use.
+ */
+static int
+ClientSlotAlloc(struct PwrEventClientInfo *info)
+{
+    int slot;
+
+    if (sFreeSlots->len > 0)
+    {
+        slot = g_array_index(sFreeSlots, int, sFreeSlots->len - 1);
+        g_array_remove_index(sFreeSlots, sFreeSlots->len - 1);
+        g_ptr_array_index(sClientSlots, slot) = info;
+        return slot;
+    }
+
+    slot = sClientSlots->len;
+    g_ptr_array_add(sClientSlots, info);
+
+    guint nwords = slot / VOTE_BITS_PER_WORD + 1;
+    VoteBitsetGrow(&sSuspendRequestRequired, nwords, false);
+    VoteBitsetGrow(&sPrepareSuspendRequired, nwords, false);
+    VoteBitsetGrow(&sSuspendRequestAcked, nwords, true);
+    VoteBitsetGrow(&sSuspendRequestNacked, nwords, true);
+    VoteBitsetGrow(&sPrepareSuspendAcked, nwords, true);
+    VoteBitsetGrow(&sPrepareSuspendNacked, nwords, true);
+
+    return slot;
+}
+
+/**
+ * @brief Release a client's slot, withdrawing it from the current round so the
+ * expected/received counts stay consistent.
+ */
+static void
+ClientSlotFree(struct PwrEventClientInfo *info)
+{
+    int slot = info->slot;
+
+    if (VoteBitsetTest(&sSuspendRequestRequired, slot))
+    {
+        VoteBitsetAssign(&sSuspendRequestRequired, slot, false);
+        sNumSuspendRequest--;
+    }
+
+    if (VoteBitsetTest(&sPrepareSuspendRequired, slot))
+    {
+        VoteBitsetAssign(&sPrepareSuspendRequired, slot, false);
+        sNumPrepareSuspend--;
+    }
+
+    if (VoteBitsetTest(&sSuspendRequestAcked, slot))
+    {
+        sNumSuspendRequestAck--;
+    }
+
+    if (VoteBitsetTest(&sPrepareSuspendAcked, slot))
+    {
+        sNumPrepareSuspendAck--;
+    }
+
+    VoteBitsetAssign(&sSuspendRequestAcked, slot, false);
+    VoteBitsetAssign(&sSuspendRequestNacked, slot, false);
+    VoteBitsetAssign(&sPrepareSuspendAcked, slot, false);
+    VoteBitsetAssign(&sPrepareSuspendNacked, slot, false);
+
+    g_ptr_array_index(sClientSlots, slot) = NULL;
+    g_array_append_val(sFreeSlots, slot);
+}
 
 /**
  * @brief Increment the client's total suspend request NACK response as well as total NACK responses for the
@@ -112,8 +323,11 @@ PwrEventClientInfoCreate(void)
 
     ret_client->clientName = NULL;
     ret_client->clientId = NULL;
-    ret_client->requireSuspendRequest = false;
-    ret_client->requirePrepareSuspend = false;
+    ret_client->applicationName = NULL;
+    ret_client->serviceName = NULL;
+    ret_client->message = NULL;
+    ret_client->slot = ClientSlotAlloc(ret_client);
+    ret_client->restoredFlags = 0;
 
     ret_client->num_NACK_suspendRequest = 0;
     ret_client->num_NACK_prepareSuspend = 0;
@@ -136,9 +350,28 @@ PwrEventClientInfoDestroy(struct PwrEventClientInfo *client)
         return;
     }
 
+    if (client->clientName &&
+            g_hash_table_lookup(sClientNames, client->clientName) == client)
+    {
+        g_hash_table_remove(sClientNames, client->clientName);
+    }
+
+    ClientSlotFree(client);
+
+    if (client->clientName)
+    {
+        ClientSnapshotSchedule();
+    }
+
     g_free(client->clientName);
     g_free(client->clientId);
     g_free(client->applicationName);
+    g_free(client->serviceName);
+
+    if (client->message)
+    {
+        LSMessageUnref(client->message);
+    }
 
     free(client);
 }
@@ -183,6 +416,133 @@ PwrEventClientUnregister(ClientUID uid)
     return true;
 }
 
+/**
+ * @brief Set the name a client identified itself with and index it for
+ * PwrEventClientUnregisterByName.
+ *
+ * @param info Registered client
+ * @param clientName Name of the client
+ */
+
+void
+PwrEventClientSetName(struct PwrEventClientInfo *info, const char *clientName)
+{
+    if (!info)
+    {
+        return;
+    }
+
+    if (info->clientName &&
+            g_hash_table_lookup(sClientNames, info->clientName) == info)
+    {
+        g_hash_table_remove(sClientNames, info->clientName);
+    }
+
+    g_free(info->clientName);
+    info->clientName = g_strdup(clientName);
+
+    if (!info->clientName)
+    {
+        return;
+    }
+
+    /* A client that was restored from the snapshot is back; it keeps the
+     * registrations it had before sleepd restarted. */
+    gchar *restored_uid = g_strconcat(CLIENT_SNAPSHOT_RESTORED_PREFIX,
+                                      info->clientName, NULL);
+    struct PwrEventClientInfo *restored = PwrEventClientLookup(restored_uid);
+
+    if (restored && restored != info)
+    {
+        if ((restored->restoredFlags & CLIENT_SNAPSHOT_SUSPEND_REQUEST) &&
+                !VoteBitsetTest(&sSuspendRequestRequired, info->slot))
+        {
+            VoteBitsetAssign(&sSuspendRequestRequired, info->slot, true);
+            sNumSuspendRequest++;
+        }
+
+        if ((restored->restoredFlags & CLIENT_SNAPSHOT_PREPARE_SUSPEND) &&
+                !VoteBitsetTest(&sPrepareSuspendRequired, info->slot))
+        {
+            VoteBitsetAssign(&sPrepareSuspendRequired, info->slot, true);
+            sNumPrepareSuspend++;
+        }
+
+        SLEEPDLOG_DEBUG("%s re-identified after restart", info->clientName);
+        PwrEventClientUnregister(restored_uid);
+    }
+
+    g_free(restored_uid);
+
+    g_hash_table_replace(sClientNames, info->clientName, info);
+    ClientSnapshotSchedule();
+}
+
+/**
+ * @brief Put back a client registration saved in the client snapshot.
+ *
+ * The placeholder cannot answer a vote, so it does not take part in the suspend
+ * rounds. It only holds the registrations until the client identifies again.
+ *
+ * @param uid Placeholder id for the client
+ * @param clientName Name of the client
+ * @param applicationName Application id of the client, can be NULL
+ * @param serviceName Luna service name of the client, can be NULL
+ * @param flags CLIENT_SNAPSHOT_* flags
+ */
+
+void
+PwrEventClientRestore(ClientUID uid, const char *clientName,
+                      const char *applicationName, const char *serviceName,
+                      guint flags)
+{
+    struct PwrEventClientInfo *info;
+
+    if (!PwrEventClientRegister(uid))
+    {
+        return;
+    }
+
+    info = PwrEventClientLookup(uid);
+    info->clientId = g_strdup(uid);
+    info->applicationName = g_strdup(applicationName);
+    info->serviceName = g_strdup(serviceName);
+    info->restoredFlags = flags;
+    PwrEventClientSetName(info, clientName);
+}
+
+/**
+ * @brief Append a record for every identified client to the client snapshot.
+ */
+
+void
+PwrEventClientSnapshot(GByteArray *buf)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, sClientList);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        struct PwrEventClientInfo *info = value;
+        guint flags = info->restoredFlags;
+
+        if (VoteBitsetTest(&sSuspendRequestRequired, info->slot))
+        {
+            flags |= CLIENT_SNAPSHOT_SUSPEND_REQUEST;
+        }
+
+        if (VoteBitsetTest(&sPrepareSuspendRequired, info->slot))
+        {
+            flags |= CLIENT_SNAPSHOT_PREPARE_SUSPEND;
+        }
+
+        ClientSnapshotAppend(buf, kClientSnapshotPwrEvent, flags, info->clientName,
+                             info->applicationName, info->serviceName);
+    }
+}
+
 /**
  * @brief Function to free the memory allocated for the value used when removing the entry from the
  * GHashTable "sClientList".
@@ -210,6 +570,9 @@ PwrEventClientGetTable(void)
 void
 PwrEventClientTableCreate(void)
 {
+    sClientNames = g_hash_table_new(g_str_hash, g_str_equal);
+    sClientSlots = g_ptr_array_new();
+    sFreeSlots = g_array_new(false, false, sizeof(int));
     sClientList = g_hash_table_new_full(g_str_hash, g_str_equal,
                                         g_free, ClientTableValueDestroy);
 }
@@ -223,6 +586,9 @@ PwrEventClientTableDestroy(void)
 {
     g_hash_table_remove_all(sClientList);
     g_hash_table_destroy(sClientList);
+    g_hash_table_destroy(sClientNames);
+    g_ptr_array_free(sClientSlots, true);
+    g_array_free(sFreeSlots, true);
 }
 
 /**
@@ -245,6 +611,25 @@ PwrEventClientLookup(ClientUID uid)
     return clientInfo;
 }
 
+/**
+ * @brief Retrieve the client that last identified with the given name
+ *
+ * @param clientName
+ *
+ * @retval PwrEventClientInfo
+ */
+
+struct PwrEventClientInfo *
+PwrEventClientLookupByName(const char *clientName)
+{
+    if (!clientName)
+    {
+        return NULL;
+    }
+
+    return g_hash_table_lookup(sClientNames, clientName);
+}
+
 /**
  * Unregister a client by its name
  *
@@ -260,26 +645,16 @@ bool PwrEventClientUnregisterByName(char *clientName)
         return NULL;
     }
 
-    struct PwrEventClientInfo *clientInfo = NULL;
-
-    GHashTableIter iter;
-
-    gpointer key, value;
+    struct PwrEventClientInfo *clientInfo =
+        g_hash_table_lookup(sClientNames, clientName);
 
-    g_hash_table_iter_init(&iter, sClientList);
-
-    while (g_hash_table_iter_next(&iter, &key, &value))
+    if (!clientInfo)
     {
-        clientInfo = value;
-
-        if (!strcmp(clientInfo->clientName, clientName))
-        {
-            PwrEventClientUnregister(clientInfo->clientId);
-            return true;
-        }
+        return false;
     }
 
-    return false;
+    PwrEventClientUnregister(clientInfo->clientId);
+    return true;
 }
 
 /**
@@ -325,10 +700,12 @@ get_client_table_str_helper(gpointer key, gpointer value, gpointer data)
     g_return_if_fail(info != NULL);
 
     g_string_append_printf(str, "    %s/%s - %s (%s) - NACKS: %d/%d\n",
-                           info->requireSuspendRequest ?
-                           AckToString(info->ackSuspendRequest) : "###",
-                           info->requirePrepareSuspend ?
-                           AckToString(info->ackPrepareSuspend) : "###",
+                           VoteBitsetTest(&sSuspendRequestRequired, info->slot) ?
+                           AckToString(ClientVoteState(info->slot, &sSuspendRequestAcked,
+                                       &sSuspendRequestNacked)) : "###",
+                           VoteBitsetTest(&sPrepareSuspendRequired, info->slot) ?
+                           AckToString(ClientVoteState(info->slot, &sPrepareSuspendAcked,
+                                       &sPrepareSuspendNacked)) : "###",
                            info->clientName,
                            info->clientId,
                            info->num_NACK_suspendRequest,
@@ -349,78 +726,116 @@ PwrEventGetClientTable()
 }
 
 /**
- * @brief Helper function for adding all clients who did not respond to suspend request message
- * to the string pointer passed.
+ * @brief Append every client that is required to vote but has neither acked nor
+ * nacked in the current round, i.e. required & ~(acked | nacked).
  */
-static void
-get_SuspendRequest_NORSP_list_helper(gpointer key, gpointer value,
-                                     gpointer data)
+static gchar *
+GetNORSPList(const VoteBitset *required, const VoteBitset *acked,
+             const VoteBitset *nacked)
 {
-    GString *str = (GString *) data;
-    g_return_if_fail(str != NULL);
+    GString *str = g_string_sized_new(32);
+    guint i;
 
-    struct PwrEventClientInfo *info =
-        (struct PwrEventClientInfo *)value;
-    g_return_if_fail(info != NULL);
-
-    if ((info->requireSuspendRequest) &&
-            (info->ackSuspendRequest == PWREVENT_CLIENT_NORSP))
+    for (i = 0; i < required->nwords; i++)
     {
-        g_string_append_printf(str, "%s%s(%s)",
-                               str->len > 0 ? ", " : "",
-                               info->clientName,
-                               info->clientId);
+        guint64 pending = VoteBitsetWord(required, i) &
+                          ~(VoteBitsetWord(acked, i) | VoteBitsetWord(nacked, i));
+
+        while (pending)
+        {
+            int slot = i * VOTE_BITS_PER_WORD + __builtin_ctzll(pending);
+            struct PwrEventClientInfo *info = g_ptr_array_index(sClientSlots, slot);
+
+            pending &= pending - 1;
+
+            if (!info)
+            {
+                continue;
+            }
+
+            g_string_append_printf(str, "%s%s(%s)",
+                                   str->len > 0 ? ", " : "",
+                                   info->clientName,
+                                   info->clientId);
+        }
     }
+
+    return g_string_free(str, false);
 }
 
 /**
- * @brief Go through each client in the hash table and print their details if they have not responded
- * back to suspend request message.
+ * @brief List the clients that have not responded back to the suspend request message.
  */
 
 gchar *
 PwrEventGetSuspendRequestNORSPList()
 {
-    GString *ret = g_string_sized_new(32);
-    g_hash_table_foreach(sClientList, get_SuspendRequest_NORSP_list_helper, ret);
-    return g_string_free(ret, false);
+    return GetNORSPList(&sSuspendRequestRequired, &sSuspendRequestAcked,
+                        &sSuspendRequestNacked);
 }
 
 /**
- * @brief Helper function for printing all clients who did not respond to prepare suspend message
+ * @brief List the clients that have not responded back to the prepare suspend message.
  */
-
-static void
-get_PrepareSuspend_NORSP_list_helper(gpointer key, gpointer value,
-                                     gpointer data)
+gchar *
+PwrEventGetPrepareSuspendNORSPList()
 {
-    GString *str = (GString *) data;
-    g_return_if_fail(str != NULL);
-
-    struct PwrEventClientInfo *info =
-        (struct PwrEventClientInfo *)value;
-    g_return_if_fail(info != NULL);
-
-    if ((info->requirePrepareSuspend) &&
-            (info->ackPrepareSuspend == PWREVENT_CLIENT_NORSP))
-    {
-        g_string_append_printf(str, "%s%s(%s)",
-                               str->len > 0 ? ", " : "",
-                               info->clientName,
-                               info->clientId);
-    }
+    return GetNORSPList(&sPrepareSuspendRequired, &sPrepareSuspendAcked,
+                        &sPrepareSuspendNacked);
 }
 
+
 /**
- * @brief Go through each client in the hash table and print their details if they have not responded
- * back to prepare suspend message.
+ * @brief Send a vote request straight to the clients that take part in the
+ * given round, as a reply on their identify subscription.
+ *
+ * Only clients whose bit is set in the round's required bitset are reached, so
+ * daemons that listen to the broadcast signals but never vote are left alone.
+ *
+ * @param round Suspend request or prepare suspend
+ * @param payload Message to send
+ *
+ * @retval Number of clients the message was sent to
  */
-gchar *
-PwrEventGetPrepareSuspendNORSPList()
+int
+PwrEventClientsNotify(PwrEventVoteRound round, const char *payload)
 {
-    GString *ret = g_string_sized_new(32);
-    g_hash_table_foreach(sClientList, get_PrepareSuspend_NORSP_list_helper, ret);
-    return g_string_free(ret, false);
+    const VoteBitset *required = (round == kPwrEventVotePrepareSuspend) ?
+                                 &sPrepareSuspendRequired : &sSuspendRequestRequired;
+    int sent = 0;
+    guint i;
+
+    for (i = 0; i < required->nwords; i++)
+    {
+        guint64 pending = VoteBitsetWord(required, i);
+
+        while (pending)
+        {
+            int slot = i * VOTE_BITS_PER_WORD + __builtin_ctzll(pending);
+            struct PwrEventClientInfo *info = g_ptr_array_index(sClientSlots, slot);
+
+            pending &= pending - 1;
+
+            if (!info || !info->message)
+            {
+                continue;
+            }
+
+            LSError lserror;
+            LSErrorInit(&lserror);
+
+            if (!LSMessageRespond(info->message, payload, &lserror))
+            {
+                SLEEPDLOG_DEBUG("Could not reach %s(%s)", info->clientName, info->clientId);
+                LSErrorFree(&lserror);
+                continue;
+            }
+
+            sent++;
+        }
+    }
+
+    return sent;
 }
 
 
@@ -440,10 +855,12 @@ PwrEventClientTablePrintHelper(gpointer key, gpointer value, gpointer data)
     }
 
     SLEEPDLOG_DEBUG(" %s/%s - %s (%s) - NACKS: %d/%d\n",
-                    info->requireSuspendRequest ?
-                    AckToString(info->ackSuspendRequest) : "###",
-                    info->requirePrepareSuspend ?
-                    AckToString(info->ackPrepareSuspend) : "###",
+                    VoteBitsetTest(&sSuspendRequestRequired, info->slot) ?
+                    AckToString(ClientVoteState(info->slot, &sSuspendRequestAcked,
+                                &sSuspendRequestNacked)) : "###",
+                    VoteBitsetTest(&sPrepareSuspendRequired, info->slot) ?
+                    AckToString(ClientVoteState(info->slot, &sPrepareSuspendAcked,
+                                &sPrepareSuspendNacked)) : "###",
                     info->clientName,
                     info->clientId,
                     info->num_NACK_suspendRequest,
@@ -519,10 +936,11 @@ PwrEventClientSuspendRequestRegister(ClientUID uid, bool reg)
         return;
     }
 
-    if (info->requireSuspendRequest != reg)
+    if (VoteBitsetTest(&sSuspendRequestRequired, info->slot) != reg)
     {
-        info->requireSuspendRequest = reg;
+        VoteBitsetAssign(&sSuspendRequestRequired, info->slot, reg);
         sNumSuspendRequest += reg ? 1 : -1;
+        ClientSnapshotSchedule();
     }
 
     SLEEPDLOG_DEBUG("%s %sregistering for suspend_request", info->clientName,
@@ -548,10 +966,11 @@ PwrEventClientPrepareSuspendRegister(ClientUID uid, bool reg)
         return false;
     }
 
-    if (info->requirePrepareSuspend != reg)
+    if (VoteBitsetTest(&sPrepareSuspendRequired, info->slot) != reg)
     {
-        info->requirePrepareSuspend = reg;
+        VoteBitsetAssign(&sPrepareSuspendRequired, info->slot, reg);
         sNumPrepareSuspend += reg ? 1 : -1;
+        ClientSnapshotSchedule();
     }
 
     SLEEPDLOG_DEBUG("%s %sregistering for prepare_suspend", info->clientName,
@@ -561,49 +980,22 @@ PwrEventClientPrepareSuspendRegister(ClientUID uid, bool reg)
 }
 
 
-/**
- * Helper function for initializing all counts before device suspend polling.
- * The counts sNumSuspendRequest and sNumPrepareSuspend keep a track of the
- * total expected responses for the suspend request and prepare suspend rounds
- * respectively.
- */
-void
-PwrEventVoteInitHelper(gpointer key, gpointer value, gpointer ctx)
-{
-    struct PwrEventClientInfo *info = (struct PwrEventClientInfo *)value;
-
-    if (!info)
-    {
-        return;
-    }
-
-    info->ackSuspendRequest = PWREVENT_CLIENT_NORSP;
-    info->ackPrepareSuspend = PWREVENT_CLIENT_NORSP;
-
-    if (info->requireSuspendRequest)
-    {
-        sNumSuspendRequest++;
-    }
-
-    if (info->requirePrepareSuspend)
-    {
-        sNumPrepareSuspend++;
-    }
-}
-
 /**
  * @brief Intialize all counts before the first polling round i.e the suspend request polling.
+ *
+ * Bumping the epoch invalidates every ack/nack word at once; the expected counts
+ * sNumSuspendRequest and sNumPrepareSuspend are re-derived from the required bitsets.
  */
 void
 PwrEventVoteInit(void)
 {
+    sVoteEpoch++;
+
     sNumSuspendRequestAck = 0;
-    sNumSuspendRequest    = 0;
+    sNumSuspendRequest    = VoteBitsetCount(&sSuspendRequestRequired);
 
     sNumPrepareSuspendAck = 0;
-    sNumPrepareSuspend    = 0;
-
-    g_hash_table_foreach(sClientList, PwrEventVoteInitHelper, NULL);
+    sNumPrepareSuspend    = VoteBitsetCount(&sPrepareSuspendRequired);
 }
 
 /**
@@ -632,12 +1024,14 @@ PwrEventVoteSuspendRequest(ClientUID uid, bool ack)
 
     PMLOG_TRACE("%s %sACK suspend response", info->clientName, ack ? "" : "N");
 
-    if (info->ackSuspendRequest != ack)
+    if (VoteBitsetTest(&sSuspendRequestAcked, info->slot) != ack)
     {
-        info->ackSuspendRequest = ack;
-        sNumSuspendRequestAck += ack ? 1 : 0;
+        VoteBitsetAssign(&sSuspendRequestAcked, info->slot, ack);
+        sNumSuspendRequestAck += ack ? 1 : -1;
     }
 
+    VoteBitsetAssign(&sSuspendRequestNacked, info->slot, !ack);
+
     return (!ack || PwrEventClientsApproveSuspendRequest());
 }
 
@@ -668,12 +1062,14 @@ PwrEventVotePrepareSuspend(ClientUID uid, bool ack)
 
     PMLOG_TRACE("%s %sACK prepare suspend", info->clientName, ack ? "" : "N");
 
-    if (info->ackPrepareSuspend != ack)
+    if (VoteBitsetTest(&sPrepareSuspendAcked, info->slot) != ack)
     {
-        info->ackPrepareSuspend = ack;
-        sNumPrepareSuspendAck += ack ? 1 : 0;
+        VoteBitsetAssign(&sPrepareSuspendAcked, info->slot, ack);
+        sNumPrepareSuspendAck += ack ? 1 : -1;
     }
 
+    VoteBitsetAssign(&sPrepareSuspendNacked, info->slot, !ack);
+
     return (!ack || PwrEventClientsApprovePrepareSuspend());
 }
 
@@ -0,0 +1,527 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file client_snapshot.c
+ *
+ * @brief Keep a snapshot of the suspend and shutdown client registrations on disk,
+ * so that a restarted sleepd keeps waiting on the same voters.
+ *
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <luna-service2/lunaservice.h>
+
+#include "client_snapshot.h"
+#include "client.h"
+#include "shutdown.h"
+#include "main.h"
+#include "sleepd_config.h"
+#include "logging.h"
+
+#define LOG_DOMAIN "PWREVENT-SNAPSHOT: "
+
+#define CLIENT_SNAPSHOT_FILE        "clients.snapshot"
+#define CLIENT_SNAPSHOT_MAGIC       "SLCS"
+#define CLIENT_SNAPSHOT_VERSION     1
+
+/* Registrations tend to come in bursts, write them out together */
+#define CLIENT_SNAPSHOT_SAVE_DELAY_MS 1000
+
+/**
+ * @defgroup ClientSnapshot  Client Snapshot
+ * @ingroup PowerEvents
+ * @brief Client registrations that survive a sleepd restart.
+ *
+ * Each time a client identifies, (un)registers for suspend_request or
+ * prepare_suspend, or registers for shutdown, the registrations are written to
+ * preference_dir/clients.snapshot a second later. The file is a small header
+ * followed by one packed record per client:
+ *
+ * @code
+ * header: "SLCS" | u32 version | u32 count
+ * record: u8 kind | u8 flags | u16 name_len | u16 app_len | u16 service_len | name | app | service
+ * @endcode
+ *
+ * At startup every record is put back as a placeholder client with the id
+ * "restored:<clientName>". A placeholder cannot vote, so it is left out of the
+ * suspend rounds and of the shutdown phases; it keeps the registrations until
+ * the client identifies or registers again. A placeholder goes away when:
+ *
+ * - a client with the same name identifies or registers again (it takes over the
+ *   placeholder's suspend flags),
+ * - the luna service that owned it is not on the bus, or
+ * - client_restore_grace_ms passes without it coming back.
+ */
+
+/**
+ * @addtogroup ClientSnapshot
+ * @{
+ */
+
+typedef struct
+{
+    char    magic[4];
+    guint32 version;
+    guint32 count;
+} __attribute__((packed)) ClientSnapshotHeader;
+
+typedef struct
+{
+    guint8  kind;
+    guint8  flags;
+    guint16 name_len;
+    guint16 app_len;
+    guint16 service_len;
+} __attribute__((packed)) ClientSnapshotRecord;
+
+/**
+ * @brief A placeholder put back from the snapshot, waiting to be reconciled.
+ */
+typedef struct
+{
+    ClientSnapshotKind kind;
+    gchar *uid;
+    gchar *service;
+    void *cookie;
+} RestoredClient;
+
+static guint sSaveSource = 0;
+static guint sGraceSource = 0;
+static GSList *sRestored = NULL;
+
+static gchar *
+ClientSnapshotPath(const char *suffix)
+{
+    gchar *name = g_strconcat(CLIENT_SNAPSHOT_FILE, suffix, NULL);
+    gchar *path = g_build_filename(gSleepConfig.preference_dir, name, NULL);
+
+    g_free(name);
+    return path;
+}
+
+/**
+ * @brief Append one client record to a snapshot being built.
+ *
+ * @param buf Snapshot buffer, starting with a ClientSnapshotHeader
+ * @param kind Table the client is registered in
+ * @param flags CLIENT_SNAPSHOT_* flags
+ * @param name Client name
+ * @param appName Application id of the client, can be NULL
+ * @param serviceName Luna service name of the client, can be NULL
+ */
+void
+ClientSnapshotAppend(GByteArray *buf, ClientSnapshotKind kind, guint flags,
+                     const char *name, const char *appName,
+                     const char *serviceName)
+{
+    ClientSnapshotRecord record;
+    ClientSnapshotHeader *header = (ClientSnapshotHeader *)buf->data;
+
+    if (!name)
+    {
+        return;
+    }
+
+    record.kind = kind;
+    record.flags = flags;
+    record.name_len = MIN(strlen(name), G_MAXUINT16);
+    record.app_len = appName ? MIN(strlen(appName), G_MAXUINT16) : 0;
+    record.service_len = serviceName ? MIN(strlen(serviceName), G_MAXUINT16) : 0;
+
+    header->count++;
+
+    g_byte_array_append(buf, (const guint8 *)&record, sizeof(record));
+    g_byte_array_append(buf, (const guint8 *)name, record.name_len);
+
+    if (record.app_len)
+    {
+        g_byte_array_append(buf, (const guint8 *)appName, record.app_len);
+    }
+
+    if (record.service_len)
+    {
+        g_byte_array_append(buf, (const guint8 *)serviceName, record.service_len);
+    }
+}
+
+/**
+ * @brief Write the buffer to the snapshot file through a temporary file, so a
+ * power cut leaves either the old or the new snapshot.
+ */
+static bool
+ClientSnapshotWrite(const guint8 *data, gsize len)
+{
+    gchar *path = ClientSnapshotPath(NULL);
+    gchar *tmp_path = ClientSnapshotPath(".tmp");
+    bool ret = false;
+    int fd;
+
+    fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+
+    if (fd < 0)
+    {
+        goto end;
+    }
+
+    while (len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+
+        if (written <= 0)
+        {
+            close(fd);
+            unlink(tmp_path);
+            goto end;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    fsync(fd);
+    close(fd);
+
+    if (rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+
+    if (!ret)
+    {
+        SLEEPDLOG_WARNING(MSGID_CLIENT_SNAPSHOT_SAVE_FAIL, 1, PMLOGKS("FileName", path),
+                          "Could not save client registrations");
+    }
+
+    g_free(tmp_path);
+    g_free(path);
+    return ret;
+}
+
+static gboolean
+ClientSnapshotSave(gpointer data)
+{
+    ClientSnapshotHeader header;
+    GByteArray *buf = g_byte_array_sized_new(512);
+
+    sSaveSource = 0;
+
+    memcpy(header.magic, CLIENT_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = CLIENT_SNAPSHOT_VERSION;
+    header.count = 0;
+    g_byte_array_append(buf, (const guint8 *)&header, sizeof(header));
+
+    PwrEventClientSnapshot(buf);
+    shutdown_client_snapshot(buf);
+
+    SLEEPDLOG_DEBUG("Saving %u client registrations",
+                    ((ClientSnapshotHeader *)buf->data)->count);
+
+    ClientSnapshotWrite(buf->data, buf->len);
+
+    g_byte_array_free(buf, true);
+
+    return FALSE;
+}
+
+/**
+ * @brief Write the client registrations out a little later. Called whenever a
+ * registration changes.
+ */
+void
+ClientSnapshotSchedule(void)
+{
+    if (sSaveSource)
+    {
+        return;
+    }
+
+    sSaveSource = g_timeout_add(CLIENT_SNAPSHOT_SAVE_DELAY_MS,
+                                ClientSnapshotSave, NULL);
+}
+
+static bool
+RestoredClientPresent(RestoredClient *restored)
+{
+    switch (restored->kind)
+    {
+        case kClientSnapshotPwrEvent:
+            return PwrEventClientLookup(restored->uid) != NULL;
+
+        case kClientSnapshotShutdownApp:
+            return shutdown_client_present(true, restored->uid);
+
+        case kClientSnapshotShutdownService:
+            return shutdown_client_present(false, restored->uid);
+
+        default:
+            return false;
+    }
+}
+
+static void
+RestoredClientDrop(RestoredClient *restored)
+{
+    switch (restored->kind)
+    {
+        case kClientSnapshotPwrEvent:
+            PwrEventClientUnregister(restored->uid);
+            break;
+
+        case kClientSnapshotShutdownApp:
+            shutdown_client_drop(true, restored->uid);
+            break;
+
+        case kClientSnapshotShutdownService:
+            shutdown_client_drop(false, restored->uid);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void
+RestoredClientFree(RestoredClient *restored)
+{
+    if (restored->cookie)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!LSCancelServerStatus(GetLunaServiceHandle(), restored->cookie, &lserror))
+        {
+            LSErrorFree(&lserror);
+        }
+    }
+
+    g_free(restored->uid);
+    g_free(restored->service);
+    g_free(restored);
+}
+
+/**
+ * @brief Server status of the service that owned a restored client. A service
+ * that is not on the bus cannot vote, so its placeholder is dropped right away.
+ */
+static bool
+RestoredClientServerStatus(LSHandle *sh, const char *serviceName,
+                           bool connected, void *ctx)
+{
+    RestoredClient *restored = ctx;
+
+    if (!connected && RestoredClientPresent(restored))
+    {
+        SLEEPDLOG_DEBUG("%s is not running, dropping %s", serviceName, restored->uid);
+        RestoredClientDrop(restored);
+    }
+
+    return true;
+}
+
+/**
+ * @brief End of the grace period: whoever has not come back by now is gone.
+ */
+static gboolean
+RestoredClientsExpire(gpointer data)
+{
+    GSList *iter;
+    int dropped = 0;
+
+    sGraceSource = 0;
+
+    for (iter = sRestored; iter; iter = iter->next)
+    {
+        RestoredClient *restored = iter->data;
+
+        if (RestoredClientPresent(restored))
+        {
+            RestoredClientDrop(restored);
+            dropped++;
+        }
+
+        RestoredClientFree(restored);
+    }
+
+    g_slist_free(sRestored);
+    sRestored = NULL;
+
+    SLEEPDLOG_DEBUG("Restored clients reconciled, %d never came back", dropped);
+
+    return FALSE;
+}
+
+static void
+RestoredClientAdd(ClientSnapshotKind kind, guint flags, const char *name,
+                  const char *appName, const char *serviceName)
+{
+    RestoredClient *restored = g_new0(RestoredClient, 1);
+
+    restored->kind = kind;
+    restored->uid = g_strconcat(CLIENT_SNAPSHOT_RESTORED_PREFIX, name, NULL);
+    restored->service = g_strdup(serviceName);
+
+    switch (kind)
+    {
+        case kClientSnapshotPwrEvent:
+            PwrEventClientRestore(restored->uid, name, appName, serviceName, flags);
+            break;
+
+        case kClientSnapshotShutdownApp:
+            shutdown_client_restore(true, restored->uid, name, serviceName);
+            break;
+
+        case kClientSnapshotShutdownService:
+            shutdown_client_restore(false, restored->uid, name, serviceName);
+            break;
+
+        default:
+            break;
+    }
+
+    if (restored->service)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!LSRegisterServerStatusEx(GetLunaServiceHandle(), restored->service,
+                                      RestoredClientServerStatus, restored,
+                                      &restored->cookie, &lserror))
+        {
+            restored->cookie = NULL;
+            LSErrorFree(&lserror);
+        }
+    }
+
+    sRestored = g_slist_prepend(sRestored, restored);
+}
+
+/**
+ * @brief Put the registrations from the last snapshot back as placeholder
+ * clients. Must be called once the client tables exist.
+ */
+void
+ClientSnapshotRestore(void)
+{
+    gchar *path = ClientSnapshotPath(NULL);
+    const guint8 *map = MAP_FAILED;
+    const guint8 *pos, *end;
+    const ClientSnapshotHeader *header;
+    struct stat st;
+    guint32 i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        goto end;
+    }
+
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(ClientSnapshotHeader))
+    {
+        goto corrupt;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        goto corrupt;
+    }
+
+    header = (const ClientSnapshotHeader *)map;
+
+    if (memcmp(header->magic, CLIENT_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+            header->version != CLIENT_SNAPSHOT_VERSION)
+    {
+        goto corrupt;
+    }
+
+    pos = map + sizeof(ClientSnapshotHeader);
+    end = map + st.st_size;
+
+    for (i = 0; i < header->count; i++)
+    {
+        ClientSnapshotRecord record;
+
+        if (end - pos < (ptrdiff_t)sizeof(record))
+        {
+            goto corrupt;
+        }
+
+        memcpy(&record, pos, sizeof(record));
+        pos += sizeof(record);
+
+        if (end - pos < record.name_len + record.app_len + record.service_len ||
+                record.kind >= kClientSnapshotLast || record.name_len == 0)
+        {
+            goto corrupt;
+        }
+
+        gchar *name = g_strndup((const char *)pos, record.name_len);
+        pos += record.name_len;
+        gchar *app = record.app_len ?
+                     g_strndup((const char *)pos, record.app_len) : NULL;
+        pos += record.app_len;
+        gchar *service = record.service_len ?
+                         g_strndup((const char *)pos, record.service_len) : NULL;
+        pos += record.service_len;
+
+        RestoredClientAdd(record.kind, record.flags, name, app, service);
+
+        g_free(name);
+        g_free(app);
+        g_free(service);
+    }
+
+    SLEEPDLOG_DEBUG("Restored %u client registrations", header->count);
+    goto done;
+
+corrupt:
+    SLEEPDLOG_WARNING(MSGID_CLIENT_SNAPSHOT_CORRUPT, 1, PMLOGKS("FileName", path),
+                      "Ignoring unreadable client snapshot");
+
+done:
+
+    if (map != MAP_FAILED)
+    {
+        munmap((void *)map, st.st_size);
+    }
+
+    close(fd);
+
+    if (sRestored)
+    {
+        sGraceSource = g_timeout_add(gSleepConfig.client_restore_grace_ms,
+                                     RestoredClientsExpire, NULL);
+    }
+
+end:
+    g_free(path);
+}
+
+/* @} END OF ClientSnapshot */
@@ -32,6 +32,8 @@
 
 #include "init.h"
 #include "logging.h"
+#include "main.h"
+#include "timerwheel.h"
 
 #define PRINT_INTERVAL_MS 60000
 
@@ -48,7 +50,7 @@ static long unsigned int sTotalMSAsleep = 0;
 static long unsigned int sTotalMSScreenOn = 0;
 static long unsigned int sTotalMSScreenOff = 0;
 static bool sIsAwake = true;
-static guint sTimerEventSource = 0;
+static TimerWheelTimer *sPrintTimer = NULL;
 
 #define NS_PER_MS 1000000
 #define MS_PER_S 1000
@@ -110,11 +112,8 @@ sawmill_logger_update(gpointer data)
                        );
     }
 
-    //TODO: use g_timer_source_set_interval(GTimerSource *tsource, guint interval_ms, gboolean from_poll)
-    g_source_remove(sTimerEventSource);
-    sTimerEventSource = g_timeout_add_full(G_PRIORITY_DEFAULT, PRINT_INTERVAL_MS,
-                                           sawmill_logger_update, GINT_TO_POINTER(TRUE), NULL);
-    return FALSE;
+    TimerWheelSetInterval(sPrintTimer, PRINT_INTERVAL_MS, true);
+    return TRUE;
 }
 
 // note we dont get ms resolution here
@@ -126,11 +125,8 @@ sawmill_logger_record_wake(struct timespec time_asleep)
     sTimeOnWake = time_now_ms();
     sIsAwake = true;
 
-    //TODO: use g_timer_source_set_interval(GTimerSource *tsource, guint interval_ms, gboolean from_poll)
-    g_source_remove(sTimerEventSource);
-    sTimerEventSource = g_timeout_add_full(G_PRIORITY_DEFAULT,
-                                           CLAMP(sMSUntilPrint - ms_asleep, 0, PRINT_INTERVAL_MS), sawmill_logger_update,
-                                           GINT_TO_POINTER(FALSE), NULL);
+    TimerWheelSetInterval(sPrintTimer,
+                          CLAMP(sMSUntilPrint - ms_asleep, 0, PRINT_INTERVAL_MS), false);
 }
 
 void
@@ -165,8 +161,9 @@ _sawlog_init(void)
     sTimeOnPrint = time_now_ms();
     sTimeScreenOn = time_now_ms();
     sTimeScreenOff = time_now_ms();
-    sTimerEventSource = g_timeout_add_full(G_PRIORITY_DEFAULT, PRINT_INTERVAL_MS,
-                                           sawmill_logger_update, GINT_TO_POINTER(TRUE), NULL);
+    sPrintTimer = TimerWheelAdd(GetMainLoopContext(), PRINT_INTERVAL_MS,
+                                PRINT_INTERVAL_MS / 4,
+                                sawmill_logger_update, NULL);
 
     return 0;
 }
@@ -35,21 +35,50 @@
 #include "machine.h"
 #include "init.h"
 #include "json_utils.h"
+#include "shutdown.h"
+#include "client_snapshot.h"
+#include "lunabus.h"
+#include "sleepd_config.h"
+#include "timerwheel.h"
 
 #define LOG_DOMAIN "SHUTDOWN: "
 
+#define SHUTDOWN_LATENCY_FILE "shutdown_latency"
+#define SHUTDOWN_REPORT_FILE  "last_shutdown.json"
+
+
+/**
+* @brief Shutdown phases, the applications phase and the services phase.
+*/
+typedef enum
+{
+    kShutdownPhaseApps,
+    kShutdownPhaseServices,
+    kShutdownPhaseLast
+} ShutdownPhase;
+
+#define SHUTDOWN_PHASE_BIT(phase) (1U << (phase))
 
 /**
 * @brief Contains list of applications and services
 *        interested in shutdown.
+*
+* num_clients, num_ack and num_nack are kept per phase and always match the
+* clients in the tables: a client leaving takes its vote with it. Placeholders
+* restored from the client snapshot cannot vote and are not counted.
 */
 typedef struct
 {
     GHashTable *applications;
     GHashTable *services;
 
-    int num_ack;
-    int num_nack;
+    /* Client name -> ms it took to ACK the last shutdown, see client_deadline_ms() */
+    GHashTable *app_latency;
+    GHashTable *service_latency;
+
+    int num_clients[kShutdownPhaseLast];
+    int num_ack[kShutdownPhaseLast];
+    int num_nack[kShutdownPhaseLast];
 } ShutdownClientList;
 
 typedef enum
@@ -85,8 +114,23 @@ typedef struct
 {
     char            *id;
     char            *name;
+    char            *service;
     ShutdownReply    ack_shutdown;
+    bool             application;
+
+    /* Placeholder restored from the client snapshot, until the client registers */
+    bool             restored;
+
+    /* SHUTDOWN_PHASE_BIT of each phase the client has voted in */
+    guint            voted;
 
+    /* Services that shut down without waiting for the applications */
+    bool             depends_on_apps;
+    LSMessage       *message;
+
+    /* Seconds into the shutdown when the client was signalled and when it ACKed */
+    bool             signalled;
+    double           signalled_at;
     double           elapsed;
 } ShutdownClient;
 
@@ -160,6 +204,7 @@ static void send_shutdown_apps();
 static void send_shutdown_services();
 
 static bool shutdown_timeout(void *data);
+static void shutdown_phase_recheck(void);
 
 /**
  * Mapping from state to function handling state.
@@ -181,9 +226,25 @@ ShutdownClientList       *sClientList = NULL;
 LSMessage                *shutdown_message = NULL;
 LSHandle                 *shutdown_sh = NULL;
 
-guint shutdown_apps_timeout_id = 0;
+TimerWheelTimer *shutdown_timeout_timer = NULL;
 GTimer  *shutdown_timer = NULL;
 
+/* Seconds into the shutdown when each phase ended */
+static double sAppsPhaseEnd = 0.0;
+static double sServicesPhaseEnd = 0.0;
+
+/* Seconds into the shutdown when each state was entered, < 0 if it was not */
+static double sStateEnteredAt[kPowerShutdownLast];
+
+/* Report written before the previous power off, see shutdown_report_write() */
+static gchar *sLastShutdownReport = NULL;
+
+/* Subscription keys of the registered applications and services */
+static const char *kShutdownApplicationsKey = "shutdownApplicationsClient";
+static const char *kShutdownServicesKey = "shutdownServicesClient";
+
+static LunaBusCategory sShutdownCategory;
+
 /**
  * @defgroup ShutdownProcess    Shutdown Process
  * @ingroup PowerEvents
@@ -192,12 +253,24 @@ GTimer  *shutdown_timer = NULL;
  * When sleepd receives the /shutdown/initiate luna-call, it sends the shutdown signal
  * (shutdownApplications) to all the registered applications. It will proceed to the next
  * stage i.e sending shutdown signal (shutdownServices) to all the registered services, if
- * all the registered applications respond back by "Ack" or after a timeout of 15 sec.
+ * all the registered applications respond back by "Ack" or after a timeout of
+ * apps_timeout_ms (15 sec by default).
+ *
+ * Again after sending the shutdownServices signal, it will allow a max timeout of
+ * services_timeout_ms for all the registered services to respond back. Finally it will
+ * respond back to the caller of the "initiate" luna-call with success to indicate the
+ * completion of the shutdown process.
  *
- * Again after sending the shutdownServices signal, it will allow a max timeout of 15 sec
- * for all the registered services to respond back. Finally it will respond back to the
- * caller of the "initiate" luna-call with success to indicate the completion of the
- * shutdown process.
+ * A phase does not wait longer than its slowest client needs: the time each client took
+ * to ACK is remembered across boots, and a client that ACKed before gets
+ * client_deadline_pct of that time (but at least client_deadline_min_ms) instead of the
+ * whole phase timeout.
+ *
+ * With overlap_phases, services that registered with "dependsOnApps":false are sent
+ * shutdownServices together with the applications phase.
+ *
+ * A client that registers while its phase waits for the ACKs is sent the signal of
+ * the phase right after its clientId, and the phase waits for its ACK as well.
  */
 
 /**
@@ -216,12 +289,14 @@ GTimer  *shutdown_timer = NULL;
  */
 
 static ShutdownClient *
-client_new(const char *key, const char *clientName)
+client_new(const char *key, const char *clientName, const char *serviceName)
 {
     ShutdownClient *client = g_new0(ShutdownClient, 1);
     client->id  = g_strdup(key);
     client->name = g_strdup(clientName);
+    client->service = g_strdup(serviceName);
     client->ack_shutdown = kShutdownReplyNoRsp;
+    client->depends_on_apps = true;
 
     return client;
 }
@@ -236,21 +311,102 @@ client_free(ShutdownClient *client)
     {
         g_free(client->id);
         g_free(client->name);
+        g_free(client->service);
+
+        if (client->message)
+        {
+            LSMessageUnref(client->message);
+        }
+
         g_free(client);
     }
 }
 
+static ShutdownPhase
+client_phase(ShutdownClient *client)
+{
+    return client->application ? kShutdownPhaseApps : kShutdownPhaseServices;
+}
+
+/**
+ * @brief Take a client leaving its table out of its phase's counts. This is
+ * the tables' destroy notify, so it covers every way a client is removed.
+ */
+static void
+client_destroy(ShutdownClient *client)
+{
+    ShutdownPhase phase = client_phase(client);
+
+    if (client->restored)
+    {
+        client_free(client);
+        return;
+    }
+
+    sClientList->num_clients[phase]--;
+
+    if (client->voted & SHUTDOWN_PHASE_BIT(phase))
+    {
+        if (client->ack_shutdown == kShutdownReplyAck)
+        {
+            sClientList->num_ack[phase]--;
+        }
+        else
+        {
+            sClientList->num_nack[phase]--;
+        }
+    }
+
+    client_free(client);
+}
+
+/**
+ * @brief Add a client to the given table, replacing the placeholder restored
+ * from the client snapshot for the same name if there is one. A placeholder is
+ * not counted in its phase, the phases do not wait for it.
+ */
+static ShutdownClient *
+client_table_add(GHashTable *table, const char *key, const char *clientName,
+                 const char *serviceName)
+{
+    ShutdownClient *client = client_new(key, clientName, serviceName);
+
+    client->application = table == sClientList->applications;
+    client->restored = g_str_has_prefix(key, CLIENT_SNAPSHOT_RESTORED_PREFIX);
+
+    if (clientName && !client->restored)
+    {
+        gchar *restored_uid = g_strconcat(CLIENT_SNAPSHOT_RESTORED_PREFIX,
+                                          clientName, NULL);
+        g_hash_table_remove(table, restored_uid);
+        g_free(restored_uid);
+    }
+
+    g_hash_table_replace(table, client->id, client);
+
+    if (!client->restored)
+    {
+        sClientList->num_clients[client_phase(client)]++;
+    }
+
+    ClientSnapshotSchedule();
+
+    return client;
+}
+
 /**
  * @brief Create a client structure for an application and add it to the global application list
  *
  * @param key Unique key for this client
  * @param clientName Name of the application
+ * @param serviceName Luna service name of the application
  */
-static void
-client_new_application(const char *key, const char *clientName)
+static ShutdownClient *
+client_new_application(const char *key, const char *clientName,
+                       const char *serviceName)
 {
-    ShutdownClient *client = client_new(key, clientName);
-    g_hash_table_replace(sClientList->applications, client->id, client);
+    return client_table_add(sClientList->applications, key, clientName,
+                            serviceName);
 }
 
 /**
@@ -258,12 +414,14 @@ client_new_application(const char *key, const char *clientName)
  *
  * @param key Unique key for this client
  * @param clientName Name of the application
+ * @param serviceName Luna service name of the service
  */
-static void
-client_new_service(const char *key, const char *clientName)
+static ShutdownClient *
+client_new_service(const char *key, const char *clientName,
+                   const char *serviceName)
 {
-    ShutdownClient *client = client_new(key, clientName);
-    g_hash_table_replace(sClientList->services, client->id, client);
+    return client_table_add(sClientList->services, key, clientName,
+                            serviceName);
 }
 
 /**
@@ -275,6 +433,9 @@ client_vote_clear(const char *key, ShutdownClient *client, void *data)
     _assert(client != NULL);
 
     client->ack_shutdown = kShutdownReplyNoRsp;
+    client->voted = 0;
+    client->signalled = false;
+    client->signalled_at = 0.0;
     client->elapsed = 0.0;
 }
 
@@ -285,7 +446,11 @@ client_vote_clear(const char *key, ShutdownClient *client, void *data)
 static void
 client_unregister_application(const char *uid)
 {
-    g_hash_table_remove(sClientList->applications, uid);
+    if (g_hash_table_remove(sClientList->applications, uid))
+    {
+        ClientSnapshotSchedule();
+        shutdown_phase_recheck();
+    }
 }
 
 /**
@@ -294,7 +459,11 @@ client_unregister_application(const char *uid)
 static void
 client_unregister_service(const char *uid)
 {
-    g_hash_table_remove(sClientList->services, uid);
+    if (g_hash_table_remove(sClientList->services, uid))
+    {
+        ClientSnapshotSchedule();
+        shutdown_phase_recheck();
+    }
 }
 
 
@@ -320,13 +489,231 @@ client_lookup_app(const char *uid)
 
 
 /**
- * @brief Reset global ACK & NACK counts.
+ * @brief Learned ACK times of the applications or of the services.
+ */
+static GHashTable *
+client_latency_table(ShutdownClient *client)
+{
+    return client->application ? sClientList->app_latency :
+           sClientList->service_latency;
+}
+
+/**
+ * @brief Remember how long the client took to ACK. A slower ACK replaces the
+ * remembered time, a faster one only pulls it down by a quarter so that one
+ * quick shutdown does not cut the client short the next time.
+ */
+static void
+client_latency_learn(ShutdownClient *client, int latency_ms)
+{
+    GHashTable *table = client_latency_table(client);
+    gpointer value;
+
+    if (!client->name)
+    {
+        return;
+    }
+
+    if (g_hash_table_lookup_extended(table, client->name, NULL, &value))
+    {
+        latency_ms = MAX(latency_ms, GPOINTER_TO_INT(value) * 3 / 4);
+    }
+
+    g_hash_table_replace(table, g_strdup(client->name),
+                         GINT_TO_POINTER(latency_ms));
+}
+
+/**
+ * @brief How long to wait for the client's ACK in a phase of phase_ms.
+ */
+static int
+client_deadline_ms(ShutdownClient *client, int phase_ms)
+{
+    gpointer value;
+
+    if (!client->name ||
+            !g_hash_table_lookup_extended(client_latency_table(client),
+                                          client->name, NULL, &value))
+    {
+        return phase_ms;
+    }
+
+    int deadline_ms = GPOINTER_TO_INT(value) *
+                      gSleepConfig.shutdown_client_deadline_pct / 100;
+
+    deadline_ms = MAX(deadline_ms, gSleepConfig.shutdown_client_deadline_min_ms);
+
+    return MIN(deadline_ms, phase_ms);
+}
+
+/**
+ * @brief Mark the clients of a phase as signalled, and return how long the phase
+ * has to wait for the slowest of the clients that still have to ACK.
+ */
+static int
+client_list_begin_phase(GHashTable *table, int phase_ms)
+{
+    double now = g_timer_elapsed(shutdown_timer, NULL);
+    int deadline_ms = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        ShutdownClient *client = value;
+
+        if (client->restored)
+        {
+            continue;
+        }
+
+        if (!client->signalled)
+        {
+            client->signalled = true;
+            client->signalled_at = now;
+        }
+
+        if (client->ack_shutdown != kShutdownReplyAck)
+        {
+            deadline_ms = MAX(deadline_ms, client_deadline_ms(client, phase_ms));
+        }
+    }
+
+    return deadline_ms;
+}
+
+/**
+ * @brief Forget the ACK time of the clients that did not ACK in time, so that
+ * they get the whole phase timeout the next time.
+ */
+static void
+client_list_forget_pending(GHashTable *table)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        ShutdownClient *client = value;
+
+        if (client->ack_shutdown != kShutdownReplyAck && client->name &&
+                !client->restored)
+        {
+            g_hash_table_remove(client_latency_table(client), client->name);
+        }
+    }
+}
+
+static void
+client_latency_load_group(GKeyFile *keyfile, const char *group,
+                          GHashTable *table)
+{
+    gchar **keys = g_key_file_get_keys(keyfile, group, NULL, NULL);
+    int i;
+
+    for (i = 0; keys && keys[i]; i++)
+    {
+        GError *gerror = NULL;
+        int latency_ms = g_key_file_get_integer(keyfile, group, keys[i], &gerror);
+
+        if (gerror)
+        {
+            g_error_free(gerror);
+            continue;
+        }
+
+        g_hash_table_replace(table, g_strdup(keys[i]),
+                             GINT_TO_POINTER(latency_ms));
+    }
+
+    g_strfreev(keys);
+}
+
+/**
+ * @brief Load the ACK times learned during the previous shutdowns.
+ */
+static void
+client_latency_load(void)
+{
+    gchar *path = g_build_filename(gSleepConfig.preference_dir,
+                                   SHUTDOWN_LATENCY_FILE, NULL);
+    GKeyFile *keyfile = g_key_file_new();
+
+    if (g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL))
+    {
+        client_latency_load_group(keyfile, "applications",
+                                  sClientList->app_latency);
+        client_latency_load_group(keyfile, "services",
+                                  sClientList->service_latency);
+    }
+
+    g_key_file_free(keyfile);
+    g_free(path);
+}
+
+static void
+client_latency_save_group(GKeyFile *keyfile, const char *group,
+                          GHashTable *table)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        g_key_file_set_integer(keyfile, group, key, GPOINTER_TO_INT(value));
+    }
+}
+
+/**
+ * @brief Save the learned ACK times for the next boot.
+ */
+static void
+client_latency_save(void)
+{
+    gchar *path = g_build_filename(gSleepConfig.preference_dir,
+                                   SHUTDOWN_LATENCY_FILE, NULL);
+    GKeyFile *keyfile = g_key_file_new();
+    GError *gerror = NULL;
+    gsize length;
+    gchar *data;
+
+    client_latency_save_group(keyfile, "applications", sClientList->app_latency);
+    client_latency_save_group(keyfile, "services", sClientList->service_latency);
+
+    data = g_key_file_to_data(keyfile, &length, NULL);
+
+    if (!g_file_set_contents(path, data, length, &gerror))
+    {
+        SLEEPDLOG_WARNING(MSGID_SHUTDOWN_LATENCY_SAVE_FAIL, 1,
+                          PMLOGKS("Error", gerror->message),
+                          "Could not save client ack times");
+        g_error_free(gerror);
+    }
+
+    g_free(data);
+    g_key_file_free(keyfile);
+    g_free(path);
+}
+
+/**
+ * @brief Reset the ACK & NACK counts of every phase.
  */
 static void
 client_list_reset_ack_count()
 {
-    sClientList->num_ack = 0;
-    sClientList->num_nack = 0;
+    int phase;
+
+    for (phase = 0; phase < kShutdownPhaseLast; phase++)
+    {
+        sClientList->num_ack[phase] = 0;
+        sClientList->num_nack[phase] = 0;
+    }
 }
 
 /**
@@ -344,28 +731,39 @@ client_list_vote_init()
 }
 
 /**
- * @brief Add an ACK or NACK vote for a client
+ * @brief Add an ACK or NACK vote for a client to the counts of its phase.
+ * Only the first vote of a client that has been signalled counts.
  */
 
 static void
 client_vote(ShutdownClient *client, bool ack)
 {
-    if (!client)
+    if (!client || !client->signalled)
     {
         return;
     }
 
-    client->ack_shutdown = ack ? kShutdownReplyAck : kShutdownReplyNack;
+    ShutdownPhase phase = client_phase(client);
 
+    if (client->voted & SHUTDOWN_PHASE_BIT(phase))
+    {
+        return;
+    }
+
+    client->voted |= SHUTDOWN_PHASE_BIT(phase);
+    client->ack_shutdown = ack ? kShutdownReplyAck : kShutdownReplyNack;
     client->elapsed = g_timer_elapsed(shutdown_timer, NULL);
 
+    client_latency_learn(client,
+                         (int)((client->elapsed - client->signalled_at) * 1000));
+
     if (ack)
     {
-        sClientList->num_ack++;
+        sClientList->num_ack[phase]++;
     }
     else
     {
-        sClientList->num_nack++;
+        sClientList->num_nack[phase]++;
     }
 }
 
@@ -403,36 +801,16 @@ client_list_print(GHashTable *client_table)
 }
 
 /**
-* @brief Return tristate on apps readiness for shutdown.
+* @brief Return tristate on a phase's readiness for shutdown.
 *
 * @retval 1 if ready, 0 if not ready, -1 if someone nacked.
 */
 static int
-shutdown_apps_ready()
+shutdown_phase_ready(ShutdownPhase phase)
 {
-    if (0 == sClientList->num_nack)
+    if (0 == sClientList->num_nack[phase])
     {
-        int num_clients = g_hash_table_size(sClientList->applications);
-        return sClientList->num_ack >= num_clients;
-    }
-    else
-    {
-        return -1;
-    }
-}
-
-/**
-* @brief Return tristate on services readiness for shutdown.
-*
-* @retval 1 if ready, 0 if not ready, -1 if someone nacked.
-*/
-static int
-shutdown_services_ready()
-{
-    if (0 == sClientList->num_nack)
-    {
-        int num_clients = g_hash_table_size(sClientList->services);
-        return sClientList->num_ack >= num_clients;
+        return sClientList->num_ack[phase] >= sClientList->num_clients[phase];
     }
     else
     {
@@ -458,8 +836,11 @@ shutdown_state_dispatch(ShutdownEvent *event)
 
         if (next_state != gCurrentState->state)
         {
+            double now = g_timer_elapsed(shutdown_timer, NULL);
+
             SLEEPDLOG_DEBUG("Shutdown: entering state: %s @ %fs",
-                            kStateMachine[next_state].name, g_timer_elapsed(shutdown_timer, NULL));
+                            kStateMachine[next_state].name, now);
+            sStateEnteredAt[next_state] = now;
         }
 
         gCurrentState = &kStateMachine[next_state];
@@ -467,76 +848,143 @@ shutdown_state_dispatch(ShutdownEvent *event)
 }
 
 /**
- * @brief Broadcast the "shutdownApplications" signal
+ * @brief A client left in the middle of a phase, the remaining clients may all
+ * have ACKed already.
  */
 static void
-send_shutdown_apps()
+shutdown_phase_recheck(void)
 {
-    bool retVal;
-    LSError lserror;
-    LSErrorInit(&lserror);
+    if (gCurrentState->state == kPowerShutdownAppsProcess ||
+            gCurrentState->state == kPowerShutdownServicesProcess)
+    {
+        ShutdownEvent event;
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/shutdown/shutdownApplications",
-                          "{}", &lserror);
+        event.id = kShutdownEventNone;
+        event.client = NULL;
 
-    if (!retVal)
+        shutdown_state_dispatch(&event);
+    }
+}
+
+/**
+ * @brief Broadcast the "shutdownApplications" signal
+ */
+static void
+send_shutdown_apps()
+{
+    if (!LunaBusSignalSend(&sShutdownCategory, kShutdownApplicationsKey,
+                           "shutdownApplications", "{}"))
     {
         SLEEPDLOG_ERROR(MSGID_SHUTDOWN_APPS_SIG_FAIL, 0,
                         "Could not send shutdown applications");
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-        return;
     }
+}
 
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/shutdown/shutdownApplications",
-                          "{}", &lserror);
+/**
+ * @brief Broadcast the "shutdownServices" signal
+ */
 
-    if (!retVal)
+static void
+send_shutdown_services()
+{
+    if (!LunaBusSignalSend(&sShutdownCategory, kShutdownServicesKey,
+                           "shutdownServices", "{}"))
     {
         SLEEPDLOG_ERROR(MSGID_SHUTDOWN_SRVC_SIG_FAIL, 0,
                         "Could not send shutdown Services");
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
     }
 }
 
 /**
- * @brief Broadcast the "shutdownServices" signal
+ * @brief Send "shutdownServices" ahead of the services phase to the services that
+ * do not depend on the applications.
+ */
+static void
+send_shutdown_services_early()
+{
+    double now = g_timer_elapsed(shutdown_timer, NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    int sent = 0;
+
+    g_hash_table_iter_init(&iter, sClientList->services);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        ShutdownClient *client = value;
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (client->depends_on_apps || !client->message)
+        {
+            continue;
+        }
+
+        if (!LSMessageRespond(client->message, "{\"signal\":\"shutdownServices\"}",
+                              &lserror))
+        {
+            LSErrorFree(&lserror);
+            continue;
+        }
+
+        client->signalled = true;
+        client->signalled_at = now;
+        sent++;
+    }
+
+    SLEEPDLOG_DEBUG("shutdownServices sent early to %d services", sent);
+}
+
+/**
+ * @brief Whether the signal of the client's phase has gone out and the phase is
+ * waiting for the ACKs.
  */
+static bool
+client_phase_active(ShutdownClient *client)
+{
+    switch (gCurrentState->state)
+    {
+        case kPowerShutdownAppsProcess:
+            return client->application ||
+                   (gSleepConfig.shutdown_overlap_phases && !client->depends_on_apps);
+
+        case kPowerShutdownServicesProcess:
+            return !client->application;
+
+        default:
+            return false;
+    }
+}
 
+/**
+ * @brief Send the signal of the phase in progress to a client that registered
+ * after it was broadcast. The client counts in the phase, so without its ACK
+ * the phase would wait for its deadline.
+ */
 static void
-send_shutdown_services()
+client_signal_late(ShutdownClient *client, LSMessage *message)
 {
-    bool retVal;
     LSError lserror;
     LSErrorInit(&lserror);
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/shutdown/shutdownServices",
-                          "{}", &lserror);
-
-    if (!retVal)
+    if (!client_phase_active(client))
     {
-        SLEEPDLOG_ERROR(MSGID_SHUTDOWN_SRVC_SIG_FAIL, 0,
-                        "Could not send shutdown Services");
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
         return;
     }
 
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/shutdown/shutdownServices",
-                          "{}", &lserror);
-
-    if (!retVal)
+    if (!LSMessageRespond(message, client->application ?
+                          "{\"signal\":\"shutdownApplications\"}" :
+                          "{\"signal\":\"shutdownServices\"}", &lserror))
     {
-        SLEEPDLOG_ERROR(MSGID_SHUTDOWN_SRVC_SIG_FAIL, 0,
-                        "Could not send shutdown Services");
-        LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
+        return;
     }
+
+    client->signalled = true;
+    client->signalled_at = g_timer_elapsed(shutdown_timer, NULL);
+
+    SLEEPDLOG_DEBUG("%s registered late, signalled @ %fs", client->name,
+                    client->signalled_at);
 }
 
 /**
@@ -559,7 +1007,7 @@ shutdown_client_cancel_registration(const char *clientId)
 * @param  clientName
 */
 void
-shutdown_client_cancel_registration_by_name(char *clientName)
+shutdown_client_cancel_registration_by_name(const char *clientName)
 {
     if (NULL == clientName)
     {
@@ -599,6 +1047,82 @@ shutdown_client_cancel_registration_by_name(char *clientName)
     return;
 }
 
+/**
+* @brief Put back a shutdown client saved in the client snapshot.
+*
+* @param  application true for the applications list, false for services
+* @param  uid Placeholder id for the client
+* @param  clientName
+* @param  serviceName
+*/
+void
+shutdown_client_restore(bool application, const char *uid,
+                        const char *clientName, const char *serviceName)
+{
+    if (application)
+    {
+        client_new_application(uid, clientName, serviceName);
+    }
+    else
+    {
+        client_new_service(uid, clientName, serviceName);
+    }
+}
+
+/**
+* @brief Check whether a shutdown client is still registered.
+*/
+bool
+shutdown_client_present(bool application, const char *uid)
+{
+    return application ? client_lookup_app(uid) != NULL :
+           client_lookup_service(uid) != NULL;
+}
+
+/**
+* @brief Remove a shutdown client from the applications or services list.
+*/
+void
+shutdown_client_drop(bool application, const char *uid)
+{
+    if (application)
+    {
+        client_unregister_application(uid);
+    }
+    else
+    {
+        client_unregister_service(uid);
+    }
+}
+
+static void
+client_snapshot_table(GByteArray *buf, GHashTable *table,
+                      ClientSnapshotKind kind)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        ShutdownClient *client = value;
+        ClientSnapshotAppend(buf, kind, 0, client->name, NULL, client->service);
+    }
+}
+
+/**
+* @brief Append a record for every shutdown client to the client snapshot.
+*/
+void
+shutdown_client_snapshot(GByteArray *buf)
+{
+    client_snapshot_table(buf, sClientList->applications,
+                          kClientSnapshotShutdownApp);
+    client_snapshot_table(buf, sClientList->services,
+                          kClientSnapshotShutdownService);
+}
+
 /**
  * @brief The Idle state : Sleepd will always be in this state until the "initiate" shutdown
  * message is received.
@@ -626,21 +1150,28 @@ state_idle(ShutdownEvent *event, ShutdownState *next)
 static bool
 state_shutdown_apps(ShutdownEvent *event, ShutdownState *next)
 {
-    client_list_reset_ack_count();
-
     event->id = kShutdownEventNone;
     *next = kPowerShutdownAppsProcess;
 
-    shutdown_apps_timeout_id =
-        g_timeout_add_seconds(15, (GSourceFunc)shutdown_timeout, NULL);
+    int deadline_ms = client_list_begin_phase(sClientList->applications,
+                      gSleepConfig.shutdown_apps_timeout_ms);
+
+    shutdown_timeout_timer = TimerWheelAdd(GetMainLoopContext(), deadline_ms, 0,
+                                           (GSourceFunc)shutdown_timeout, NULL);
 
     send_shutdown_apps();
 
+    if (gSleepConfig.shutdown_overlap_phases)
+    {
+        send_shutdown_services_early();
+    }
+
     return true;
 }
 
 /**
- * @brief This function is called when any of the clients haven't responded back even after 15 sec.
+ * @brief This function is called when any of the clients haven't responded back by the
+ * deadline of the phase.
  */
 static bool
 shutdown_timeout(void *data)
@@ -667,6 +1198,8 @@ state_shutdown_apps_process(ShutdownEvent *event, ShutdownState *next)
     switch (event->id)
     {
         case kShutdownEventAck:
+            /* A service that was sent shutdownServices early counts in the
+             * services phase. */
             client_vote(event->client, true);
             break;
 
@@ -678,18 +1211,26 @@ state_shutdown_apps_process(ShutdownEvent *event, ShutdownState *next)
             break;
     }
 
-    int readiness = shutdown_apps_ready();
+    int readiness = shutdown_phase_ready(kShutdownPhaseApps);
 
     if (readiness > 0 || timeout)
     {
         if (timeout)
         {
             SLEEPDLOG_DEBUG("Shutdown apps timed out");
+            client_list_forget_pending(sClientList->applications);
+            shutdown_timeout_timer = NULL;
         }
 
         client_list_print(sClientList->applications);
 
-        g_source_remove(shutdown_apps_timeout_id);
+        if (shutdown_timeout_timer)
+        {
+            TimerWheelRemove(shutdown_timeout_timer);
+            shutdown_timeout_timer = NULL;
+        }
+
+        sAppsPhaseEnd = g_timer_elapsed(shutdown_timer, NULL);
 
         *next = kPowerShutdownServices;
         return true;
@@ -714,13 +1255,14 @@ state_shutdown_apps_process(ShutdownEvent *event, ShutdownState *next)
 static bool
 state_shutdown_services(ShutdownEvent *event, ShutdownState *next)
 {
-    client_list_reset_ack_count();
-
     event->id = kShutdownEventNone;
     *next = kPowerShutdownServicesProcess;
 
-    shutdown_apps_timeout_id =
-        g_timeout_add_seconds(15, (GSourceFunc)shutdown_timeout, NULL);
+    int deadline_ms = client_list_begin_phase(sClientList->services,
+                      gSleepConfig.shutdown_services_timeout_ms);
+
+    shutdown_timeout_timer = TimerWheelAdd(GetMainLoopContext(), deadline_ms, 0,
+                                           (GSourceFunc)shutdown_timeout, NULL);
 
     send_shutdown_services();
 
@@ -750,19 +1292,28 @@ state_shutdown_services_process(ShutdownEvent *event, ShutdownState *next)
             break;
     }
 
-    int readiness = shutdown_services_ready();
+    int readiness = shutdown_phase_ready(kShutdownPhaseServices);
 
     if (readiness > 0 || timeout)
     {
         if (timeout)
         {
             SLEEPDLOG_DEBUG("Shutdown services timed out");
+            client_list_forget_pending(sClientList->services);
+            shutdown_timeout_timer = NULL;
         }
 
         client_list_print(sClientList->services);
 
         *next = kPowerShutdownAction;
-        g_source_remove(shutdown_apps_timeout_id);
+
+        if (shutdown_timeout_timer)
+        {
+            TimerWheelRemove(shutdown_timeout_timer);
+            shutdown_timeout_timer = NULL;
+        }
+
+        sServicesPhaseEnd = g_timer_elapsed(shutdown_timer, NULL);
         return true;
     }
     else if (readiness < 0)
@@ -785,6 +1336,17 @@ state_shutdown_services_process(ShutdownEvent *event, ShutdownState *next)
 static bool
 state_shutdown_action(ShutdownEvent *event, ShutdownState *next)
 {
+    double elapsed = g_timer_elapsed(shutdown_timer, NULL);
+
+    SLEEPDLOG_INFO(MSGID_SHUTDOWN_DURATION, 3,
+                   PMLOGKFV("total_ms", "%d", (int)(elapsed * 1000)),
+                   PMLOGKFV("apps_ms", "%d", (int)(sAppsPhaseEnd * 1000)),
+                   PMLOGKFV("services_ms", "%d",
+                            (int)((sServicesPhaseEnd - sAppsPhaseEnd) * 1000)),
+                   "Ready for shutdown action");
+
+    client_latency_save();
+
     bool retVal =
         LSMessageReply(shutdown_sh, shutdown_message,
                        "{\"success\":true}", NULL);
@@ -806,6 +1368,162 @@ state_shutdown_action(ShutdownEvent *event, ShutdownState *next)
     return false;
 }
 
+/**
+ * @brief Forget the state timings of the previous shutdown attempt.
+ */
+static void
+shutdown_report_reset(void)
+{
+    int i;
+
+    for (i = 0; i < kPowerShutdownLast; i++)
+    {
+        sStateEnteredAt[i] = -1.0;
+    }
+
+    sStateEnteredAt[kPowerShutdownNone] = 0.0;
+}
+
+static void
+shutdown_report_clients(GString *report, const char *name, GHashTable *table)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    bool first = true;
+
+    g_string_append_printf(report, ",\"%s\":[", name);
+    g_hash_table_iter_init(&iter, table);
+
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        ShutdownClient *client = value;
+
+        g_string_append(report, first ? "{\"name\":\"" : ",{\"name\":\"");
+        LSReplyAppendEscaped(report, client->name);
+        g_string_append_printf(report, "\",\"reply\":\"%s\"",
+                               shutdown_reply_to_string(client->ack_shutdown));
+
+        if (client->signalled)
+        {
+            g_string_append_printf(report, ",\"signalledMs\":%d",
+                                   (int)(client->signalled_at * 1000));
+
+            if (client->ack_shutdown != kShutdownReplyNoRsp)
+            {
+                g_string_append_printf(report, ",\"ackMs\":%d",
+                                       (int)((client->elapsed - client->signalled_at) * 1000));
+            }
+        }
+
+        g_string_append_c(report, '}');
+        first = false;
+    }
+
+    g_string_append_c(report, ']');
+}
+
+/**
+ * @brief Write how long each shutdown state and each client's ACK took to
+ * preference_dir, so that it can be read back after the next boot.
+ *
+ * @param action "shutdown" or "reboot"
+ * @param reason Reason given by the caller of machineOff/machineReboot
+ */
+static void
+shutdown_report_write(const char *action, const char *reason)
+{
+    double now = g_timer_elapsed(shutdown_timer, NULL);
+    bool initiated = sStateEnteredAt[kPowerShutdownApps] >= 0;
+    GString *report = g_string_sized_new(1024);
+    GError *gerror = NULL;
+    double entered = -1.0;
+    const char *state = NULL;
+    bool first = true;
+    int i;
+
+    g_string_append_printf(report, "{\"action\":\"%s\",\"reason\":\"", action);
+    LSReplyAppendEscaped(report, reason);
+    g_string_append_printf(report, "\",\"initiated\":%s",
+                           initiated ? "true" : "false");
+
+    if (initiated)
+    {
+        g_string_append_printf(report, ",\"totalMs\":%d,\"states\":{",
+                               (int)(now * 1000));
+
+        /* States are entered in order, each lasts until the next one entered */
+        for (i = kPowerShutdownApps; i <= kPowerShutdownLast; i++)
+        {
+            if (i < kPowerShutdownLast && sStateEnteredAt[i] < 0)
+            {
+                continue;
+            }
+
+            if (state)
+            {
+                double left = i < kPowerShutdownLast ? sStateEnteredAt[i] : now;
+
+                g_string_append_printf(report, "%s\"%s\":%d", first ? "" : ",",
+                                       state, (int)((left - entered) * 1000));
+                first = false;
+            }
+
+            if (i < kPowerShutdownLast)
+            {
+                state = kStateMachine[i].name;
+                entered = sStateEnteredAt[i];
+            }
+        }
+
+        g_string_append_c(report, '}');
+
+        shutdown_report_clients(report, "applications", sClientList->applications);
+        shutdown_report_clients(report, "services", sClientList->services);
+    }
+
+    g_string_append_c(report, '}');
+
+    gchar *path = g_build_filename(gSleepConfig.preference_dir,
+                                   SHUTDOWN_REPORT_FILE, NULL);
+
+    if (!g_file_set_contents(path, report->str, report->len, &gerror))
+    {
+        SLEEPDLOG_WARNING(MSGID_SHUTDOWN_REPORT_SAVE_FAIL, 1,
+                          PMLOGKS("Error", gerror->message),
+                          "Could not save shutdown report");
+        g_error_free(gerror);
+    }
+
+    g_free(path);
+    g_string_free(report, TRUE);
+}
+
+/**
+ * @brief Keep the report written before the previous power off for lastShutdownReport.
+ */
+static void
+shutdown_report_load(void)
+{
+    gchar *path = g_build_filename(gSleepConfig.preference_dir,
+                                   SHUTDOWN_REPORT_FILE, NULL);
+    gchar *contents = NULL;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL))
+    {
+        struct json_object *object = json_tokener_parse(contents);
+
+        if (object)
+        {
+            json_object_put(object);
+            sLastShutdownReport = contents;
+            contents = NULL;
+        }
+    }
+
+    g_free(contents);
+    g_free(path);
+}
+
 /**
  * @brief Send response to the caller of the luna call.
  */
@@ -815,25 +1533,23 @@ send_reply(LSHandle *sh, LSMessage *message,
            const char *format, ...)
 {
     bool retVal;
-    char *payload;
+    GString *payload = LSReplyBuffer();
     va_list vargs;
     gchar *payloadStr = NULL;
 
     va_start(vargs, format);
-    payload = g_strdup_vprintf(format, vargs);
+    LSReplyAppendVprintf(payload, format, vargs);
     va_end(vargs);
 
-    retVal = LSMessageReply(sh, message, payload, NULL);
+    retVal = LSMessageReply(sh, message, payload->str, NULL);
 
     if (!retVal)
     {
-        payloadStr = g_strescape(payload, NULL);
+        payloadStr = g_strescape(payload->str, NULL);
         SLEEPDLOG_WARNING(MSGID_LSMSG_REPLY_FAIL, 1, PMLOGKS("payload", payloadStr),
                           "Could not send reply");
         g_free(payloadStr);
     }
-
-    g_free(payload);
 }
 
 
@@ -857,6 +1573,7 @@ initiateShutdown(LSHandle *sh, LSMessage *message, void *user_data)
     shutdown_sh = sh;
 
     g_timer_start(shutdown_timer);
+    shutdown_report_reset();
 
     shutdown_state_dispatch(&event);
 
@@ -1022,13 +1739,14 @@ shutdownApplicationsRegister(LSHandle *sh, LSMessage *message,
         goto cleanup;
     }
 
-    client_new_application(clientId, clientName);
+    ShutdownClient *client = client_new_application(clientId, clientName,
+                             LSMessageGetSenderServiceName(message));
 
     bool retVal;
     LSError lserror;
     LSErrorInit(&lserror);
 
-    retVal = LSSubscriptionAdd(sh, "shutdownClient",
+    retVal = LSSubscriptionAdd(sh, kShutdownApplicationsKey,
                                message, &lserror);
 
     if (!retVal)
@@ -1040,6 +1758,7 @@ shutdownApplicationsRegister(LSHandle *sh, LSMessage *message,
     }
 
     send_reply(sh, message, "{\"clientId\":\"%s\", \"returnValue\": true}", clientId);
+    client_signal_late(client, message);
 
 cleanup:
     if (object)
@@ -1076,18 +1795,22 @@ shutdownServicesRegister(LSHandle *sh, LSMessage *message,
 
     it = json_object_iter_begin(object);
     itEnd = json_object_iter_end(object);
-    if (!json_object_iter_equal(&it, &itEnd))
+    while (!json_object_iter_equal(&it, &itEnd))
     {
-        json_object_iter_next(&it);
-        if (!json_object_iter_equal(&it, &itEnd))
+        const char *name = json_object_iter_peek_name(&it);
+
+        if (strcmp(name, "clientName") && strcmp(name, "dependsOnApps"))
         {
                LSMessageReplyErrorInvalidParams(sh, message);
            goto cleanup;
         }
+
+        json_object_iter_next(&it);
     }
 
     const char *clientId = LSMessageGetUniqueToken(message);
     char *clientName = NULL;
+    bool dependsOnApps = true;
 
     if(!get_json_string(object, "clientName", &clientName))
     {
@@ -1095,13 +1818,23 @@ shutdownServicesRegister(LSHandle *sh, LSMessage *message,
         goto cleanup;
     }
 
-    client_new_service(clientId, clientName);
+    get_json_boolean(object, "dependsOnApps", &dependsOnApps);
+
+    ShutdownClient *client = client_new_service(clientId, clientName,
+                             LSMessageGetSenderServiceName(message));
+
+    if (!dependsOnApps)
+    {
+        client->depends_on_apps = false;
+        client->message = message;
+        LSMessageRef(message);
+    }
 
     bool retVal;
     LSError lserror;
     LSErrorInit(&lserror);
 
-    retVal = LSSubscriptionAdd(sh, "shutdownClient",
+    retVal = LSSubscriptionAdd(sh, kShutdownServicesKey,
                                message, &lserror);
 
     if (!retVal)
@@ -1113,6 +1846,7 @@ shutdownServicesRegister(LSHandle *sh, LSMessage *message,
     }
 
     send_reply(sh, message, "{\"clientId\":\"%s\", \"returnValue\": true}", clientId);
+    client_signal_late(client, message);
 
 cleanup:
     if (object)
@@ -1152,6 +1886,7 @@ machineOff(LSHandle *sh, LSMessage *message,
         goto cleanup;
     }
 
+    shutdown_report_write("shutdown", reason);
     MachineForceShutdown(reason);
     LSMessageReplySuccess(sh, message);
 
@@ -1193,6 +1928,7 @@ machineReboot(LSHandle *sh, LSMessage *message,
         goto cleanup;
     }
 
+    shutdown_report_write("reboot", reason);
     MachineForceReboot(reason);
     LSMessageReplySuccess(sh, message);
 
@@ -1206,9 +1942,45 @@ cleanup:
     return true;
 }
 
+/**
+ * @brief Return the timing report written just before the previous power off or
+ * reboot.
+ *
+ * Response:
+ *
+ * {"returnValue":true,"report":{"action":"reboot","reason":"...","initiated":true,
+ *  "totalMs":2140,"states":{"ShutdownApps":1,...},
+ *  "applications":[{"name":"...","reply":"Ack","signalledMs":0,"ackMs":120}],
+ *  "services":[...]}}
+ *
+ * @param sh
+ * @param message This method doesn't need any arguments.
+ * @param user_data
+ */
+static bool
+lastShutdownReport(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    if (!sLastShutdownReport)
+    {
+        LSMessageReplyCustomError(sh, message, "No shutdown report");
+        return true;
+    }
+
+    GString *reply = LSReplyBuffer();
+
+    g_string_append(reply, "{\"returnValue\":true,\"report\":");
+    g_string_append(reply, sLastShutdownReport);
+    g_string_append_c(reply, '}');
+
+    LSMessageReplyBuffer(sh, message, reply);
+
+    return true;
+}
+
 LSMethod shutdown_methods[] =
 {
     { "initiate", initiateShutdown },
+    { "lastShutdownReport", lastShutdownReport },
 
     { "shutdownApplicationsRegister", shutdownApplicationsRegister },
     { "shutdownApplicationsAck", shutdownApplicationsAck },
@@ -1236,11 +2008,16 @@ shutdown_init(void)
 {
     sClientList = g_new0(ShutdownClientList, 1);
     sClientList->applications = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                NULL, (GDestroyNotify)client_free);
+                                NULL, (GDestroyNotify)client_destroy);
     sClientList->services = g_hash_table_new_full(g_str_hash, g_str_equal,
-                            NULL, (GDestroyNotify)client_free);
-    sClientList->num_ack = 0;
-    sClientList->num_nack = 0;
+                            NULL, (GDestroyNotify)client_destroy);
+    sClientList->app_latency = g_hash_table_new_full(g_str_hash, g_str_equal,
+                               g_free, NULL);
+    sClientList->service_latency = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                   g_free, NULL);
+    client_latency_load();
+    shutdown_report_load();
+    shutdown_report_reset();
 
     shutdown_timer = g_timer_new();
 
@@ -1249,16 +2026,20 @@ shutdown_init(void)
     LSError lserror;
     LSErrorInit(&lserror);
 
-    // Registering "shutdown" category with com.palm.sleep service (to be deprecated soon)
-    if (!LSRegisterCategory(GetLunaServiceHandle(),
-                            "/shutdown", shutdown_methods, shutdown_signals, NULL, &lserror))
+    // "/shutdown" on com.palm.sleep (to be deprecated soon) and on
+    // com.webos.service.power share one method table.
+    if (!LunaBusCategoryAddName(&sShutdownCategory, GetLunaServiceHandle(),
+                                "com.palm.sleep", "/shutdown") ||
+            !LunaBusCategoryAddName(&sShutdownCategory, GetWebosLunaServiceHandle(),
+                                    "com.webos.service.power", "/shutdown"))
     {
-        goto error;
+        SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 0,
+                        "could not publish /shutdown, service not registered");
+        return -1;
     }
 
-    // Registering "shutdown" category with com.webos.service.power service
-    if (!LSRegisterCategory(GetWebosLunaServiceHandle(),
-                            "/shutdown", shutdown_methods, shutdown_signals, NULL, &lserror))
+    if (!LunaBusRegisterCategory(&sShutdownCategory, shutdown_methods,
+                                 shutdown_signals, &lserror))
     {
         goto error;
     }
@@ -30,6 +30,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <syslog.h>
 
@@ -39,16 +40,18 @@
 #include "machine.h"
 #include "sleepd_debug.h"
 #include "main.h"
-#include "timersource.h"
+#include "timerwheel.h"
 #include "activity.h"
 #include "logging.h"
 #include "client.h"
 #include "timesaver.h"
 #include "init.h"
 #include "timeout_alarm.h"
+#include "client_snapshot.h"
 #include "reference_time.h"
 #include "sleepd_config.h"
 #include "sawmill_logger.h"
+#include "wakeup.h"
 #include "nyx/nyx_client.h"
 
 #include <json.h>
@@ -56,9 +59,6 @@
 
 #define LOG_DOMAIN "PWREVENT-SUSPEND: "
 
-#define kPowerBatteryCheckReasonSysfs "/sys/power/batterycheck_wakeup"
-#define kPowerWakeupSourcesSysfs      "/sys/power/wakeup_event_list"
-
 #define MIN_IDLE_SEC 5
 
 /*
@@ -154,6 +154,11 @@ static PowerState StateAbortSuspend(void);
  * to "On" state.
  *
  * 8. AbortSuspend: It will broadcast the "Resume" signal and go back to the "On" state.
+ *
+ * When built with ASYNC_SUSPEND there is no SuspendThread, the state machine runs on the main
+ * loop. SuspendRequest and PrepareSuspend then return right after their broadcast, and the state
+ * machine runs again when the last client voted or when the wait timed out. A forced suspend or
+ * resume trigger that came in during the vote is run once the vote is over.
  */
 
 /**
@@ -183,22 +188,50 @@ WaitObj gWaitResumeMessage;
 
 PowerEvent gSuspendEvent = kPowerEventNone;
 
-GTimerSource *idle_scheduler = NULL;
+TimerWheelTimer *idle_scheduler = NULL;
 
 GMainLoop *suspend_loop = NULL;
 
-WaitObj gWaitSuspendResponse;
-WaitObj gWaitPrepareSuspend;
+/* Signalled by the ACK handlers when a vote round is decided */
+WaitEvent gWaitSuspendResponse;
+WaitEvent gWaitPrepareSuspend;
 
 struct timespec sTimeOnStartSuspend;
+static struct timespec sTimeOnVotesDone;
 struct timespec sTimeOnSuspended;
 struct timespec sTimeOnWake;
 
 struct timespec sSuspendRTC;
 struct timespec sWakeRTC;
+static time_t sWakeReference;
 
 bool gDisplayIsOn = true;
 
+/* Suspend attempts are spaced out while clients keep NACKing, see SuspendBackoffIncrease */
+static pthread_mutex_t backoff_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sBackoffMs = 0;
+static int sBackoffNacks = 0;
+static ClockNs sBackoffUntil;
+
+/* Running averages of what a suspend and a resume cost, see SuspendIsWorthIt */
+#define SUSPEND_COST_WEIGHT 4
+static long sSuspendCostMs = 0;
+static long sResumeCostMs = 0;
+
+#ifdef ENABLE_ASYNC_SUSPEND
+/* A voting state has sent its request and returned without a decision. The state
+ * machine runs again when the last client voted or when the round timed out. */
+static bool sVotePending = false;
+static bool sVoteTimedOut = false;
+static TimerWheelTimer *sVoteTimeout = NULL;
+static GSource *sVoteDoneSource = NULL;
+
+/* Last forced suspend or resume trigger that came in during a vote round, run
+ * once the round is over */
+static bool sEventQueued = false;
+static PowerEvent sQueuedEvent = kPowerEventNone;
+#endif
+
 void SuspendIPCInit(void);
 int SendSuspendRequest(const char *message);
 int SendPrepareSuspend(const char *message);
@@ -235,8 +268,8 @@ const char* StateToStr(PowerState state)
 void
 StateLoopShutdown(void)
 {
-    WaitObjectSignal(&gWaitSuspendResponse);
-    WaitObjectSignal(&gWaitPrepareSuspend);
+    WaitEventSignal(&gWaitSuspendResponse);
+    WaitEventSignal(&gWaitPrepareSuspend);
 }
 
 /**
@@ -249,7 +282,7 @@ ScheduleIdleCheck(int interval_ms, bool fromPoll)
     if (idle_scheduler)
     {
         SLEEPDLOG_DEBUG("Scheduling new idle check in %d ms", interval_ms);
-        g_timer_source_set_interval(idle_scheduler, interval_ms, fromPoll);
+        TimerWheelSetInterval(idle_scheduler, interval_ms, fromPoll);
     }
     else
     {
@@ -257,6 +290,139 @@ ScheduleIdleCheck(int interval_ms, bool fromPoll)
     }
 }
 
+/**
+ * @brief A client NACKed the suspend: double the time until the next attempt,
+ * starting from twice wait_idle_ms and up to suspend_backoff_max_ms.
+ */
+static void
+SuspendBackoffIncrease(void)
+{
+    if (gSleepConfig.suspend_backoff_max_ms <= 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&backoff_mutex);
+
+    sBackoffNacks++;
+    sBackoffMs = MIN(sBackoffMs ? sBackoffMs * 2 : gSleepConfig.wait_idle_ms * 2,
+                     gSleepConfig.suspend_backoff_max_ms);
+
+    sBackoffUntil = ClockNsNow() + ClockNsFromMs(sBackoffMs);
+
+    SLEEPDLOG_DEBUG("Suspend NACKed %d times in a row, next attempt in %d ms",
+                    sBackoffNacks, sBackoffMs);
+
+    pthread_mutex_unlock(&backoff_mutex);
+}
+
+/**
+ * @brief Attempt to suspend at the next idle check again.
+ *
+ * @param reason What changed, for the log
+ */
+void
+SuspendBackoffReset(const char *reason)
+{
+    pthread_mutex_lock(&backoff_mutex);
+
+    if (sBackoffMs)
+    {
+        SLEEPDLOG_DEBUG("Suspend backoff of %d ms reset by %s", sBackoffMs, reason);
+    }
+
+    sBackoffMs = 0;
+    sBackoffNacks = 0;
+
+    pthread_mutex_unlock(&backoff_mutex);
+}
+
+/**
+ * @retval Milliseconds left until the next suspend attempt is allowed.
+ */
+static int
+SuspendBackoffRemainingMs(ClockNs now)
+{
+    int remaining_ms = 0;
+
+    pthread_mutex_lock(&backoff_mutex);
+
+    if (sBackoffMs && sBackoffUntil > now)
+    {
+        remaining_ms = ClockNsToMs(sBackoffUntil - now);
+    }
+
+    pthread_mutex_unlock(&backoff_mutex);
+
+    return remaining_ms;
+}
+
+/**
+ * @brief Current suspend backoff as a JSON reply payload.
+ *
+ * @retval Newly allocated string, to be freed by the caller.
+ */
+gchar *
+SuspendGetBackoffState(void)
+{
+    int remaining_ms = SuspendBackoffRemainingMs(ClockNsNow());
+
+    pthread_mutex_lock(&backoff_mutex);
+
+    gchar *state = g_strdup_printf(
+                       "{\"returnValue\":true,\"nacks\":%d,\"backoffMs\":%d,\"nextAttemptInMs\":%d}",
+                       sBackoffNacks, sBackoffMs, remaining_ms);
+
+    pthread_mutex_unlock(&backoff_mutex);
+
+    return state;
+}
+
+/**
+ * @brief Fold a new latency sample into a running average.
+ */
+static void
+SuspendCostUpdate(long *average_ms, long sample_ms)
+{
+    if (*average_ms)
+    {
+        *average_ms += (sample_ms - *average_ms) / SUSPEND_COST_WEIGHT;
+    }
+    else
+    {
+        *average_ms = sample_ms;
+    }
+}
+
+/**
+ * @brief Check if sleeping for predicted_sleep_ms saves more than the suspend costs.
+ *
+ * A suspend costs the time from the end of the votes to the kernel suspend, the time
+ * spent resuming and the after_resume_idle_ms we stay awake after each wake. The vote
+ * rounds are left out, they run whether or not the device ends up sleeping. The
+ * predicted sleep has to be suspend_break_even_ratio times that overhead.
+ */
+static bool
+SuspendIsWorthIt(long predicted_sleep_ms)
+{
+    if (gSleepConfig.suspend_break_even_ratio <= 0)
+    {
+        return true;
+    }
+
+    long overhead_ms = sSuspendCostMs + sResumeCostMs +
+                       gSleepConfig.after_resume_idle_ms;
+
+    if (predicted_sleep_ms < overhead_ms * gSleepConfig.suspend_break_even_ratio)
+    {
+        SLEEPDLOG_DEBUG("Sleeping %ld ms does not pay off a %ld ms suspend/resume overhead",
+                        predicted_sleep_ms, overhead_ms);
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Get display status using NYX interface.
  */
@@ -277,7 +443,7 @@ IdleCheck(gpointer ctx)
     bool suspend_active;
     bool activity_idle;
 
-    struct timespec now;
+    ClockNs now;
     int next_idle_ms = 0;
 
     if (gCurrentStateNode.state == kPowerStateKernelResume) {
@@ -291,38 +457,36 @@ IdleCheck(gpointer ctx)
     {
         SLEEPDLOG_DEBUG("IdleCheck: display off");
 
-        ClockGetTime(&now);
+        now = ClockNsNow();
 
         /*
          * Enforce that the minimum time awake must be at least
          * after_resume_idle_ms.
          */
-        struct timespec last_wake;
-        last_wake.tv_sec = sTimeOnWake.tv_sec;
-        last_wake.tv_nsec = sTimeOnWake.tv_nsec;
-
-        ClockAccumMs(&last_wake, gSleepConfig.after_resume_idle_ms);
+        ClockNs time_on_wake = ClockNsFromTimespec(&sTimeOnWake);
+        ClockNs last_wake = time_on_wake +
+                            ClockNsFromMs(gSleepConfig.after_resume_idle_ms);
 
-        if (!ClockTimeIsGreater(&last_wake, &now))
+        if (last_wake <= now)
         {
             /*
              * Do not sleep if any activity is still active
              */
 
-            activity_idle = PwrEventActivityCanSleep(&now);
+            activity_idle = PwrEventActivityCanSleep(now);
 
             if (!activity_idle)
             {
                 SLEEPDLOG_DEBUG("Can't sleep because an activity is active: ");
             }
 
-            if (PwrEventActivityCount(&sTimeOnWake))
+            if (PwrEventActivityCount(time_on_wake))
             {
                 SLEEPDLOG_DEBUG("Activities since wake: ");
-                PwrEventActivityPrintFrom(&sTimeOnWake);
+                PwrEventActivityPrintFrom(time_on_wake);
             }
 
-            PwrEventActivityRemoveExpired(&now);
+            PwrEventActivityRemoveExpired(now);
             {
                 time_t expiry = 0;
                 gchar *app_id = NULL;
@@ -340,6 +504,25 @@ IdleCheck(gpointer ctx)
                                         next_wake);
                         goto resched;
                     }
+
+                    // we can't sleep before the longest activity is over
+                    if (next_wake >= 0 &&
+                            !SuspendIsWorthIt((long)next_wake * 1000 - PwrEventActivityGetMaxDuration(now)))
+                    {
+                        goto resched;
+                    }
+                }
+            }
+
+            {
+                int backoff_ms = SuspendBackoffRemainingMs(now);
+
+                if (backoff_ms > 0)
+                {
+                    SLEEPDLOG_DEBUG("Not going to sleep for another %d ms because of NACKs",
+                                    backoff_ms);
+                    next_idle_ms = backoff_ms;
+                    goto resched;
                 }
             }
 
@@ -356,15 +539,13 @@ IdleCheck(gpointer ctx)
         }
         else
         {
-            struct timespec diff;
-            ClockDiff(&diff, &last_wake, &now);
-            next_idle_ms = ClockGetMs(&diff);
+            next_idle_ms = ClockNsToMs(last_wake - now);
         }
 
 resched:
         {
             long wait_idle_ms = gSleepConfig.wait_idle_ms;
-            long max_duration_ms = PwrEventActivityGetMaxDuration(&now);
+            long max_duration_ms = PwrEventActivityGetMaxDuration(now);
 
             if (max_duration_ms > wait_idle_ms)
             {
@@ -382,14 +563,11 @@ resched:
     }
 }
 
-static gboolean
-SuspendStateUpdate(PowerEvent power_event)
+static void
+SuspendStateRun(void)
 {
-    gSuspendEvent = power_event;
     PowerState next_state = kPowerStateLast;
 
-    SLEEPDLOG_DEBUG("%s: state %s", __PRETTY_FUNCTION__, StateToStr(gCurrentStateNode.state));
-
     do
     {
         SLEEPDLOG_DEBUG("In state '%s'", StateToStr(gCurrentStateNode.state));
@@ -408,10 +586,159 @@ SuspendStateUpdate(PowerEvent power_event)
         }
     }
     while (next_state != kPowerStateLast);
+}
+
+static gboolean
+SuspendStateUpdate(PowerEvent power_event)
+{
+    SLEEPDLOG_DEBUG("%s: state %s", __PRETTY_FUNCTION__, StateToStr(gCurrentStateNode.state));
+
+#ifdef ENABLE_ASYNC_SUSPEND
+    if (sVotePending)
+    {
+        /* The round in progress is the answer to an idle event. Running it
+         * after a NACK would start the next round without backing off. */
+        if (power_event == kPowerEventIdleEvent)
+        {
+            SLEEPDLOG_DEBUG("Vote round in progress, ignoring idle event");
+            return FALSE;
+        }
+
+        /* A forced suspend is not lost to a later resume trigger */
+        if (!sEventQueued || power_event != kPowerEventNone)
+        {
+            sQueuedEvent = power_event;
+        }
+
+        sEventQueued = true;
+
+        SLEEPDLOG_DEBUG("Vote round in progress, queueing event %d", power_event);
+        return FALSE;
+    }
+#endif
+
+    gSuspendEvent = power_event;
+    SuspendStateRun();
 
     return FALSE;
 }
 
+#ifdef ENABLE_ASYNC_SUSPEND
+static gboolean
+SuspendVoteContinue(gpointer data)
+{
+    if (sVotePending)
+    {
+        SuspendStateRun();
+    }
+
+    /* The round is over, run the event that came in meanwhile */
+    if (!sVotePending && sEventQueued)
+    {
+        sEventQueued = false;
+        SuspendStateUpdate(sQueuedEvent);
+    }
+
+    return FALSE;
+}
+
+static gboolean
+SuspendVoteTimeout(gpointer data)
+{
+    sVoteTimeout = NULL;
+    sVoteTimedOut = true;
+
+    SuspendVoteContinue(NULL);
+
+    return FALSE;
+}
+
+/**
+ * @brief Leave the current voting state waiting for up to ms milliseconds.
+ */
+static void
+SuspendVoteWait(int ms)
+{
+    sVotePending = true;
+    sVoteTimedOut = false;
+
+    /* Forget a completion of an earlier round that timed out first */
+    WaitEventClear(&gWaitSuspendResponse);
+
+    sVoteTimeout = TimerWheelAdd(g_main_loop_get_context(suspend_loop), ms, 0,
+                                 SuspendVoteTimeout, NULL);
+}
+
+/**
+ * @brief Close the vote round the current state was waiting for.
+ *
+ * @retval 1 if the round timed out, 0 otherwise.
+ */
+static int
+SuspendVoteFinish(void)
+{
+    if (sVoteTimeout)
+    {
+        TimerWheelRemove(sVoteTimeout);
+        sVoteTimeout = NULL;
+    }
+
+    sVotePending = false;
+
+    return sVoteTimedOut ? 1 : 0;
+}
+
+static gboolean
+SuspendVoteDone(gpointer data)
+{
+    SuspendVoteContinue(NULL);
+
+    return TRUE;
+}
+
+/**
+ * @brief All votes are in (or somebody NACKed), run the state machine again
+ * once the ACK handler has returned.
+ *
+ * @param round State whose vote round was decided. A late ACK for a round that
+ *              already timed out must not decide the round that followed it.
+ */
+static void
+SuspendVoteComplete(PowerState round)
+{
+    if (sVotePending && gCurrentStateNode.state == round)
+    {
+        WaitEventSignal(&gWaitSuspendResponse);
+    }
+}
+#endif
+
+/**
+ * @brief Called from the ACK handler when the suspend request round is decided.
+ */
+void
+SuspendRequestVotesDone(void)
+{
+#ifdef ENABLE_ASYNC_SUSPEND
+    SuspendVoteComplete(kPowerStateSuspendRequest);
+#else
+    WaitEventSignal(&gWaitSuspendResponse);
+#endif
+}
+
+/**
+ * @brief Called from the ACK handler when the prepare suspend round is decided.
+ */
+void
+PrepareSuspendVotesDone(void)
+{
+#ifdef ENABLE_ASYNC_SUSPEND
+    SuspendVoteComplete(kPowerStatePrepareSuspend);
+#else
+    WaitEventSignal(&gWaitPrepareSuspend);
+#endif
+}
+
 /**
  * @brief Suspend state machine is run in this thread.
  *
@@ -427,16 +754,13 @@ SuspendThread(void *ctx)
 
     suspend_loop = g_main_loop_new(context, FALSE);
 
-    idle_scheduler = g_timer_source_new(
-                         gSleepConfig.wait_idle_ms, gSleepConfig.wait_idle_granularity_ms);
-
-    g_source_set_callback((GSource *)idle_scheduler,
-                          IdleCheck, NULL, NULL);
-    g_source_attach((GSource *)idle_scheduler,
-                    g_main_loop_get_context(suspend_loop));
+    idle_scheduler = TimerWheelAdd(g_main_loop_get_context(suspend_loop),
+                                   gSleepConfig.wait_idle_ms,
+                                   gSleepConfig.wait_idle_granularity_ms,
+                                   IdleCheck, NULL);
 
     g_main_loop_run(suspend_loop);
-    g_source_unref((GSource *)idle_scheduler);
+    TimerWheelRemove(idle_scheduler);
     g_main_loop_unref(suspend_loop);
     g_main_context_unref(context);
 
@@ -517,9 +841,33 @@ StateSuspendRequest(void)
     static int log_count = START_LOG_COUNT;
     PowerState ret;
 
+#ifdef ENABLE_ASYNC_SUSPEND
+    if (!sVotePending)
+    {
+        ClockGetTime(&sTimeOnStartSuspend);
+
+        PwrEventVoteInit();
+
+        SendSuspendRequest("");
+
+        SLEEPDLOG_DEBUG("Sent \"suspend request\", waiting up to %dms",
+                        gSleepConfig.wait_suspend_response_ms);
+
+        if (!PwrEventClientsApproveSuspendRequest())
+        {
+            // come back here when the votes are in
+            SuspendVoteWait(gSleepConfig.wait_suspend_response_ms);
+            return kPowerStateLast;
+        }
+    }
+    else
+    {
+        timeout = SuspendVoteFinish();
+    }
+#else
     ClockGetTime(&sTimeOnStartSuspend);
 
-    WaitObjectLock(&gWaitSuspendResponse);
+    WaitEventClear(&gWaitSuspendResponse);
 
     PwrEventVoteInit();
 
@@ -532,11 +880,10 @@ StateSuspendRequest(void)
     if (!PwrEventClientsApproveSuspendRequest())
     {
         // wait for the message to arrive
-        timeout = WaitObjectWait(&gWaitSuspendResponse,
-                                 gSleepConfig.wait_suspend_response_ms);
+        timeout = WaitEventWait(&gWaitSuspendResponse,
+                                gSleepConfig.wait_suspend_response_ms);
     }
-
-    WaitObjectUnlock(&gWaitSuspendResponse);
+#endif
 
     PwrEventClientTablePrint(G_LOG_LEVEL_DEBUG);
 
@@ -561,6 +908,8 @@ StateSuspendRequest(void)
 
     if (ret == kPowerStateOn)
     {
+        SuspendBackoffIncrease();
+
         successive_ons++;
 
         if (successive_ons >= log_count)
@@ -606,7 +955,26 @@ StatePrepareSuspend(void)
     static int successive_ons = 0;
     static int log_count = START_LOG_COUNT;
 
-    WaitObjectLock(&gWaitPrepareSuspend);
+#ifdef ENABLE_ASYNC_SUSPEND
+    if (!sVotePending)
+    {
+        SendPrepareSuspend("");
+
+        PMLOG_TRACE("Sent \"prepare suspend\", waiting up to %dms",
+                    gSleepConfig.wait_prepare_suspend_ms);
+
+        if (!PwrEventClientsApprovePrepareSuspend())
+        {
+            SuspendVoteWait(gSleepConfig.wait_prepare_suspend_ms);
+            return kPowerStateLast;
+        }
+    }
+    else
+    {
+        timeout = SuspendVoteFinish();
+    }
+#else
+    WaitEventClear(&gWaitPrepareSuspend);
 
     // send suspend request to all power-aware daemons.
     SendPrepareSuspend("");
@@ -617,11 +985,10 @@ StatePrepareSuspend(void)
     if (!PwrEventClientsApprovePrepareSuspend())
     {
 
-        timeout = WaitObjectWait(&gWaitPrepareSuspend,
-                                 gSleepConfig.wait_prepare_suspend_ms);
+        timeout = WaitEventWait(&gWaitPrepareSuspend,
+                                gSleepConfig.wait_prepare_suspend_ms);
     }
-
-    WaitObjectUnlock(&gWaitPrepareSuspend);
+#endif
 
     PwrEventClientTablePrint(G_LOG_LEVEL_DEBUG);
 
@@ -654,6 +1021,7 @@ StatePrepareSuspend(void)
     {
         // if any daemons nacked, quit suspend...
         PMLOG_TRACE("Some daemon nacked prepare_suspend: stay awake");
+        SuspendBackoffIncrease();
         successive_ons++;
 
         if (successive_ons >= log_count)
@@ -713,12 +1081,26 @@ InstrumentOnSleep(void)
 
 /**
  * @brief Instrument how much time it took to wake back up.
+ *
+ * Only the timestamps are taken here, the formatting and the sawmill update
+ * are left to InstrumentOnWakeDeferred.
  */
 void
 InstrumentOnWake(int resumeType)
 {
     ClockGetTime(&sTimeOnWake);
     get_time_now(&sWakeRTC);
+    sWakeReference = reference_time();
+}
+
+/**
+ * @brief Log and account the time spent asleep, from a low priority idle source
+ * once the resume path is done.
+ */
+static gboolean
+InstrumentOnWakeDeferred(gpointer data)
+{
+    int resumeType = GPOINTER_TO_INT(data);
 
     struct timespec diffAsleep;
     ClockDiff(&diffAsleep, &sWakeRTC, &sSuspendRTC);
@@ -743,14 +1125,23 @@ InstrumentOnWake(int resumeType)
                            tm.tm_hour, tm.tm_min, tm.tm_sec);
 
     SLEEPDLOG_DEBUG("%s (%s)", str->str, resume_type_descriptions[resumeType]);
+    SLEEPDLOG_DEBUG("Average suspend takes %ld ms, resume %ld ms", sSuspendCostMs,
+                    sResumeCostMs);
 
     g_string_free(str, TRUE);
 
     sawmill_logger_record_wake(diffAsleep);
+
+    if (resumeType == kResumeTypeKernel)
+    {
+        PwrEventWakeupAttribute(sWakeReference);
+    }
+
+    return FALSE;
 }
 
 static bool
-CheckActivitiesActive(struct timespec *now)
+CheckActivitiesActive(ClockNs now)
 {
     if (MachineSupportsWakelocks())
     {
@@ -776,6 +1167,10 @@ StateSleep(void)
 
     PMLOG_TRACE("State Sleep, We will try to go to sleep now");
 
+    ClockGetTime(&sTimeOnVotesDone);
+
+    SuspendBackoffReset("suspend");
+
     SendSuspended("attempting to suspend (We are trying to sleep)");
 
     {
@@ -788,6 +1183,8 @@ StateSleep(void)
             SLEEPDLOG_DEBUG("waking in %ld seconds for %s", expiry - reference_time(), key);
         }
 
+        PwrEventWakeupSnapshot(expiry, key);
+
         g_free(app_id);
         g_free(key);
     }
@@ -799,10 +1196,10 @@ StateSleep(void)
 
     // if any activities were started, abort suspend.
     if (gSuspendEvent != kPowerEventForceSuspend &&
-            !CheckActivitiesActive(&sTimeOnSuspended))
+            !CheckActivitiesActive(ClockNsFromTimespec(&sTimeOnSuspended)))
     {
         SLEEPDLOG_DEBUG("aborting sleep because of current activity");
-        PwrEventActivityPrintFrom(&sTimeOnSuspended);
+        PwrEventActivityPrintFrom(ClockNsFromTimespec(&sTimeOnSuspended));
         nextState = kPowerStateActivityResume;
     }
 
@@ -811,6 +1208,12 @@ StateSleep(void)
         SLEEPDLOG_DEBUG("Going to sleep now");
         if (MachineCanSleep())
         {
+            struct timespec now, diff;
+
+            ClockGetTime(&now);
+            ClockDiff(&diff, &now, &sTimeOnVotesDone);
+            SuspendCostUpdate(&sSuspendCostMs, ClockGetMs(&diff));
+
             if (queue_next_wakeup())
             {
                 SLEEPDLOG_DEBUG("We couldn't sleep because there can't setup wakup alarm");
@@ -866,29 +1269,52 @@ StateAbortSuspend(void)
 static PowerState
 _stateResume(int resumeType)
 {
-    PMLOG_TRACE("We awoke");
+    struct timespec resume_start, resume_end, resume_diff;
+
+    ClockGetTime(&resume_start);
 
     MachineWakeup();
 
+    InstrumentOnWake(resumeType);
+
     if (!MachineSupportsWakelocks())
     {
         PwrEventThawActivities();
     }
 
-    char *resumeDesc = g_strdup_printf("resume (%s)",
-                                       resume_type_descriptions[resumeType]);
-    SendResume(resumeType, resumeDesc);
-    g_free(resumeDesc);
+    /* Fire due timeouts straight away on the main loop rather than waiting
+     * for our own resume signal to come back from the hub. */
+    if (resumeType == kResumeTypeKernel)
+    {
+        update_timeouts_on_resume();
+    }
+
+    SendResume(resumeType, resume_type_descriptions[resumeType]);
+
+    if (resumeType == kResumeTypeKernel)
+    {
+        ClockGetTime(&resume_end);
+        ClockDiff(&resume_diff, &resume_end, &resume_start);
+        SuspendCostUpdate(&sResumeCostMs, ClockGetMs(&resume_diff));
+    }
 
 #ifdef ASSERT_ON_BUG
-    WaitObjectSignal(&gWaitSuspendResponse);
+    WaitEventSignal(&gWaitSuspendResponse);
 #endif
 
-    InstrumentOnWake(resumeType);
-
     // if we are inactive in 1s, go back to sleep.
     ScheduleIdleCheck(gSleepConfig.after_resume_idle_ms, false);
 
+    /* Everything below is not needed to get the device going again. */
+    GSource *source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_LOW);
+    g_source_set_callback(source, InstrumentOnWakeDeferred,
+                          GINT_TO_POINTER(resumeType), NULL);
+    g_source_attach(source, g_main_loop_get_context(suspend_loop));
+    g_source_unref(source);
+
+    PMLOG_TRACE("We awoke");
+
     return kPowerStateOn;
 }
 
@@ -913,6 +1339,7 @@ DisplayStatusCb(LSHandle *handle, LSMessage *message, void *user_data)
     struct json_object *event_obj;
     const char *state;
     const char *event;
+    bool was_on = gDisplayIsOn;
 
     root_obj = json_tokener_parse(LSMessageGetPayload(message));
     if (!root_obj) {
@@ -945,6 +1372,11 @@ DisplayStatusCb(LSHandle *handle, LSMessage *message, void *user_data)
 
     SLEEPDLOG_DEBUG("Display status is now %s", gDisplayIsOn ? "on" : "off");
 
+    if (was_on != gDisplayIsOn)
+    {
+        SuspendBackoffReset("display");
+    }
+
     json_object_put(root_obj);
 
     return true;
@@ -968,21 +1400,52 @@ StateActivityResume(void)
  * @brief Initialize the Suspend/Resume state machine.
  */
 
+#ifdef ENABLE_ASYNC_SUSPEND
+/**
+ * @brief Run the state machine on the main loop instead of a SuspendThread.
+ */
+static void
+SuspendMainLoopInit(void)
+{
+    suspend_loop = GetMainLoop();
+
+    /* Vote rounds are decided on the main loop too, but the ACK handler must
+     * return before the state machine runs again */
+    sVoteDoneSource = WaitEventSourceNew(&gWaitSuspendResponse);
+    g_source_set_priority(sVoteDoneSource, G_PRIORITY_HIGH);
+    g_source_set_callback(sVoteDoneSource, SuspendVoteDone, NULL, NULL);
+    g_source_attach(sVoteDoneSource, GetMainLoopContext());
+
+    idle_scheduler = TimerWheelAdd(GetMainLoopContext(),
+                                   gSleepConfig.wait_idle_ms,
+                                   gSleepConfig.wait_idle_granularity_ms,
+                                   IdleCheck, NULL);
+}
+#endif
+
 static int
 SuspendInit(void)
 {
+#ifndef ENABLE_ASYNC_SUSPEND
     pthread_t suspend_tid;
+#endif
 
     // initialize wake time.
     ClockGetTime(&sTimeOnWake);
 
-    WaitObjectInit(&gWaitSuspendResponse);
-    WaitObjectInit(&gWaitPrepareSuspend);
+    if (!WaitEventInit(&gWaitSuspendResponse) ||
+            !WaitEventInit(&gWaitPrepareSuspend))
+    {
+        SLEEPDLOG_CRITICAL(MSGID_EVENTFD_CREATE_FAIL, 0,
+                           "Could not create suspend vote events\n");
+        abort();
+    }
 
     WaitObjectInit(&gWaitResumeMessage);
 
     com_palm_suspend_lunabus_init();
     PwrEventClientTableCreate();
+    ClientSnapshotRestore();
 
     SuspendIPCInit();
 
@@ -998,12 +1461,16 @@ SuspendInit(void)
             SLEEPDLOG_WARNING(MSGID_SUBSCRIBE_DISP_MGR_FAIL, 0, "Failed to subscribe for display status updates");
             LSErrorFree(&lserror);
         }
+#ifdef ENABLE_ASYNC_SUSPEND
+        SuspendMainLoopInit();
+#else
         if (pthread_create(&suspend_tid, NULL, SuspendThread, NULL))
         {
             SLEEPDLOG_CRITICAL(MSGID_PTHREAD_CREATE_FAIL, 0,
                                "Could not create SuspendThread\n");
             abort();
         }
+#endif
     }
 
     return 0;
@@ -38,11 +38,19 @@
 #include "lunaservice_utils.h"
 #include "sleepd_config.h"
 #include "json_utils.h"
+#include "wakeup.h"
+#include "lunabus.h"
+#include "timerwheel.h"
+#include "timeout_delivery.h"
 
 #define LOG_DOMAIN "PWREVENT-SUSPEND: "
 
-extern WaitObj gWaitSuspendResponse;
-extern WaitObj gWaitPrepareSuspend;
+/* Subscription key of the clients that identified themselves */
+static const char *kPwrEventsClientsKey = "PwrEventsClients";
+
+/* "/com/palm/power" on com.palm.sleep and "/suspend" on com.webos.service.power */
+static LunaBusCategory sPowerCategory;
+
 
 /**
  * @defgroup SuspendIPC Luna methods & signals
@@ -132,20 +140,36 @@ activityStartCallback(LSHandle *sh, LSMessage *message, void *user_data)
 
     const char *payload = LSMessageGetPayload(message);
 
-    struct json_object *object = json_tokener_parse(payload);
+    struct json_object *object = NULL;
+    char activityIdBuf[JSON_FLAT_STRING_MAX];
+    JsonFlatField fields[] =
+    {
+        JSON_FLAT_STRING("id", activityIdBuf),
+        JSON_FLAT_INT("duration_ms"),
+    };
 
-    if (!object)
+    const char *activity_id = NULL;
+    int duration_ms = 0;
+
+    if (json_flat_parse(payload, fields, G_N_ELEMENTS(fields)))
     {
-        goto malformed_json;
+        activity_id = activityIdBuf;
+        duration_ms = fields[1].num;
     }
+    else
+    {
+        object = json_tokener_parse(payload);
 
-    char *activity_id = NULL;
-    int duration_ms = 0;
+        if (!object)
+        {
+            goto malformed_json;
+        }
 
-    if(!get_json_string(object, "id", &activity_id))
-        goto malformed_json;
-    if(!get_json_int(object, "duration_ms", &duration_ms))
-        goto malformed_json;
+        if(!get_json_string(object, "id", &activity_id))
+            goto malformed_json;
+        if(!get_json_int(object, "duration_ms", &duration_ms))
+            goto malformed_json;
+    }
 
     if (duration_ms <= 0)
     {
@@ -203,17 +227,31 @@ activityEndCallback(LSHandle *sh, LSMessage *message, void *user_data)
 
     const char *payload = LSMessageGetPayload(message);
 
-    struct json_object *object = json_tokener_parse(payload);
+    struct json_object *object = NULL;
+    char activityIdBuf[JSON_FLAT_STRING_MAX];
+    JsonFlatField fields[] =
+    {
+        JSON_FLAT_STRING("id", activityIdBuf),
+    };
 
-    if (!object)
+    const char *activity_id = NULL;
+
+    if (json_flat_parse(payload, fields, G_N_ELEMENTS(fields)))
     {
-        goto malformed_json;
+        activity_id = activityIdBuf;
     }
+    else
+    {
+        object = json_tokener_parse(payload);
 
-    char *activity_id = NULL;
+        if (!object)
+        {
+            goto malformed_json;
+        }
 
-    if(!get_json_string(object, "id", &activity_id))
-        goto malformed_json;
+        if(!get_json_string(object, "id", &activity_id))
+            goto malformed_json;
+    }
 
     PwrEventActivityStop(activity_id);
 
@@ -244,7 +282,6 @@ end:
 bool
 identifyCallback(LSHandle *sh, LSMessage *message, void *data)
 {
-    bool retVal;
     LSError lserror;
     LSErrorInit(&lserror);
 
@@ -262,6 +299,7 @@ identifyCallback(LSHandle *sh, LSMessage *message, void *data)
 
     bool subscribe;
     char *clientName = NULL;
+    GString *reply;
 
     if(!get_json_string(object, "clientName", &clientName))
         goto invalid_syntax;
@@ -273,7 +311,22 @@ identifyCallback(LSHandle *sh, LSMessage *message, void *data)
         goto invalid_syntax;
     }
 
-    if (!LSSubscriptionAdd(sh, "PwrEventsClients", message, &lserror))
+    if (gSleepConfig.direct_signal_delivery)
+    {
+        /* The same client identifying again, on the other service name or
+         * through another handle, is the same voter: give it back the id it
+         * already has. It is reached through its first subscription, so this
+         * one is not added. */
+        struct PwrEventClientInfo *existing = PwrEventClientLookupByName(clientName);
+
+        if (existing && existing->message)
+        {
+            clientId = existing->clientId;
+            goto reply;
+        }
+    }
+
+    if (!LSSubscriptionAdd(sh, kPwrEventsClientsKey, message, &lserror))
     {
         goto lserror;
     }
@@ -290,23 +343,22 @@ identifyCallback(LSHandle *sh, LSMessage *message, void *data)
         goto error;
     }
 
-    info->clientName = g_strdup(clientName);
     info->clientId = g_strdup(clientId);
     info->applicationName = g_strdup(applicationName);
+    info->serviceName = g_strdup(LSMessageGetSenderServiceName(message));
+    PwrEventClientSetName(info, clientName);
 
-    char *reply = g_strdup_printf(
-                      "{\"subscribed\":true,\"clientId\":\"%s\",\"returnValue\":true}", clientId);
+    info->message = message;
+    LSMessageRef(message);
 
-    SLEEPDLOG_DEBUG("Pwrevents received identify, reply with %s", reply);
+reply:
+    reply = LSReplyBuffer();
+    LSReplyAppendPrintf(reply,
+                        "{\"subscribed\":true,\"clientId\":\"%s\",\"returnValue\":true}", clientId);
 
-    retVal = LSMessageReply(sh, message, reply, &lserror);
+    SLEEPDLOG_DEBUG("Pwrevents received identify, reply with %s", reply->str);
 
-    g_free(reply);
-
-    if (!retVal)
-    {
-        goto lserror;
-    }
+    LSMessageReplyBuffer(sh, message, reply);
 
     goto end;
 
@@ -396,116 +448,158 @@ TESTSuspendCallback(LSHandle *sh, LSMessage *message, void *user_data)
 }
 
 /**
- * @brief Broadcast the suspend request signal to all registered clients.
+ * @brief Reply to message with the JSON string returned by stats, and free it.
  */
-
-int
-SendSuspendRequest(const char *message)
+static bool
+replyStats(LSHandle *sh, LSMessage *message, gchar *(*stats)(void))
 {
-    bool retVal;
     LSError lserror;
     LSErrorInit(&lserror);
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/com/palm/power/suspendRequest",
-                          "{}", &lserror);
+    gchar *reply = stats();
 
-    if (!retVal)
+    if (!LSMessageReply(sh, message, reply, &lserror))
     {
         LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
-        goto exit;
     }
 
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/suspend/suspendRequest",
-                          "{}", &lserror);
+    g_free(reply);
 
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-    }
+    return true;
+}
 
-exit:
-    return retVal;
+/**
+ * @brief Report how often and why the device woke up from suspend.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
+bool
+wakeupReasonsCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    return replyStats(sh, message, PwrEventWakeupGetStats);
 }
 
 /**
- * @brief Broadcast the prepare suspend signal to all registered clients.
+ * @brief Report how long suspend attempts are held back after NACKs.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
  */
+bool
+suspendBackoffCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    return replyStats(sh, message, SuspendGetBackoffState);
+}
 
-int
-SendPrepareSuspend(const char *message)
+/**
+ * @brief Report how many signals were sent and how many messages were saved by
+ * sending them once per client instead of once per service name.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
+
+bool
+busStatsCallback(LSHandle *sh, LSMessage *message, void *user_data)
 {
-    bool retVal;
-    LSError lserror;
-    LSErrorInit(&lserror);
+    return replyStats(sh, message, LunaBusGetStats);
+}
+
+/**
+ * @brief Report how often the daemon's timers woke it up against how many
+ * timers fired, see timerwheel.c.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/com/palm/power/prepareSuspend",
-                          "{}", &lserror);
+bool
+timerStatsCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    return replyStats(sh, message, TimerWheelGetStats);
+}
 
-    if (!retVal)
+/**
+ * @brief Report how many fired timeouts were delivered, retried or dropped,
+ * see timeout_delivery.c.
+ *
+ * @param  sh
+ * @param  message
+ * @param  user_data
+ */
+
+bool
+deliveryStatsCallback(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    return replyStats(sh, message, timeout_delivery_get_stats);
+}
+
+/**
+ * @brief Send the suspend request signal only to the clients registered for it, or
+ * broadcast it to all clients when direct_signal_delivery is turned off.
+ */
+
+int
+SendSuspendRequest(const char *message)
+{
+    if (gSleepConfig.direct_signal_delivery)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-        goto exit;
+        int sent = PwrEventClientsNotify(kPwrEventVoteSuspendRequest,
+                                         "{\"signal\":\"suspendRequest\"}");
+        LunaBusAccountDirect(&sPowerCategory, kPwrEventsClientsKey, sent);
+        SLEEPDLOG_DEBUG("suspendRequest sent to %d voters", sent);
+        return true;
     }
 
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/suspend/prepareSuspend",
-                          "{}", &lserror);
+    return LunaBusSignalSend(&sPowerCategory, NULL, "suspendRequest", "{}");
+}
 
-    if (!retVal)
+/**
+ * @brief Send the prepare suspend signal only to the clients registered for it, or
+ * broadcast it to all clients when direct_signal_delivery is turned off.
+ */
+
+int
+SendPrepareSuspend(const char *message)
+{
+    if (gSleepConfig.direct_signal_delivery)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
+        int sent = PwrEventClientsNotify(kPwrEventVotePrepareSuspend,
+                                         "{\"signal\":\"prepareSuspend\"}");
+        LunaBusAccountDirect(&sPowerCategory, kPwrEventsClientsKey, sent);
+        SLEEPDLOG_DEBUG("prepareSuspend sent to %d voters", sent);
+        return true;
     }
 
-exit:
-    return retVal;
+    return LunaBusSignalSend(&sPowerCategory, NULL, "prepareSuspend", "{}");
 }
 
 /**
  * @brief Broadcast the "resume" signal when the device wakes up from sleep, or the
  * suspend action is aborted on the system.
+ *
+ * Always broadcast, direct_signal_delivery does not apply: the timeout module
+ * and other listeners add a match on the signal without ever identifying.
  */
 
 int
 SendResume(int resumetype, char *message)
 {
     bool retVal;
-    LSError lserror;
-    LSErrorInit(&lserror);
 
     SLEEPDLOG_DEBUG("sending \"resume\" because %s", message);
 
     char *payload = g_strdup_printf(
                         "{\"resumetype\":%d}", resumetype);
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/com/palm/power/resume",
-                          payload, &lserror);
-
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-        goto exit;
-    }
-
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/suspend/resume",
-                          payload, &lserror);
+    retVal = LunaBusSignalSend(&sPowerCategory, NULL, "resume", payload);
 
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-    }
-
-exit:
     g_free(payload);
     return retVal;
 }
@@ -513,39 +607,14 @@ exit:
 
 /**
  * @brief Broadcast the "suspended" signal when the system is just about to go to sleep.
+ * Always broadcast, like "resume".
  */
 int
 SendSuspended(const char *message)
 {
-    bool retVal;
-    LSError lserror;
-    LSErrorInit(&lserror);
-
     SLEEPDLOG_DEBUG("sending \"suspended\" because %s", message);
 
-    retVal = LSSignalSend(GetLunaServiceHandle(),
-                          "luna://com.palm.sleep/com/palm/power/suspended",
-                          "{}", &lserror);
-
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-        goto exit;
-    }
-
-    retVal = LSSignalSend(GetWebosLunaServiceHandle(),
-                          "luna://com.webos.service.power/suspend/suspended",
-                          "{}", &lserror);
-
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-    }
-
-exit:
-    return retVal;
+    return LunaBusSignalSend(&sPowerCategory, NULL, "suspended", "{}");
 }
 
 /**
@@ -611,22 +680,38 @@ end:
 bool
 suspendRequestAck(LSHandle *sh, LSMessage *message, void *data)
 {
-    struct json_object *object = json_tokener_parse(
-                                     LSMessageGetPayload(message));
+    struct json_object *object = NULL;
+    char clientIdBuf[JSON_FLAT_STRING_MAX];
+    JsonFlatField fields[] =
+    {
+        JSON_FLAT_STRING("clientId", clientIdBuf),
+        JSON_FLAT_BOOLEAN("ack"),
+    };
 
-    if (!object)
+    const char *clientId = NULL;
+    bool ack;
+
+    // Every voter acks at once during a round, skip json-c when we can.
+    if (json_flat_parse(LSMessageGetPayload(message), fields, G_N_ELEMENTS(fields)))
     {
-        goto malformed_json;
+        clientId = clientIdBuf;
+        ack = fields[1].boolean;
     }
+    else
+    {
+        object = json_tokener_parse(LSMessageGetPayload(message));
 
-    char *clientId = NULL;
-    bool ack;
+        if (!object)
+        {
+            goto malformed_json;
+        }
 
-    if(!get_json_string(object, "clientId", &clientId))
-        goto invalid_syntax;
+        if(!get_json_string(object, "clientId", &clientId))
+            goto invalid_syntax;
 
-    if(!get_json_boolean(object, "ack", &ack))
-        goto invalid_syntax;
+        if(!get_json_boolean(object, "ack", &ack))
+            goto invalid_syntax;
+    }
 
     struct PwrEventClientInfo *clientInfo = PwrEventClientLookup(clientId);
 
@@ -643,7 +728,7 @@ suspendRequestAck(LSHandle *sh, LSMessage *message, void *data)
     // returns true when all clients have acked.
     if (PwrEventVoteSuspendRequest(clientId, ack))
     {
-        WaitObjectSignal(&gWaitSuspendResponse);
+        SuspendRequestVotesDone();
     }
 
     LSMessageReplySuccess(sh, message);
@@ -731,22 +816,38 @@ end:
 bool
 prepareSuspendAck(LSHandle *sh, LSMessage *message, void *data)
 {
-    struct json_object *object = json_tokener_parse(
-                                     LSMessageGetPayload(message));
+    struct json_object *object = NULL;
+    char clientIdBuf[JSON_FLAT_STRING_MAX];
+    JsonFlatField fields[] =
+    {
+        JSON_FLAT_STRING("clientId", clientIdBuf),
+        JSON_FLAT_BOOLEAN("ack"),
+    };
 
-    if (!object)
+    const char *clientId = NULL;
+    bool ack;
+
+    // Every voter acks at once during a round, skip json-c when we can.
+    if (json_flat_parse(LSMessageGetPayload(message), fields, G_N_ELEMENTS(fields)))
     {
-        goto malformed_json;
+        clientId = clientIdBuf;
+        ack = fields[1].boolean;
     }
+    else
+    {
+        object = json_tokener_parse(LSMessageGetPayload(message));
 
-    char *clientId = NULL;
-    bool ack;
+        if (!object)
+        {
+            goto malformed_json;
+        }
 
-    if(!get_json_string(object, "clientId", &clientId))
-        goto invalid_syntax;
+        if(!get_json_string(object, "clientId", &clientId))
+            goto invalid_syntax;
 
-    if(!get_json_boolean(object, "ack", &ack))
-        goto invalid_syntax;
+        if(!get_json_boolean(object, "ack", &ack))
+            goto invalid_syntax;
+    }
 
     struct PwrEventClientInfo *clientInfo = PwrEventClientLookup(clientId);
     if (!clientInfo)
@@ -775,7 +876,7 @@ prepareSuspendAck(LSHandle *sh, LSMessage *message, void *data)
     // returns true when all clients have acked.
     if (PwrEventVotePrepareSuspend(clientId, ack))
     {
-        WaitObjectSignal(&gWaitPrepareSuspend);
+        PrepareSuspendVotesDone();
     }
 
     LSMessageReplySuccess(sh, message);
@@ -838,6 +939,12 @@ LSMethod com_palm_suspend_methods[] =
 
     { "TESTSuspend", TESTSuspendCallback },
 
+    { "wakeupReasons", wakeupReasonsCallback },
+    { "suspendBackoff", suspendBackoffCallback },
+    { "busStats", busStatsCallback },
+    { "timerStats", timerStatsCallback },
+    { "deliveryStats", deliveryStatsCallback },
+
     { },
 };
 
@@ -859,20 +966,20 @@ int com_palm_suspend_lunabus_init(void)
     LSError lserror;
     LSErrorInit(&lserror);
 
-    // Registering "/com/palm/power" category with com.palm.sleep service (to be deprecated)
-    if (!LSRegisterCategory(GetLunaServiceHandle(), "/com/palm/power",
-                                       com_palm_suspend_methods,
-                                       com_palm_suspend_signals,
-                                       NULL, &lserror))
+    // "/com/palm/power" on com.palm.sleep (to be deprecated) and "/suspend" on
+    // com.webos.service.power share one method table.
+    if (!LunaBusCategoryAddName(&sPowerCategory, GetLunaServiceHandle(),
+                                "com.palm.sleep", "/com/palm/power") ||
+            !LunaBusCategoryAddName(&sPowerCategory, GetWebosLunaServiceHandle(),
+                                    "com.webos.service.power", "/suspend"))
     {
-        goto error;
+        SLEEPDLOG_ERROR(MSGID_CATEGORY_REG_FAIL, 0,
+                        "could not publish /suspend, service not registered");
+        return -1;
     }
 
-    // Registering "suspend" category with the com.webos.service.power service.
-    if (!LSRegisterCategory(GetWebosLunaServiceHandle(), "/suspend",
-                                       com_palm_suspend_methods,
-                                       com_palm_suspend_signals,
-                                       NULL, &lserror))
+    if (!LunaBusRegisterCategory(&sPowerCategory, com_palm_suspend_methods,
+                                 com_palm_suspend_signals, &lserror))
     {
         goto error;
     }
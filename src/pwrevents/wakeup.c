@@ -0,0 +1,423 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file wakeup.c
+ *
+ * @brief Attribute every kernel resume to the wakeup source that caused it, using
+ * the kernel wakeup source list, and keep per-reason wake counters.
+ *
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "wakeup.h"
+#include "suspend.h"
+#include "reference_time.h"
+#include "sleepd_config.h"
+#include "sysfs.h"
+#include "logging.h"
+#include "init.h"
+
+#define LOG_DOMAIN "PWREVENT-WAKEUP: "
+
+/* A wake this close to the queued RTC alarm is attributed to that alarm. */
+#define RTC_WAKE_TOLERANCE_S 2
+
+#define WAKEUP_SOURCE_NAME_MAX 64
+
+/**
+ * @defgroup WakeupReasons  Wakeup Reasons
+ * @ingroup PowerEvents
+ * @brief Find out why the device woke up.
+ *
+ * Each kernel resume is attributed to the first of:
+ *
+ * - user:<src> a wakeup source that belongs to a button or touch event.
+ * - irq:batterycheck  the battery check wakeup.
+ * - rtc:<key>  the RTC alarm queued for the timeout "key" was due at resume and
+ *              no wakeup source other than the RTC fired.
+ * - irq:<src>  any other wakeup source.
+ * - unknown    nothing could be read from the kernel.
+ *
+ * The wakeup source is read from wakeup_event_list_path if the platform provides
+ * it. Otherwise it is the source whose wakeup_count went up while suspended,
+ * read from wakeup_sources_path (debugfs) or wakeup_class_dir.
+ */
+
+/**
+ * @addtogroup WakeupReasons
+ * @{
+ */
+
+/* Substrings of wakeup source names that stand for a user action */
+static const char *kUserWakeupSources[] =
+{
+    "power",
+    "pwrkey",
+    "gpio-keys",
+    "gpio_keys",
+    "keypad",
+    "touch",
+    NULL
+};
+
+/* Substrings of wakeup source names that stand for the RTC alarm */
+static const char *kRtcWakeupSources[] =
+{
+    "rtc",
+    "alarm",
+    NULL
+};
+
+static pthread_mutex_t wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static GHashTable *sWakeReasons = NULL;   // reason -> number of wakes
+static GHashTable *sWakeupCounts = NULL;  // wakeup source -> wakeup_count at suspend
+static time_t sRtcExpiry = 0;
+static gchar *sRtcKey = NULL;
+static gchar *sLastReason = NULL;
+static guint sTotalWakes = 0;
+static struct timespec sTrackingStart;
+
+/**
+ * @brief Read the wakeup_count of every wakeup source, from the debugfs table or
+ * from the wakeup class directory when debugfs is not mounted.
+ *
+ * @retval Table from source name to wakeup count, NULL if none could be read.
+ */
+static GHashTable *
+_read_wakeup_counts(void)
+{
+    GHashTable *counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                         NULL);
+    gchar *contents = NULL;
+
+    if (gSleepConfig.wakeup_sources_path &&
+            g_file_get_contents(gSleepConfig.wakeup_sources_path, &contents, NULL, NULL))
+    {
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        int i;
+
+        // first line is the column header
+        for (i = 1; lines[i]; i++)
+        {
+            char name[WAKEUP_SOURCE_NAME_MAX];
+            unsigned long active_count, event_count, wakeup_count;
+
+            if (sscanf(lines[i], "%63s %lu %lu %lu", name, &active_count, &event_count,
+                       &wakeup_count) == 4)
+            {
+                g_hash_table_replace(counts, g_strdup(name), GUINT_TO_POINTER(wakeup_count));
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(contents);
+    }
+    else if (gSleepConfig.wakeup_class_dir)
+    {
+        GDir *dir = g_dir_open(gSleepConfig.wakeup_class_dir, 0, NULL);
+        const gchar *entry;
+
+        while (dir && (entry = g_dir_read_name(dir)))
+        {
+            char name[WAKEUP_SOURCE_NAME_MAX];
+            int wakeup_count = 0;
+            bool found;
+
+            gchar *path = g_build_filename(gSleepConfig.wakeup_class_dir, entry, "name",
+                                           NULL);
+            found = (SysfsGetString(path, name, sizeof(name)) == 0);
+            g_free(path);
+
+            path = g_build_filename(gSleepConfig.wakeup_class_dir, entry, "wakeup_count",
+                                    NULL);
+            found = found && (SysfsGetInt(path, &wakeup_count) == 0);
+            g_free(path);
+
+            if (found)
+            {
+                g_hash_table_replace(counts, g_strdup(name), GUINT_TO_POINTER(wakeup_count));
+            }
+        }
+
+        if (dir)
+        {
+            g_dir_close(dir);
+        }
+    }
+
+    if (!g_hash_table_size(counts))
+    {
+        g_hash_table_destroy(counts);
+        return NULL;
+    }
+
+    return counts;
+}
+
+/**
+ * @brief Get the names of the wakeup sources that fired since we suspended.
+ *
+ * @retval List of newly allocated names, to be freed by the caller.
+ */
+static GList *
+_read_wakeup_sources(void)
+{
+    GList *sources = NULL;
+    gchar *contents = NULL;
+
+    if (gSleepConfig.wakeup_event_list_path &&
+            g_file_get_contents(gSleepConfig.wakeup_event_list_path, &contents, NULL,
+                                NULL))
+    {
+        gchar **lines = g_strsplit(contents, "\n", -1);
+        int i;
+
+        for (i = 0; lines[i]; i++)
+        {
+            g_strstrip(lines[i]);
+
+            if (*lines[i])
+            {
+                sources = g_list_append(sources, g_strdup(lines[i]));
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(contents);
+
+        if (sources)
+        {
+            return sources;
+        }
+    }
+
+    GHashTable *counts = _read_wakeup_counts();
+
+    if (counts && sWakeupCounts)
+    {
+        GHashTableIter iter;
+        gpointer name, count;
+
+        g_hash_table_iter_init(&iter, counts);
+
+        while (g_hash_table_iter_next(&iter, &name, &count))
+        {
+            gpointer before;
+
+            if (!g_hash_table_lookup_extended(sWakeupCounts, name, NULL, &before) ||
+                    GPOINTER_TO_UINT(count) > GPOINTER_TO_UINT(before))
+            {
+                sources = g_list_append(sources, g_strdup(name));
+            }
+        }
+    }
+
+    if (counts)
+    {
+        g_hash_table_destroy(counts);
+    }
+
+    return sources;
+}
+
+static bool
+_is_source_of(const char *name, const char **kinds)
+{
+    int i;
+
+    for (i = 0; kinds[i]; i++)
+    {
+        if (strstr(name, kinds[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Pick the reason for the wake from the fired wakeup sources and the RTC
+ * alarm that was queued before suspend.
+ *
+ * @param sources   Names of the wakeup sources that fired
+ * @param wake_time reference_time() taken when the kernel resumed
+ */
+static gchar *
+_attribute_wakeup(GList *sources, time_t wake_time)
+{
+    GList *iter;
+    const char *irq_source = NULL;
+    int batterycheck = BATTERYCHECK_NONE;
+
+    for (iter = sources; iter != NULL; iter = iter->next)
+    {
+        if (_is_source_of(iter->data, kUserWakeupSources))
+        {
+            return g_strdup_printf("user:%s", (const char *)iter->data);
+        }
+
+        if (!irq_source && !_is_source_of(iter->data, kRtcWakeupSources))
+        {
+            irq_source = iter->data;
+        }
+    }
+
+    if (SysfsGetInt(gSleepConfig.batterycheck_wakeup_path, &batterycheck) == 0 &&
+            batterycheck > BATTERYCHECK_NONE && batterycheck < BATTERYCHECK_END)
+    {
+        return g_strdup("irq:batterycheck");
+    }
+
+    if (!irq_source && sRtcKey && wake_time + RTC_WAKE_TOLERANCE_S >= sRtcExpiry)
+    {
+        return g_strdup_printf("rtc:%s", sRtcKey);
+    }
+
+    if (sources)
+    {
+        return g_strdup_printf("irq:%s", irq_source ? irq_source :
+                               (const char *)sources->data);
+    }
+
+    return g_strdup("unknown");
+}
+
+/**
+ * @brief Remember what should wake us up, right before the device suspends.
+ *
+ * @param rtc_expiry Time of the RTC alarm queued for the next wakeup timeout
+ * @param rtc_key    Key of that timeout, or NULL if there is none
+ */
+void
+PwrEventWakeupSnapshot(time_t rtc_expiry, const char *rtc_key)
+{
+    GHashTable *counts = _read_wakeup_counts();
+
+    pthread_mutex_lock(&wakeup_mutex);
+
+    sRtcExpiry = rtc_expiry;
+    g_free(sRtcKey);
+    sRtcKey = g_strdup(rtc_key);
+
+    if (sWakeupCounts)
+    {
+        g_hash_table_destroy(sWakeupCounts);
+    }
+
+    sWakeupCounts = counts;
+
+    pthread_mutex_unlock(&wakeup_mutex);
+}
+
+/**
+ * @brief Attribute the last kernel resume to a wakeup reason and account it.
+ *
+ * @param wake_time reference_time() taken when the kernel resumed
+ */
+void
+PwrEventWakeupAttribute(time_t wake_time)
+{
+    pthread_mutex_lock(&wakeup_mutex);
+
+    GList *sources = _read_wakeup_sources();
+    gchar *reason = _attribute_wakeup(sources, wake_time);
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(sWakeReasons, reason)) + 1;
+
+    g_hash_table_replace(sWakeReasons, g_strdup(reason), GUINT_TO_POINTER(count));
+    sTotalWakes++;
+
+    g_free(sLastReason);
+    sLastReason = reason;
+
+    SLEEPDLOG_DEBUG("Woke up because of %s (%u times so far)", reason, count);
+
+    pthread_mutex_unlock(&wakeup_mutex);
+
+    g_list_free_full(sources, g_free);
+}
+
+/**
+ * @brief Wake counters as a JSON reply payload.
+ *
+ * @retval Newly allocated string, to be freed by the caller.
+ */
+gchar *
+PwrEventWakeupGetStats(void)
+{
+    struct timespec now;
+    GHashTableIter iter;
+    gpointer reason, count;
+    bool first = true;
+
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    double hours = (now.tv_sec - sTrackingStart.tv_sec) / 3600.0;
+
+    GString *str = g_string_new("{\"returnValue\":true");
+
+    pthread_mutex_lock(&wakeup_mutex);
+
+    g_string_append_printf(str, ",\"wakes\":%u,\"hours\":%.2f,\"wakesPerHour\":%.2f",
+                           sTotalWakes, hours, hours > 0 ? sTotalWakes / hours : 0);
+
+    if (sLastReason)
+    {
+        gchar *escaped = g_strescape(sLastReason, NULL);
+        g_string_append_printf(str, ",\"lastReason\":\"%s\"", escaped);
+        g_free(escaped);
+    }
+
+    g_string_append(str, ",\"reasons\":[");
+
+    g_hash_table_iter_init(&iter, sWakeReasons);
+
+    while (g_hash_table_iter_next(&iter, &reason, &count))
+    {
+        gchar *escaped = g_strescape(reason, NULL);
+        g_string_append_printf(str,
+                               "%s{\"reason\":\"%s\",\"count\":%u,\"wakesPerHour\":%.2f}",
+                               first ? "" : ",", escaped, GPOINTER_TO_UINT(count),
+                               hours > 0 ? GPOINTER_TO_UINT(count) / hours : 0);
+        g_free(escaped);
+        first = false;
+    }
+
+    pthread_mutex_unlock(&wakeup_mutex);
+
+    g_string_append(str, "]}");
+
+    return g_string_free(str, FALSE);
+}
+
+static int
+_wakeup_init(void)
+{
+    sWakeReasons = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    clock_gettime(CLOCK_BOOTTIME, &sTrackingStart);
+
+    return 0;
+}
+
+INIT_FUNC(INIT_FUNC_EARLY, _wakeup_init);
+
+/* @} END OF WakeupReasons */
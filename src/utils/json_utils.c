@@ -83,3 +83,251 @@ bool get_json_object_as_string(struct json_object *object, const char *key,
 
     return result;
 }
+
+static const char *
+json_flat_skip_ws(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+/* Scan a string that has no escapes; *p is left after the closing quote. */
+static bool
+json_flat_scan_string(const char **p, const char **start, size_t *len)
+{
+    const char *s = *p;
+
+    if (*s != '"')
+    {
+        return false;
+    }
+
+    *start = ++s;
+
+    while (*s != '"')
+    {
+        if (*s == '\0' || *s == '\\' || (unsigned char)*s < 0x20)
+        {
+            return false;
+        }
+
+        s++;
+    }
+
+    *len = s - *start;
+    *p = s + 1;
+    return true;
+}
+
+static JsonFlatField *
+json_flat_find_field(JsonFlatField *fields, int num_fields, const char *key,
+                     size_t key_len)
+{
+    int i;
+
+    for (i = 0; i < num_fields; i++)
+    {
+        if (!strncmp(fields[i].key, key, key_len) && fields[i].key[key_len] == '\0')
+        {
+            return &fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Read the given fields out of a flat JSON object without building a
+ * json-c tree.
+ *
+ * Only objects whose values are strings without escapes, ints, booleans or
+ * null are handled. Everything else returns false: nested values, escapes,
+ * floats, duplicate keys, a missing field, a field of the wrong type, or an
+ * empty or oversized string. The caller then parses the payload with json-c,
+ * which gives the same result and the same error reply as before.
+ *
+ * @param payload JSON text
+ * @param fields Fields to look for, all of them are required
+ * @param num_fields Number of fields
+ *
+ * @retval true if every field was found with the expected type
+ */
+bool
+json_flat_parse(const char *payload, JsonFlatField *fields, int num_fields)
+{
+    const char *p;
+    int i;
+
+    if (!payload)
+    {
+        return false;
+    }
+
+    for (i = 0; i < num_fields; i++)
+    {
+        fields[i].found = false;
+    }
+
+    p = json_flat_skip_ws(payload);
+
+    if (*p++ != '{')
+    {
+        return false;
+    }
+
+    p = json_flat_skip_ws(p);
+
+    while (*p != '}')
+    {
+        const char *key, *str;
+        size_t key_len, len;
+        JsonFlatField *field;
+
+        if (!json_flat_scan_string(&p, &key, &key_len))
+        {
+            return false;
+        }
+
+        p = json_flat_skip_ws(p);
+
+        if (*p++ != ':')
+        {
+            return false;
+        }
+
+        p = json_flat_skip_ws(p);
+
+        field = json_flat_find_field(fields, num_fields, key, key_len);
+
+        /* json-c keeps the last of duplicate keys, leave those to it */
+        if (field && field->found)
+        {
+            return false;
+        }
+
+        if (*p == '"')
+        {
+            if (!json_flat_scan_string(&p, &str, &len))
+            {
+                return false;
+            }
+
+            if (field)
+            {
+                if (field->type != kJsonFlatString || len == 0 || len >= field->str_size)
+                {
+                    return false;
+                }
+
+                memcpy(field->str, str, len);
+                field->str[len] = '\0';
+                field->found = true;
+            }
+        }
+        else if (*p == '-' || (*p >= '0' && *p <= '9'))
+        {
+            bool negative = (*p == '-');
+            int digits = 0;
+            long value = 0;
+
+            if (negative)
+            {
+                p++;
+            }
+
+            if (p[0] == '0' && p[1] >= '0' && p[1] <= '9')
+            {
+                return false;
+            }
+
+            while (*p >= '0' && *p <= '9')
+            {
+                value = value * 10 + (*p++ - '0');
+                digits++;
+            }
+
+            if (digits == 0 || digits > 9 || *p == '.' || *p == 'e' || *p == 'E')
+            {
+                return false;
+            }
+
+            if (field)
+            {
+                if (field->type != kJsonFlatInt)
+                {
+                    return false;
+                }
+
+                field->num = negative ? -value : value;
+                field->found = true;
+            }
+        }
+        else if (!strncmp(p, "true", 4) || !strncmp(p, "false", 5))
+        {
+            bool value = (*p == 't');
+
+            p += value ? 4 : 5;
+
+            if (field)
+            {
+                if (field->type != kJsonFlatBoolean)
+                {
+                    return false;
+                }
+
+                field->boolean = value;
+                field->found = true;
+            }
+        }
+        else if (!strncmp(p, "null", 4))
+        {
+            p += 4;
+
+            if (field)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        p = json_flat_skip_ws(p);
+
+        if (*p == ',')
+        {
+            p = json_flat_skip_ws(p + 1);
+
+            if (*p == '}')
+            {
+                return false;
+            }
+        }
+        else if (*p != '}')
+        {
+            return false;
+        }
+    }
+
+    p = json_flat_skip_ws(p + 1);
+
+    if (*p != '\0')
+    {
+        return false;
+    }
+
+    for (i = 0; i < num_fields; i++)
+    {
+        if (!fields[i].found)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,310 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file lunabus.c
+ *
+ * @brief Publish a category under both the legacy com.palm.sleep names and the
+ * new com.webos.service.* names with one method table, and send its signals.
+ *
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <pthread.h>
+#include <json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "lunabus.h"
+#include "json_utils.h"
+#include "sleepd_config.h"
+#include "logging.h"
+
+#define LOG_DOMAIN "LUNABUS: "
+
+static pthread_mutex_t lunabus_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static guint64 sNumSignals = 0;
+static guint64 sNumSent = 0;
+static guint64 sNumSaved = 0;
+
+static void
+LunaBusAccount(guint sent, guint baseline)
+{
+    pthread_mutex_lock(&lunabus_mutex);
+    sNumSignals++;
+    sNumSent += sent;
+    sNumSaved += baseline > sent ? baseline - sent : 0;
+    pthread_mutex_unlock(&lunabus_mutex);
+}
+
+/**
+ * @brief Add a service name to publish the category under.
+ *
+ * @param cat Category
+ * @param sh Handle of the service, may be NULL if the service is not registered
+ * @param service Service name, e.g. "com.palm.sleep"
+ * @param category Category on that service, e.g. "/com/palm/power"
+ */
+bool
+LunaBusCategoryAddName(LunaBusCategory *cat, LSHandle *sh,
+                       const char *service, const char *category)
+{
+    if (!sh || cat->num_names >= LUNABUS_MAX_NAMES)
+    {
+        return false;
+    }
+
+    cat->names[cat->num_names].sh = sh;
+    cat->names[cat->num_names].service = service;
+    cat->names[cat->num_names].category = category;
+    cat->num_names++;
+
+    return true;
+}
+
+/**
+ * @brief Register the method table and signals under every name of the category.
+ */
+bool
+LunaBusRegisterCategory(LunaBusCategory *cat, LSMethod *methods,
+                        LSSignal *signals, LSError *lserror)
+{
+    int i;
+
+    for (i = 0; i < cat->num_names; i++)
+    {
+        if (!LSRegisterCategory(cat->names[i].sh, cat->names[i].category,
+                                methods, signals, NULL, lserror))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static gchar *
+LunaBusSignalUri(const LunaBusName *name, const char *signal)
+{
+    if (!strcmp(name->category, "/"))
+    {
+        return g_strdup_printf("luna://%s/%s", name->service, signal);
+    }
+
+    return g_strdup_printf("luna://%s%s/%s", name->service, name->category, signal);
+}
+
+/**
+ * @brief Key a subscriber by the clientName it subscribed with, which is the same
+ * on every handle of the client. Falls back to the unique sender name.
+ */
+static gchar *
+LunaBusSubscriberKey(LSMessage *subscriber)
+{
+    struct json_object *object = json_tokener_parse(LSMessageGetPayload(subscriber));
+    const char *clientName = NULL;
+    gchar *key;
+
+    if (object && get_json_string(object, "clientName", &clientName))
+    {
+        key = g_strdup(clientName);
+    }
+    else
+    {
+        key = g_strdup(LSMessageGetSender(subscriber));
+    }
+
+    if (object)
+    {
+        json_object_put(object);
+    }
+
+    return key;
+}
+
+/**
+ * @brief Reply to every subscriber of the category once, no matter how many of
+ * the category's names it subscribed on.
+ */
+static bool
+LunaBusRespondUnique(LunaBusCategory *cat, const char *subscription_key,
+                     const char *signal, const char *payload)
+{
+    GHashTable *clients;
+    guint sent = 0, baseline = 0;
+    const char *message;
+    int i;
+
+    /* Tag the payload with the signal name so one subscription can carry them all */
+    struct json_object *object = json_tokener_parse(payload);
+
+    if (!object || !json_object_is_type(object, json_type_object))
+    {
+        SLEEPDLOG_WARNING(MSGID_INVALID_JSON_REPLY, 1, PMLOGKS("Signal", signal),
+                          "signal payload is not a JSON object");
+
+        if (object)
+        {
+            json_object_put(object);
+        }
+
+        return false;
+    }
+
+    json_object_object_add(object, "signal", json_object_new_string(signal));
+    message = json_object_to_json_string(object);
+
+    clients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 0; i < cat->num_names; i++)
+    {
+        LSSubscriptionIter *iter = NULL;
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!LSSubscriptionAcquire(cat->names[i].sh, subscription_key, &iter,
+                                   &lserror))
+        {
+            LSErrorFree(&lserror);
+            continue;
+        }
+
+        while (LSSubscriptionHasNext(iter))
+        {
+            LSMessage *subscriber = LSSubscriptionNext(iter);
+            gchar *key = LunaBusSubscriberKey(subscriber);
+
+            baseline++;
+
+            if (key)
+            {
+                if (g_hash_table_contains(clients, key))
+                {
+                    g_free(key);
+                    continue;
+                }
+
+                g_hash_table_add(clients, key);
+            }
+
+            if (LSMessageRespond(subscriber, message, &lserror))
+            {
+                sent++;
+            }
+            else
+            {
+                LSErrorFree(&lserror);
+            }
+        }
+
+        LSSubscriptionRelease(iter);
+    }
+
+    g_hash_table_destroy(clients);
+    json_object_put(object);
+
+    LunaBusAccount(sent, baseline);
+
+    return true;
+}
+
+/**
+ * @brief Send a signal of the category.
+ *
+ * It goes to each client subscribed under subscription_key as a subscription
+ * reply, tagged with the signal name. A client that subscribed under several
+ * names gets it only once. Without a subscription_key, or with
+ * direct_signal_delivery turned off, it is broadcast once under each name of
+ * the category.
+ *
+ * @param cat Category
+ * @param subscription_key Subscription key of the category's clients, or NULL
+ * to always broadcast
+ * @param signal Signal name
+ * @param payload Signal payload
+ */
+bool
+LunaBusSignalSend(LunaBusCategory *cat, const char *subscription_key,
+                  const char *signal, const char *payload)
+{
+    bool retVal = true;
+    int i;
+
+    if (gSleepConfig.direct_signal_delivery && subscription_key)
+    {
+        return LunaBusRespondUnique(cat, subscription_key, signal, payload);
+    }
+
+    for (i = 0; i < cat->num_names; i++)
+    {
+        gchar *uri = LunaBusSignalUri(&cat->names[i], signal);
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        if (!LSSignalSend(cat->names[i].sh, uri, payload, &lserror))
+        {
+            LSErrorPrint(&lserror, stderr);
+            LSErrorFree(&lserror);
+            retVal = false;
+        }
+
+        g_free(uri);
+    }
+
+    LunaBusAccount(cat->num_names, cat->num_names);
+
+    return retVal;
+}
+
+/**
+ * @brief Account for a signal the caller delivered itself to "sent" clients, in
+ * place of replying to all subscribers of the category.
+ */
+void
+LunaBusAccountDirect(LunaBusCategory *cat, const char *subscription_key,
+                     int sent)
+{
+    guint baseline = 0;
+    int i;
+
+    for (i = 0; i < cat->num_names; i++)
+    {
+        baseline += LSSubscriptionGetHandleSubscribersCount(cat->names[i].sh,
+                    subscription_key);
+    }
+
+    LunaBusAccount(sent, baseline);
+}
+
+/**
+ * @brief Signal delivery counters as a JSON string.
+ */
+gchar *
+LunaBusGetStats(void)
+{
+    gchar *ret;
+
+    pthread_mutex_lock(&lunabus_mutex);
+    ret = g_strdup_printf("{\"returnValue\":true,\"signals\":%" G_GUINT64_FORMAT ",\"sent\":%"
+                          G_GUINT64_FORMAT ",\"saved\":%" G_GUINT64_FORMAT
+                          ",\"directDelivery\":%s}",
+                          sNumSignals, sNumSent, sNumSaved,
+                          gSleepConfig.direct_signal_delivery ? "true" : "false");
+    pthread_mutex_unlock(&lunabus_mutex);
+
+    return ret;
+}
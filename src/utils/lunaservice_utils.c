@@ -14,89 +14,224 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+/**
+ * @file lunaservice_utils.c
+ *
+ * @brief Reply helpers for luna handlers.
+ *
+ * Constant replies are sent straight from static storage. Replies that carry
+ * values are built in a per-thread buffer that is reused from one call to the
+ * next, so a handler's reply path does not allocate once the buffer has grown
+ * to fit its largest reply.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
 #include "lunaservice_utils.h"
 
-void
-LSMessageReplyErrorUnknown(LSHandle *sh, LSMessage *message)
+#define LS_REPLY_BUFFER_SIZE 256
+
+const char kLSReplySuccess[] = "{\"returnValue\":true}";
+const char kLSReplyFailure[] = "{\"returnValue\":false}";
+const char kLSReplyErrorUnknown[] = "{\"returnValue\":false, \"errorCode\":-1,"
+                                    "\"errorText\":\"Unknown Error.\"}";
+const char kLSReplyErrorInvalidParams[] =
+    "{\"returnValue\":false, \"errorCode\":-1,"
+    "\"errorText\":\"Invalid parameters.\"}";
+const char kLSReplyErrorBadJSON[] = "{\"returnValue\":false, \"errorCode\":-1,"
+                                    "\"errorText\":\"Malformed json.\"}";
+
+static void
+LSReplyBufferFree(gpointer data)
 {
-    LSError lserror;
-    LSErrorInit(&lserror);
+    g_string_free((GString *)data, TRUE);
+}
 
-    bool retVal = LSMessageReply(sh, message, "{\"returnValue\":false, \"errorCode\":-1,"
-                                 "\"errorText\":\"Unknown Error.\"}", &lserror);
+static GPrivate sReplyBuffer = G_PRIVATE_INIT(LSReplyBufferFree);
 
-    if (!retVal)
+/**
+ * @brief Get the calling thread's reply buffer, emptied.
+ *
+ * The buffer stays valid until the next call to LSReplyBuffer() on the same
+ * thread, so it must be sent before any other reply is built.
+ */
+GString *
+LSReplyBuffer(void)
+{
+    GString *reply = g_private_get(&sReplyBuffer);
+
+    if (!reply)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
+        reply = g_string_sized_new(LS_REPLY_BUFFER_SIZE);
+        g_private_set(&sReplyBuffer, reply);
     }
+
+    g_string_truncate(reply, 0);
+
+    return reply;
 }
 
+/**
+ * @brief Append formatted text to a reply in place.
+ *
+ * Unlike g_string_append_printf() this formats directly into the buffer
+ * instead of into a temporary string.
+ */
 void
-LSMessageReplyErrorInvalidParams(LSHandle *sh, LSMessage *message)
+LSReplyAppendVprintf(GString *reply, const char *format, va_list args)
 {
-    LSError lserror;
-    LSErrorInit(&lserror);
+    gsize offset = reply->len;
+    va_list copy;
+    int len;
 
-    bool retVal = LSMessageReply(sh, message, "{\"returnValue\":false, \"errorCode\":-1,"
-                                 "\"errorText\":\"Invalid parameters.\"}", NULL);
+    va_copy(copy, args);
+    len = vsnprintf(reply->str + offset, reply->allocated_len - offset, format,
+                    copy);
+    va_end(copy);
 
-    if (!retVal)
+    if (len < 0)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
+        reply->str[offset] = '\0';
+        return;
     }
+
+    if (offset + len >= reply->allocated_len)
+    {
+        g_string_set_size(reply, offset + len);
+        vsnprintf(reply->str + offset, reply->allocated_len - offset, format, args);
+    }
+
+    reply->len = offset + len;
 }
 
 void
-LSMessageReplyErrorBadJSON(LSHandle *sh, LSMessage *message)
+LSReplyAppendPrintf(GString *reply, const char *format, ...)
 {
-    LSError lserror;
-    LSErrorInit(&lserror);
+    va_list args;
 
-    bool retVal = LSMessageReply(sh, message, "{\"returnValue\":false, \"errorCode\":-1,"
-                                 "\"errorText\":\"Malformed json.\"}", NULL);
+    va_start(args, format);
+    LSReplyAppendVprintf(reply, format, args);
+    va_end(args);
+}
 
-    if (!retVal)
+/**
+ * @brief Append a string to a reply, escaped for use inside a JSON string.
+ */
+void
+LSReplyAppendEscaped(GString *reply, const char *str)
+{
+    const char *p;
+
+    if (!str)
     {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
+        return;
+    }
+
+    for (p = str; *p; p++)
+    {
+        unsigned char c = *p;
+
+        switch (c)
+        {
+            case '"':
+                g_string_append_len(reply, "\\\"", 2);
+                break;
+
+            case '\\':
+                g_string_append_len(reply, "\\\\", 2);
+                break;
+
+            case '\n':
+                g_string_append_len(reply, "\\n", 2);
+                break;
+
+            case '\r':
+                g_string_append_len(reply, "\\r", 2);
+                break;
+
+            case '\t':
+                g_string_append_len(reply, "\\t", 2);
+                break;
+
+            default:
+                if (c < 0x20)
+                {
+                    LSReplyAppendPrintf(reply, "\\u%04x", c);
+                }
+                else
+                {
+                    g_string_append_c(reply, c);
+                }
+
+                break;
+        }
     }
 }
 
-void
-LSMessageReplySuccess(LSHandle *sh, LSMessage *message)
+/**
+ * @brief Reply with a payload from static storage, e.g. kLSReplySuccess.
+ */
+bool
+LSMessageReplyConst(LSHandle *sh, LSMessage *message, const char *payload)
 {
     LSError lserror;
     LSErrorInit(&lserror);
 
-    bool retVal = LSMessageReply(sh, message, "{\"returnValue\":true}",
-                                 NULL);
+    bool retVal = LSMessageReply(sh, message, payload, &lserror);
 
     if (!retVal)
     {
         LSErrorPrint(&lserror, stderr);
         LSErrorFree(&lserror);
     }
+
+    return retVal;
+}
+
+/**
+ * @brief Reply with the contents of a reply buffer.
+ */
+bool
+LSMessageReplyBuffer(LSHandle *sh, LSMessage *message, GString *reply)
+{
+    return LSMessageReplyConst(sh, message, reply->str);
 }
 
 void
-LSMessageReplyCustomError(LSHandle *sh, LSMessage *message, const char *errormsg)
+LSMessageReplyErrorUnknown(LSHandle *sh, LSMessage *message)
 {
-    LSError lserror;
-    LSErrorInit(&lserror);
-    char *errorString;
+    LSMessageReplyConst(sh, message, kLSReplyErrorUnknown);
+}
 
-    errorString = g_strdup_printf("{\"returnValue\":false,\"errorCode\":-1,\"errorText\":\"%s\"}", errormsg);
+void
+LSMessageReplyErrorInvalidParams(LSHandle *sh, LSMessage *message)
+{
+    LSMessageReplyConst(sh, message, kLSReplyErrorInvalidParams);
+}
 
-    bool retVal = LSMessageReply(sh, message, errorString, NULL);
-    if (!retVal)
-    {
-        LSErrorPrint(&lserror, stderr);
-        LSErrorFree(&lserror);
-    }
+void
+LSMessageReplyErrorBadJSON(LSHandle *sh, LSMessage *message)
+{
+    LSMessageReplyConst(sh, message, kLSReplyErrorBadJSON);
+}
 
-    g_free(errorString);
+void
+LSMessageReplySuccess(LSHandle *sh, LSMessage *message)
+{
+    LSMessageReplyConst(sh, message, kLSReplySuccess);
 }
 
+void
+LSMessageReplyCustomError(LSHandle *sh, LSMessage *message, const char *errormsg)
+{
+    GString *reply = LSReplyBuffer();
+
+    g_string_append(reply,
+                    "{\"returnValue\":false,\"errorCode\":-1,\"errorText\":\"");
+    LSReplyAppendEscaped(reply, errormsg);
+    g_string_append(reply, "\"}");
 
+    LSMessageReplyBuffer(sh, message, reply);
+}
@@ -24,11 +24,20 @@
  * GTimerSource
  * 1) Can be forced to expire.
  * 2) The expiration interval may be changed.
- * 3) Uses a montonic clock.
+ * 3) Uses a montonic clock, or CLOCK_BOOTTIME to count time spent in suspend.
+ *
+ * The expiration is programmed into a timerfd as an absolute time, and the main
+ * loop polls the fd, so an idle main loop iteration does not read the clock. If
+ * no timerfd can be created the source falls back to comparing the clock on
+ * every prepare and check.
  *
  */
 
 #include <glib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include "timersource.h"
 #include "clock.h"
@@ -37,121 +46,111 @@
 struct _GTimerSource
 {
     GSource  source;
-    GTimeVal expiration;   /* Should I just make this use Clock* API? */
+    ClockNs  expiration;      /* On the source's clock */
     guint    interval_ms;     /* In milisecs */
     guint    granularity;
+
+    clockid_t clock;
+    GPollFD   pollfd;         /* timerfd, fd < 0 when polling the clock instead */
 };
 
 static gboolean g_timer_source_prepare(GSource *source, gint *timeout_ms);
 static gboolean g_timer_source_check(GSource *source);
 static gboolean g_timer_source_dispatch(GSource *source, GSourceFunc callback,
                                         gpointer user_data);
+static void g_timer_source_finalize(GSource *source);
 
 GSourceFuncs g_timer_source_funcs =
 {
     .prepare  = g_timer_source_prepare,
     .check    = g_timer_source_check,
     .dispatch = g_timer_source_dispatch,
-    .finalize = NULL,
+    .finalize = g_timer_source_finalize,
 };
 
-#define USECS_PER_SEC 1000000
-#define USECS_PER_MSEC 1000
 static void
-g_timer_set_expiration(GTimerSource *rsource, GTimeVal *now)
+g_timer_set_expiration(GTimerSource *rsource, ClockNs now)
 {
-    guint interval_secs = rsource->interval_ms / 1000;
-    glong interval_usecs = (rsource->interval_ms - interval_secs * 1000) * 1000;
-
-    rsource->expiration.tv_sec = now->tv_sec + interval_secs;
-    rsource->expiration.tv_usec = now->tv_usec + interval_usecs;
-
-    if (rsource->expiration.tv_usec >= USECS_PER_SEC)
-    {
-        rsource->expiration.tv_usec -= USECS_PER_SEC;
-        rsource->expiration.tv_sec++;
-    }
+    rsource->expiration = now + ClockNsFromMs(rsource->interval_ms);
 
     if (rsource->granularity)
     {
-        gint gran;
-        gint remainder;
+        ClockNs gran = ClockNsFromMs(rsource->granularity);
+        ClockNs remainder = rsource->expiration % gran;
 
-        gran = rsource->granularity * USECS_PER_MSEC;
-        remainder = rsource->expiration.tv_usec % gran;
+        rsource->expiration -= remainder;
 
         if (remainder >= gran / 4)
         {
-            rsource->expiration.tv_usec += gran;
-        }
-
-        rsource->expiration.tv_usec -= remainder;
-
-        while (rsource->expiration.tv_usec > USECS_PER_SEC)
-        {
-            rsource->expiration.tv_usec -= USECS_PER_SEC;
-            rsource->expiration.tv_sec++;
+            rsource->expiration += gran;
         }
     }
 }
 
+/**
+ * @brief Program the expiration into the timerfd.
+ */
 static void
-g_timer_get_current_time(GTimerSource *tsource, GTimeVal *now)
+g_timer_source_arm(GTimerSource *tsource)
 {
-    g_return_if_fail(now != NULL);
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if (tsource->pollfd.fd < 0)
+    {
+        return;
+    }
+
+    ClockNsToTimespec(tsource->expiration, &its.it_value);
 
-    // TODO: We should do a time_is_current and skip syscalls
-    struct timespec tv;
-    ClockGetTime(&tv);
+    /* An all zero it_value would disarm the timer instead */
+    if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+    {
+        its.it_value.tv_nsec = 1;
+    }
 
-    now->tv_sec = tv.tv_sec;
-    now->tv_usec = tv.tv_nsec / 1000;
+    if (timerfd_settime(tsource->pollfd.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+    {
+        SLEEPDLOG_DEBUG("timerfd_settime failed: %s", g_strerror(errno));
+    }
 }
 
 static gboolean
 g_timer_source_prepare(GSource    *source,
                        gint       *timeout_ms)
 {
-    GTimeVal now;
-
     GTimerSource *tsource = (GTimerSource *)source;
 
-    g_timer_get_current_time(tsource, &now);
-
-    // assume monotic clock
-
-    glong msec = (tsource->expiration.tv_sec - now.tv_sec) * 1000;
-
-    if (msec < 0)
+    if (tsource->pollfd.fd >= 0)
     {
-        msec = 0;
+        *timeout_ms = -1;
+        return FALSE;
     }
-    else
-    {
-        msec += (tsource->expiration.tv_usec - now.tv_usec) / 1000;
 
-        if (msec < 0)
-        {
-            msec = 0;
-        }
+    ClockNs remaining = tsource->expiration - ClockNsGet(tsource->clock);
+
+    if (remaining <= 0)
+    {
+        *timeout_ms = 0;
+        return TRUE;
     }
 
-    *timeout_ms = (gint)msec;
+    /* Round up, so that the poll does not return just before the expiration */
+    *timeout_ms = (gint)MIN(ClockNsToMs(remaining + CLOCK_NS_PER_MS - 1), G_MAXINT);
 
-    return (msec == 0);
+    return FALSE;
 }
 
 static gboolean
 g_timer_source_check(GSource *source)
 {
-    GTimeVal now;
     GTimerSource *tsource = (GTimerSource *)source;
 
-    g_timer_get_current_time(tsource, &now);
+    if (tsource->pollfd.fd >= 0)
+    {
+        return (tsource->pollfd.revents & G_IO_IN) != 0;
+    }
 
-    return (tsource->expiration.tv_sec < now.tv_sec) ||
-           ((tsource->expiration.tv_sec == now.tv_sec) &&
-            (tsource->expiration.tv_usec <= now.tv_usec));
+    return tsource->expiration <= ClockNsGet(tsource->clock);
 }
 
 static gboolean
@@ -166,11 +165,21 @@ g_timer_source_dispatch(GSource *source,
         return FALSE;
     }
 
+    if (tsource->pollfd.fd >= 0)
+    {
+        uint64_t expirations;
+
+        /* Nothing to read if the timer was re-armed since the poll */
+        if (read(tsource->pollfd.fd, &expirations, sizeof(expirations)) < 0)
+        {
+            return TRUE;
+        }
+    }
+
     if (callback(user_data))
     {
-        GTimeVal now;
-        g_timer_get_current_time(tsource, &now);
-        g_timer_set_expiration(tsource, &now);
+        g_timer_set_expiration(tsource, ClockNsGet(tsource->clock));
+        g_timer_source_arm(tsource);
         return TRUE;
     }
     else
@@ -179,17 +188,33 @@ g_timer_source_dispatch(GSource *source,
     }
 }
 
+static void
+g_timer_source_finalize(GSource *source)
+{
+    GTimerSource *tsource = (GTimerSource *)source;
+
+    if (tsource->pollfd.fd >= 0)
+    {
+        close(tsource->pollfd.fd);
+        tsource->pollfd.fd = -1;
+    }
+}
+
 /** Public Functions */
 
 /**
-* @brief A create a timer with 100 ms resolution.
+* @brief Create a timer on the given clock.
 *
 * @param  interval_ms
+* @param  granularity_ms Round the expirations to a multiple of this, so that
+*         timers with the same granularity wake the system up together
+* @param  clock CLOCK_MONOTONIC, or CLOCK_BOOTTIME to count time spent in suspend
 *
 * @retval
 */
 GTimerSource *
-g_timer_source_new(guint interval_ms, guint granularity_ms)
+g_timer_source_new_clock(guint interval_ms, guint granularity_ms,
+                         clockid_t clock)
 {
     GSource *source;
     GTimerSource *tsource;
@@ -197,37 +222,47 @@ g_timer_source_new(guint interval_ms, guint granularity_ms)
     source = g_source_new(&g_timer_source_funcs, sizeof(GTimerSource));
     tsource = (GTimerSource *)source;
 
-    GTimeVal now;
-
     tsource->interval_ms = interval_ms;
     tsource->granularity = granularity_ms;
+    tsource->clock = clock;
 
-    g_timer_get_current_time(tsource, &now);
+    tsource->pollfd.fd = timerfd_create(clock, TFD_NONBLOCK | TFD_CLOEXEC);
 
-    g_timer_set_expiration(tsource, &now);
+    if (tsource->pollfd.fd >= 0)
+    {
+        tsource->pollfd.events = G_IO_IN;
+        g_source_add_poll(source, &tsource->pollfd);
+    }
+    else
+    {
+        SLEEPDLOG_DEBUG("timerfd_create failed, polling the clock: %s",
+                        g_strerror(errno));
+    }
+
+    g_timer_set_expiration(tsource, ClockNsGet(clock));
+    g_timer_source_arm(tsource);
 
     return tsource;
 }
 
+/**
+* @brief A create a timer with 100 ms resolution.
+*
+* @param  interval_ms
+*
+* @retval
+*/
 GTimerSource *
-g_timer_source_new_seconds(guint interval_sec)
+g_timer_source_new(guint interval_ms, guint granularity_ms)
 {
-    GSource *source;
-    GTimerSource *tsource;
-
-    source = g_source_new(&g_timer_source_funcs, sizeof(GTimerSource));
-    tsource = (GTimerSource *)source;
-
-    GTimeVal now;
-
-    tsource->interval_ms = 1000 * interval_sec;
-    tsource->granularity = 1000;
-
-    g_timer_get_current_time(tsource, &now);
-
-    g_timer_set_expiration(tsource, &now);
+    return g_timer_source_new_clock(interval_ms, granularity_ms,
+                                    CLOCK_MONOTONIC);
+}
 
-    return tsource;
+GTimerSource *
+g_timer_source_new_seconds(guint interval_sec)
+{
+    return g_timer_source_new_clock(1000 * interval_sec, 1000, CLOCK_MONOTONIC);
 }
 
 void
@@ -241,14 +276,12 @@ void
 g_timer_source_set_interval(GTimerSource *tsource, guint interval_ms,
                             gboolean from_poll)
 {
-    GTimeVal now;
-
-    g_timer_get_current_time(tsource, &now);
-
     tsource->interval_ms = interval_ms;
-    g_timer_set_expiration(tsource, &now);
+    g_timer_set_expiration(tsource, ClockNsGet(tsource->clock));
+    g_timer_source_arm(tsource);
 
-    if (!from_poll)
+    /* A poll on the timerfd picks up the new expiration by itself */
+    if (!from_poll && tsource->pollfd.fd < 0)
     {
         GMainContext *context =  g_source_get_context((GSource *)tsource);
 
@@ -0,0 +1,647 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file timerwheel.c
+ *
+ * @brief Hierarchical timer wheel multiplexing any number of timers over one
+ * GTimerSource per main context.
+ *
+ * Each level of the wheel has 64 slots, a slot of level n spans 64^n ms. A
+ * timer is hashed into the lowest level that reaches its expiration, by the
+ * absolute time of the expiration. Advancing the wheel drains the slots the
+ * clock has passed on every level, fires the timers that are due and hashes
+ * the others in again one level lower. Finding the next expiration looks at
+ * the first non-empty slot of each level only.
+ *
+ * A timer behaves like a GTimerSource: it fires every interval_ms while its
+ * callback returns TRUE, and is freed once the callback returns FALSE.
+ *
+ * Timers with a granularity of at least timer_coalesce_ms are aligned to
+ * shared slots on the monotonic clock, so that the timers of all wheels that
+ * fall into the same slot wake the CPU once.
+ *
+ */
+
+#include <glib.h>
+#include <pthread.h>
+
+#include "timerwheel.h"
+#include "timersource.h"
+#include "clock.h"
+#include "sleepd_config.h"
+#include "logging.h"
+
+#define LOG_DOMAIN "TIMERWHEEL: "
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 5
+
+/* Furthest a timer can be hashed ahead of the clock on a level, in slots */
+#define TIMER_WHEEL_REACH  (TIMER_WHEEL_SLOTS - 1)
+
+/* Interval of the underlying source while the wheel is empty */
+#define TIMER_WHEEL_IDLE_MS G_MAXINT
+
+typedef struct _TimerWheel TimerWheel;
+
+struct _TimerWheelTimer
+{
+    TimerWheel      *wheel;
+    TimerWheelTimer *next;
+    TimerWheelTimer *prev;
+
+    gint64           expires;          /* ms, monotonic */
+    guint            interval_ms;
+    guint            granularity_ms;
+    GSourceFunc      func;
+    gpointer         data;
+
+    int              level;            /* < 0 while not hashed */
+    int              slot;
+    bool             firing;
+    bool             removed;
+};
+
+struct _TimerWheel
+{
+    GMainContext    *context;
+    GTimerSource    *source;
+    pthread_mutex_t  lock;
+
+    gint64           now;              /* ms the wheel has been advanced to */
+    bool             dispatching;
+
+    guint64          num_wakeups;
+    guint64          num_fired;
+
+    guint64          occupied[TIMER_WHEEL_LEVELS];
+    TimerWheelTimer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+static pthread_mutex_t sWheelsLock = PTHREAD_MUTEX_INITIALIZER;
+static GSList *sWheels = NULL;
+static gint64 sWheelsCreatedAt = 0;
+
+static gint64
+TimerWheelNow(void)
+{
+    return ClockNsToMs(ClockNsNow());
+}
+
+static inline int
+TimerWheelShift(int level)
+{
+    return level * TIMER_WHEEL_BITS;
+}
+
+static void
+TimerWheelLink(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+    gint64 delta = timer->expires - wheel->now;
+    gint64 pos = timer->expires;
+    int level;
+
+    if (delta < 0)
+    {
+        delta = 0;
+        pos = wheel->now;
+    }
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < ((gint64)TIMER_WHEEL_REACH << TimerWheelShift(level)))
+        {
+            break;
+        }
+    }
+
+    /* Beyond the top level, park it in the furthest slot and rehash it later */
+    gint64 reach = (gint64)TIMER_WHEEL_REACH << TimerWheelShift(level);
+
+    if (delta >= reach)
+    {
+        pos = wheel->now + reach;
+    }
+
+    int slot = (pos >> TimerWheelShift(level)) & TIMER_WHEEL_MASK;
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = wheel->slots[level][slot];
+
+    if (timer->next)
+    {
+        timer->next->prev = timer;
+    }
+
+    wheel->slots[level][slot] = timer;
+    wheel->occupied[level] |= (guint64)1 << slot;
+}
+
+static void
+TimerWheelUnlink(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+    if (timer->level < 0)
+    {
+        return;
+    }
+
+    if (timer->prev)
+    {
+        timer->prev->next = timer->next;
+    }
+    else
+    {
+        wheel->slots[timer->level][timer->slot] = timer->next;
+    }
+
+    if (timer->next)
+    {
+        timer->next->prev = timer->prev;
+    }
+
+    if (!wheel->slots[timer->level][timer->slot])
+    {
+        wheel->occupied[timer->level] &= ~((guint64)1 << timer->slot);
+    }
+
+    timer->level = -1;
+    timer->next = timer->prev = NULL;
+}
+
+/**
+ * @brief Align an expiration to the timer's granularity.
+ *
+ * A granularity of at least timer_coalesce_ms is a tolerance: the expiration is
+ * delayed to the next boundary of the largest power of two multiple of
+ * timer_coalesce_ms within it. The slots of all timers share their boundaries,
+ * the coarser a slot the fewer. A finer granularity rounds like GTimerSource
+ * does.
+ */
+static gint64
+TimerWheelAlign(gint64 expires, guint granularity_ms)
+{
+    gint64 gran = granularity_ms;
+    gint64 slot = gSleepConfig.timer_coalesce_ms;
+    gint64 remainder;
+
+    if (!gran)
+    {
+        return expires;
+    }
+
+    if (slot > 0 && gran >= slot)
+    {
+        while (slot * 2 <= gran)
+        {
+            slot *= 2;
+        }
+
+        remainder = expires % slot;
+
+        return remainder ? expires - remainder + slot : expires;
+    }
+
+    remainder = expires % gran;
+    expires -= remainder;
+
+    if (remainder >= gran / 4)
+    {
+        expires += gran;
+    }
+
+    return expires;
+}
+
+/**
+ * @brief Set the next expiration of a timer.
+ */
+static void
+TimerWheelSetExpiration(TimerWheelTimer *timer, gint64 now)
+{
+    timer->expires = TimerWheelAlign(now + timer->interval_ms,
+                                     timer->granularity_ms);
+}
+
+/**
+ * @brief Mask of the slots of a level the clock passes going from..to.
+ */
+static guint64
+TimerWheelPassedSlots(int level, gint64 from, gint64 to)
+{
+    gint64 first = from >> TimerWheelShift(level);
+    gint64 last = to >> TimerWheelShift(level);
+
+    if (last - first >= TIMER_WHEEL_MASK)
+    {
+        return G_MAXUINT64;
+    }
+
+    int a = first & TIMER_WHEEL_MASK;
+    int b = last & TIMER_WHEEL_MASK;
+
+    if (a <= b)
+    {
+        return (G_MAXUINT64 >> (TIMER_WHEEL_MASK - (b - a))) << a;
+    }
+
+    return (G_MAXUINT64 << a) | (G_MAXUINT64 >> (TIMER_WHEEL_MASK - b));
+}
+
+/**
+ * @brief Advance the wheel to now, and return the timers that are due sorted by
+ * expiration.
+ */
+static TimerWheelTimer *
+TimerWheelAdvance(TimerWheel *wheel, gint64 now)
+{
+    TimerWheelTimer *pending = NULL;
+    TimerWheelTimer *expired = NULL;
+    int level;
+
+    if (now < wheel->now)
+    {
+        now = wheel->now;
+    }
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        guint64 drain = wheel->occupied[level] &
+                        TimerWheelPassedSlots(level, wheel->now, now);
+
+        while (drain)
+        {
+            int slot = __builtin_ctzll(drain);
+            TimerWheelTimer *timer = wheel->slots[level][slot];
+
+            drain &= drain - 1;
+
+            while (timer)
+            {
+                TimerWheelTimer *next = timer->next;
+
+                timer->level = -1;
+                timer->next = pending;
+                pending = timer;
+                timer = next;
+            }
+
+            wheel->slots[level][slot] = NULL;
+            wheel->occupied[level] &= ~((guint64)1 << slot);
+        }
+    }
+
+    wheel->now = now;
+
+    while (pending)
+    {
+        TimerWheelTimer *timer = pending;
+        pending = timer->next;
+
+        if (timer->expires > now)
+        {
+            TimerWheelLink(wheel, timer);
+            continue;
+        }
+
+        TimerWheelTimer **pos = &expired;
+
+        while (*pos && (*pos)->expires <= timer->expires)
+        {
+            pos = &(*pos)->next;
+        }
+
+        timer->next = *pos;
+        *pos = timer;
+    }
+
+    return expired;
+}
+
+/**
+ * @brief Earliest expiration of the timers in the wheel, G_MAXINT64 if empty.
+ */
+static gint64
+TimerWheelNextExpiration(TimerWheel *wheel)
+{
+    gint64 next = G_MAXINT64;
+    int level;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        guint64 occupied = wheel->occupied[level];
+
+        if (!occupied)
+        {
+            continue;
+        }
+
+        /* The first slot at or after the clock holds the level's earliest timers */
+        int start = (wheel->now >> TimerWheelShift(level)) & TIMER_WHEEL_MASK;
+        guint64 rotated = start ? (occupied >> start) |
+                          (occupied << (TIMER_WHEEL_SLOTS - start)) : occupied;
+        int slot = (start + __builtin_ctzll(rotated)) & TIMER_WHEEL_MASK;
+        TimerWheelTimer *timer;
+
+        for (timer = wheel->slots[level][slot]; timer; timer = timer->next)
+        {
+            next = MIN(next, timer->expires);
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Point the underlying source at the next expiration. Called with the
+ * wheel locked.
+ */
+static void
+TimerWheelReschedule(TimerWheel *wheel, gint64 now, bool from_poll)
+{
+    gint64 next = TimerWheelNextExpiration(wheel);
+    gint64 interval_ms;
+
+    if (wheel->dispatching)
+    {
+        return;
+    }
+
+    if (next == G_MAXINT64)
+    {
+        interval_ms = TIMER_WHEEL_IDLE_MS;
+    }
+    else
+    {
+        interval_ms = CLAMP(next - now, 0, TIMER_WHEEL_IDLE_MS);
+    }
+
+    g_timer_source_set_interval(wheel->source, (guint)interval_ms, from_poll);
+}
+
+static gboolean
+TimerWheelDispatch(gpointer data)
+{
+    TimerWheel *wheel = data;
+    TimerWheelTimer *expired;
+    TimerWheelTimer *timer;
+
+    pthread_mutex_lock(&wheel->lock);
+    expired = TimerWheelAdvance(wheel, TimerWheelNow());
+    wheel->dispatching = true;
+    wheel->num_wakeups++;
+
+    /* Due timers are out of the wheel until they have fired, see
+     * TimerWheelSetInterval() and TimerWheelRemove() */
+    for (timer = expired; timer; timer = timer->next)
+    {
+        timer->firing = true;
+    }
+
+    while (expired)
+    {
+        timer = expired;
+        expired = timer->next;
+        timer->next = NULL;
+
+        if (timer->removed)
+        {
+            g_free(timer);
+            continue;
+        }
+
+        pthread_mutex_unlock(&wheel->lock);
+        gboolean again = timer->func(timer->data);
+        pthread_mutex_lock(&wheel->lock);
+
+        timer->firing = false;
+        wheel->num_fired++;
+
+        if (again && !timer->removed)
+        {
+            TimerWheelSetExpiration(timer, TimerWheelNow());
+            TimerWheelLink(wheel, timer);
+        }
+        else
+        {
+            g_free(timer);
+        }
+    }
+
+    wheel->dispatching = false;
+    TimerWheelReschedule(wheel, TimerWheelNow(), true);
+    pthread_mutex_unlock(&wheel->lock);
+
+    return TRUE;
+}
+
+static TimerWheel *
+TimerWheelGet(GMainContext *context)
+{
+    TimerWheel *wheel = NULL;
+    GSList *iter;
+
+    pthread_mutex_lock(&sWheelsLock);
+
+    if (!sWheels)
+    {
+        sWheelsCreatedAt = TimerWheelNow();
+    }
+
+    for (iter = sWheels; iter; iter = iter->next)
+    {
+        if (((TimerWheel *)iter->data)->context == context)
+        {
+            wheel = iter->data;
+            break;
+        }
+    }
+
+    if (!wheel)
+    {
+        wheel = g_new0(TimerWheel, 1);
+        wheel->context = context;
+        wheel->now = TimerWheelNow();
+        pthread_mutex_init(&wheel->lock, NULL);
+
+        wheel->source = g_timer_source_new(TIMER_WHEEL_IDLE_MS, 0);
+        g_source_set_callback((GSource *)wheel->source, TimerWheelDispatch,
+                              wheel, NULL);
+        g_source_attach((GSource *)wheel->source, context);
+
+        sWheels = g_slist_prepend(sWheels, wheel);
+    }
+
+    pthread_mutex_unlock(&sWheelsLock);
+
+    return wheel;
+}
+
+/** Public Functions */
+
+/**
+ * @brief Add a timer firing every interval_ms on the given main context.
+ *
+ * @param context Main context to run func on
+ * @param interval_ms
+ * @param granularity_ms How late the timer may fire to share a wakeup with
+ *                       others, 0 to fire on time
+ * @param func Keeps the timer while it returns TRUE
+ * @param data
+ */
+TimerWheelTimer *
+TimerWheelAdd(GMainContext *context, guint interval_ms, guint granularity_ms,
+              GSourceFunc func, gpointer data)
+{
+    TimerWheel *wheel = TimerWheelGet(context);
+    TimerWheelTimer *timer = g_new0(TimerWheelTimer, 1);
+    gint64 now = TimerWheelNow();
+
+    timer->wheel = wheel;
+    timer->interval_ms = interval_ms;
+    timer->granularity_ms = granularity_ms;
+    timer->func = func;
+    timer->data = data;
+    timer->level = -1;
+
+    pthread_mutex_lock(&wheel->lock);
+    TimerWheelSetExpiration(timer, now);
+    TimerWheelLink(wheel, timer);
+    TimerWheelReschedule(wheel, now, false);
+    pthread_mutex_unlock(&wheel->lock);
+
+    return timer;
+}
+
+/**
+ * @brief Add a timer firing every interval_sec, with a granularity of a second.
+ */
+TimerWheelTimer *
+TimerWheelAddSeconds(GMainContext *context, guint interval_sec,
+                     GSourceFunc func, gpointer data)
+{
+    return TimerWheelAdd(context, interval_sec * 1000, 1000, func, data);
+}
+
+/**
+ * @brief Restart the timer to fire interval_ms from now.
+ *
+ * @param timer
+ * @param interval_ms
+ * @param from_poll true when called on the timer's main context, false to wake it up
+ */
+void
+TimerWheelSetInterval(TimerWheelTimer *timer, guint interval_ms, bool from_poll)
+{
+    TimerWheel *wheel = timer->wheel;
+    gint64 now = TimerWheelNow();
+
+    pthread_mutex_lock(&wheel->lock);
+
+    timer->interval_ms = interval_ms;
+
+    /* A timer that is due fires first, and is rehashed when its callback returns */
+    if (!timer->firing)
+    {
+        TimerWheelUnlink(wheel, timer);
+        TimerWheelSetExpiration(timer, now);
+        TimerWheelLink(wheel, timer);
+        TimerWheelReschedule(wheel, now, from_poll);
+    }
+
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+void
+TimerWheelSetIntervalSeconds(TimerWheelTimer *timer, guint interval_sec,
+                             bool from_poll)
+{
+    TimerWheelSetInterval(timer, interval_sec * 1000, from_poll);
+}
+
+guint
+TimerWheelGetInterval(TimerWheelTimer *timer)
+{
+    return timer->interval_ms;
+}
+
+/**
+ * @brief Stop and free the timer. It may be called from any timer's callback.
+ */
+void
+TimerWheelRemove(TimerWheelTimer *timer)
+{
+    TimerWheel *wheel = timer->wheel;
+
+    pthread_mutex_lock(&wheel->lock);
+
+    if (timer->firing)
+    {
+        timer->removed = true;
+    }
+    else
+    {
+        TimerWheelUnlink(wheel, timer);
+        g_free(timer);
+        TimerWheelReschedule(wheel, TimerWheelNow(), true);
+    }
+
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * @brief Wakeups of the wheels' sources and timers fired as a JSON string.
+ *
+ * Without coalescing every timer fired would have been a wakeup of its own, so
+ * firedPerHour against wakeupsPerHour is what coalescing saves.
+ */
+gchar *
+TimerWheelGetStats(void)
+{
+    guint64 wakeups = 0, fired = 0;
+    gint64 elapsed_ms;
+    GSList *iter;
+    gchar *ret;
+
+    pthread_mutex_lock(&sWheelsLock);
+
+    for (iter = sWheels; iter; iter = iter->next)
+    {
+        TimerWheel *wheel = iter->data;
+
+        pthread_mutex_lock(&wheel->lock);
+        wakeups += wheel->num_wakeups;
+        fired += wheel->num_fired;
+        pthread_mutex_unlock(&wheel->lock);
+    }
+
+    elapsed_ms = MAX(TimerWheelNow() - sWheelsCreatedAt, 1);
+
+    ret = g_strdup_printf("{\"returnValue\":true,\"coalesceMs\":%d,\"elapsedMs\":%"
+                          G_GINT64_FORMAT ",\"wakeups\":%" G_GUINT64_FORMAT
+                          ",\"fired\":%" G_GUINT64_FORMAT ",\"wakeupsPerHour\":%"
+                          G_GUINT64_FORMAT ",\"firedPerHour\":%" G_GUINT64_FORMAT "}",
+                          gSleepConfig.timer_coalesce_ms, elapsed_ms, wakeups, fired,
+                          wakeups * 3600000 / elapsed_ms, fired * 3600000 / elapsed_ms);
+
+    pthread_mutex_unlock(&sWheelsLock);
+
+    return ret;
+}
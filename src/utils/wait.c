@@ -25,7 +25,11 @@
 #include <sys/time.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <glib.h>
 
 #include "wait.h"
@@ -93,7 +97,7 @@ WaitObjectWait(WaitObj *obj, int ms)
     else
     {
         time.tv_sec = ms / 1000;
-        time.tv_nsec = (ms % 1000) * 1000000000;
+        time.tv_nsec = (ms % 1000) * 1000000;
     }
 
     return WaitObjectWaitTimeSpec(obj, &time);
@@ -104,6 +108,7 @@ WaitObjectWaitTimeSpec(WaitObj *obj, struct timespec *delta)
 {
     int ret = 1;
     struct timespec time;
+    ClockNs abstime;
 
     // wait object must be locked before use.
     g_assert(WaitObjectIsLocked(obj));
@@ -136,7 +141,8 @@ WaitObjectWaitTimeSpec(WaitObj *obj, struct timespec *delta)
     }
 
     // time += delta
-    ClockAccum(&time, delta);
+    abstime = ClockNsFromTimespec(&time) + ClockNsFromTimespec(delta);
+    ClockNsToTimespec(abstime, &time);
 
     return WaitObjectWaitAbsTime(obj, &time);
 }
@@ -223,3 +229,170 @@ WaitObjectIsLocked(WaitObj *obj)
         return false;
     }
 }
+
+/**
+ * @brief Create an event that any thread can signal, and that can be waited
+ * on with WaitEventWait() or polled from a main context, see
+ * WaitEventSourceNew().
+ *
+ * Signals are latched until the event is waited on or cleared, so unlike a
+ * WaitObj nothing needs to be locked around sending what is waited for.
+ *
+ * @retval false if the eventfd could not be created
+ */
+bool
+WaitEventInit(WaitEvent *event)
+{
+    assert(event != NULL);
+
+    event->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (event->fd < 0)
+    {
+        TRACE("%s: eventfd failed: %s\n", __FUNCTION__, g_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void
+WaitEventDestroy(WaitEvent *event)
+{
+    if (event->fd >= 0)
+    {
+        close(event->fd);
+        event->fd = -1;
+    }
+}
+
+void
+WaitEventSignal(WaitEvent *event)
+{
+    uint64_t one = 1;
+
+    if (write(event->fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        TRACE("%s: write failed: %s\n", __FUNCTION__, g_strerror(errno));
+    }
+}
+
+/**
+ * @brief Reset the event.
+ *
+ * @retval true if it was signalled
+ */
+bool
+WaitEventClear(WaitEvent *event)
+{
+    uint64_t count;
+
+    return read(event->fd, &count, sizeof(count)) == sizeof(count);
+}
+
+/**
+ * Wait up to ms milliseconds for the event to be signalled, and reset it.
+ *
+ * @param ms < 0 to wait forever
+ *
+ * @returns 0 if signalled
+ * @returns 1 if timed-out
+ * @returns -1 on error
+ */
+int
+WaitEventWait(WaitEvent *event, int ms)
+{
+    struct pollfd pfd = { .fd = event->fd, .events = POLLIN };
+    ClockNs deadline = ClockNsNow() + ClockNsFromMs(ms);
+    int timeout_ms = ms;
+
+    while (!WaitEventClear(event))
+    {
+        int ret = poll(&pfd, 1, timeout_ms);
+
+        if (ret < 0 && errno != EINTR)
+        {
+            TRACE("%s: poll failed: %s\n", __FUNCTION__, g_strerror(errno));
+            return -1;
+        }
+
+        if (ret == 0)
+        {
+            return 1;
+        }
+
+        if (ms >= 0)
+        {
+            ClockNs remaining = deadline - ClockNsNow();
+
+            /* Round up, poll() would otherwise return before the deadline */
+            timeout_ms = remaining > 0 ?
+                         ClockNsToMs(remaining + CLOCK_NS_PER_MS - 1) : 0;
+        }
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    GSource    source;
+    WaitEvent *event;
+    GPollFD    pollfd;
+} WaitEventSource;
+
+static gboolean
+wait_event_source_prepare(GSource *source, gint *timeout_ms)
+{
+    *timeout_ms = -1;
+    return FALSE;
+}
+
+static gboolean
+wait_event_source_check(GSource *source)
+{
+    WaitEventSource *esource = (WaitEventSource *)source;
+
+    return (esource->pollfd.revents & G_IO_IN) != 0;
+}
+
+static gboolean
+wait_event_source_dispatch(GSource *source, GSourceFunc callback,
+                           gpointer user_data)
+{
+    WaitEventSource *esource = (WaitEventSource *)source;
+
+    /* Another waiter got to it first */
+    if (!WaitEventClear(esource->event))
+    {
+        return TRUE;
+    }
+
+    return callback ? callback(user_data) : FALSE;
+}
+
+static GSourceFuncs wait_event_source_funcs =
+{
+    .prepare  = wait_event_source_prepare,
+    .check    = wait_event_source_check,
+    .dispatch = wait_event_source_dispatch,
+};
+
+/**
+ * @brief Source dispatched, and resetting the event, whenever the event is
+ * signalled. The event must outlive the source.
+ */
+GSource *
+WaitEventSourceNew(WaitEvent *event)
+{
+    GSource *source = g_source_new(&wait_event_source_funcs,
+                                   sizeof(WaitEventSource));
+    WaitEventSource *esource = (WaitEventSource *)source;
+
+    esource->event = event;
+    esource->pollfd.fd = event->fd;
+    esource->pollfd.events = G_IO_IN;
+    g_source_add_poll(source, &esource->pollfd);
+
+    return source;
+}
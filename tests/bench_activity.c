@@ -0,0 +1,188 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file bench_activity.c
+ *
+ * @brief Cost of scanning the activity roster, with the ClockNs end times of
+ * activity.c and with the struct timespec end times compared through
+ * ClockTimeIsGreater() it had before.
+ *
+ * PwrEventActivityCount() walks the whole roster of activity.c. The timespec
+ * roster is walked the same way, with the comparison clock.c makes. Run by
+ * hand: the ClockNs scan should be the cheaper one at every roster size.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "activity.h"
+#include "suspend.h"
+#include "init.h"
+#include "sysfs.h"
+
+/* Scans of the roster per measure */
+#define BENCH_SCANS         20000
+
+/* Activities last longer than the measure, none expires */
+#define BENCH_DURATION_MS   (10 * 60 * 1000)
+
+/* Fake daemon */
+
+static InitFunc sActivityInit = NULL;
+
+void
+NamedInitFuncAdd(const char *initListName, InitFuncPriority priority,
+                 InitFunc func, const char *func_name)
+{
+    sActivityInit = func;
+}
+
+bool MachineSupportsWakelocks(void) { return false; }
+int SysfsWriteString(const char *path, const char *string) { return 0; }
+void TriggerResume(const char *cause, PowerEvent power_event) { }
+void SuspendBackoffReset(const char *reason) { }
+void ScheduleIdleCheck(int interval_ms, bool fromPoll) { }
+bool LSErrorInit(LSError *lserror) { return true; }
+
+/* The roster before ClockNs */
+
+typedef struct
+{
+    struct timespec start_time;
+    struct timespec end_time;
+    int duration_ms;
+
+    char *activity_id;
+} TimespecActivity;
+
+/**
+ * @brief ClockTimeIsGreater() of clock.c, kept out of line as it was.
+ */
+static bool __attribute__((noinline))
+timespec_is_greater(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec > b->tv_sec ||
+            (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec));
+}
+
+static int
+timespec_count(GQueue *roster, struct timespec *from)
+{
+    int count = 0;
+    GList *iter;
+
+    for (iter = roster->head; iter != NULL; iter = iter->next)
+    {
+        TimespecActivity *a = (TimespecActivity *)iter->data;
+
+        if (timespec_is_greater(from, &a->end_time))
+        {
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+static double
+now_ns(void)
+{
+    return (double)ClockNsNow();
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int sizes[] = { 8, 64, 512, 4096 };
+    int total = 0;
+    unsigned int s;
+    int i;
+
+    if (sActivityInit)
+    {
+        sActivityInit();
+    }
+
+    printf("%8s %12s %12s\n", "roster", "clockns_ns", "timespec_ns");
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        GQueue *roster = g_queue_new();
+        ClockNs now;
+        struct timespec from;
+        double start, clockns_ns, timespec_ns;
+
+        /* Grow the activity.c roster to the size */
+        for (i = total; i < sizes[s]; i++)
+        {
+            gchar *id = g_strdup_printf("com.webos.service.bench-%d", i);
+
+            PwrEventActivityStart(id, BENCH_DURATION_MS + i);
+            g_free(id);
+        }
+
+        total = sizes[s];
+
+        for (i = 0; i < sizes[s]; i++)
+        {
+            TimespecActivity *a = g_new0(TimespecActivity, 1);
+
+            ClockNsToTimespec(ClockNsNow(), &a->start_time);
+            ClockNsToTimespec(ClockNsNow() + ClockNsFromMs(BENCH_DURATION_MS + i),
+                              &a->end_time);
+            a->duration_ms = BENCH_DURATION_MS + i;
+            g_queue_push_tail(roster, a);
+        }
+
+        now = ClockNsNow();
+        ClockNsToTimespec(now, &from);
+
+        if (PwrEventActivityCount(now) != sizes[s] ||
+                timespec_count(roster, &from) != sizes[s])
+        {
+            fprintf(stderr, "%d activities: wrong count\n", sizes[s]);
+            return 1;
+        }
+
+        start = now_ns();
+
+        for (i = 0; i < BENCH_SCANS; i++)
+        {
+            PwrEventActivityCount(now);
+        }
+
+        clockns_ns = (now_ns() - start) / BENCH_SCANS;
+
+        start = now_ns();
+
+        for (i = 0; i < BENCH_SCANS; i++)
+        {
+            timespec_count(roster, &from);
+        }
+
+        timespec_ns = (now_ns() - start) / BENCH_SCANS;
+
+        printf("%8d %12.0f %12.0f\n", sizes[s], clockns_ns, timespec_ns);
+
+        g_queue_free_full(roster, g_free);
+    }
+
+    return 0;
+}
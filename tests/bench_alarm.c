@@ -0,0 +1,242 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file bench_alarm.c
+ *
+ * @brief Cost of the legacy alarm interface of alarm.c with many alarms set.
+ *
+ * The alarms are read back from a fake timeout table on alarm_init(), as on a
+ * restart of the daemon, then alarmQuery, alarmAdd, alarmRemove and expiries
+ * are timed against them. Run by hand with the number of alarms, 50000 by
+ * default: apart from the load, each call should cost about the same with 500
+ * alarms as with 50000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "reference_time.h"
+#include "timeout_alarm.h"
+#include "sleepd_config.h"
+
+/* Calls of each method per measure */
+#define BENCH_CALLS         1000
+
+/* Alarms per service, each with a key of its own */
+#define BENCH_SERVICES      100
+
+SleepConfiguration gSleepConfig =
+{
+    .preference_dir = "/nonexistent",
+};
+
+extern LSMethod time_methods[];
+
+bool alarm_queue_new(const char *key, bool calendar, time_t expiry,
+                     const char *serviceName, const char *applicationName,
+                     bool subscribe, LSMessage *message, int *ret_id);
+
+int alarm_init(void);
+
+/* Fake Luna layer */
+
+struct LSMessage
+{
+    const char *payload;
+};
+
+bool LSErrorInit(LSError *lserror) { memset(lserror, 0, sizeof(*lserror)); return true; }
+void LSErrorFree(LSError *lserror) { }
+void LSErrorPrint(LSError *lserror, FILE *out) { }
+bool LSErrorIsSet(LSError *lserror) { return false; }
+const char *LSMessageGetPayload(LSMessage *message) { return message->payload; }
+const char *LSMessageGetApplicationID(LSMessage *message) { return NULL; }
+void LSMessageRef(LSMessage *message) { }
+void LSMessageUnref(LSMessage *message) { }
+bool LSMessageReply(LSHandle *sh, LSMessage *message, const char *payload, LSError *lserror) { return true; }
+bool LSSubscriptionAdd(LSHandle *sh, const char *key, LSMessage *message, LSError *lserror) { return true; }
+bool LSCall(LSHandle *sh, const char *uri, const char *payload, LSFilterFunc callback, void *ctx, LSMessageToken *ret_token, LSError *lserror) { return true; }
+bool LSRegisterCategory(LSHandle *sh, const char *category, LSMethod *methods, LSSignal *signals, LSProperty *properties, LSError *lserror) { return true; }
+
+/* Fake daemon */
+
+LSHandle *GetLunaServiceHandle(void) { return NULL; }
+nyx_device_handle_t GetNyxSystemDevice(void) { return NULL; }
+nyx_error_t nyx_system_query_rtc_time(nyx_device_handle_t handle, time_t *time) { return 0; }
+time_t reference_time(void) { return time(NULL); }
+
+/* Fake timeout table, alarm.c only keeps an index of it */
+
+static int sNumRows = 0;
+
+void
+_timeout_create(_AlarmTimeout *timeout, const char *app_id, const char *key,
+                const char *uri, const char *params, bool public_bus,
+                bool wakeup, const char *activity_id, int activity_duration_ms,
+                bool calendar, time_t expiry)
+{
+    memset(timeout, 0, sizeof(*timeout));
+    timeout->params = params;
+    timeout->calendar = calendar;
+    timeout->expiry = expiry;
+}
+
+bool _timeout_set(_AlarmTimeout *timeout) { return true; }
+bool _timeout_clear(const char *app_id, const char *key, bool public_bus) { return true; }
+
+bool
+_timeout_foreach(const char *app_id, bool public_bus, _TimeoutFunc func,
+                 void *data)
+{
+    _AlarmTimeout timeout;
+    char params[256];
+    int i;
+
+    memset(&timeout, 0, sizeof(timeout));
+    timeout.params = params;
+
+    for (i = 0; i < sNumRows; i++)
+    {
+        snprintf(params, sizeof(params), "{\"alarmId\":%d,\"key\":\"key-%d\","
+                 "\"serviceName\":\"com.webos.service.bench%d\","
+                 "\"applicationName\":\"com.webos.app.bench\"}",
+                 i, i, i % BENCH_SERVICES);
+        timeout.expiry = time(NULL) + 3600 + i;
+        func(&timeout, data);
+    }
+
+    return true;
+}
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static LSMethodFunction
+time_method(const char *name)
+{
+    LSMethod *method;
+
+    for (method = time_methods; method->name; method++)
+    {
+        if (!strcmp(method->name, name))
+        {
+            return method->function;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Call a method of time_methods once per alarm picked, with the
+ * payload made by format from the alarm's number.
+ */
+static double
+bench_method(const char *name, const char *format, int first, int step)
+{
+    LSMethodFunction function = time_method(name);
+    LSMessage message;
+    char payload[256];
+    double start, elapsed = 0;
+    int i, n;
+
+    message.payload = payload;
+
+    for (n = 0, i = first; n < BENCH_CALLS; n++, i += step)
+    {
+        snprintf(payload, sizeof(payload), format, i, i % BENCH_SERVICES);
+
+        start = now_us();
+        function(NULL, &message, NULL);
+        elapsed += now_us() - start;
+    }
+
+    return elapsed / BENCH_CALLS;
+}
+
+int
+main(int argc, char **argv)
+{
+    int step;
+    double start;
+    char params[64];
+    int i;
+
+    sNumRows = argc > 1 ? atoi(argv[1]) : 50000;
+
+    if (sNumRows < 2 * BENCH_CALLS)
+    {
+        fprintf(stderr, "at least %d alarms\n", 2 * BENCH_CALLS);
+        return 1;
+    }
+
+    step = sNumRows / (2 * BENCH_CALLS);
+
+    printf("%d alarms\n", sNumRows);
+
+    start = now_us();
+
+    if (alarm_init() < 0)
+    {
+        fprintf(stderr, "alarm_init failed\n");
+        return 1;
+    }
+
+    printf("%-12s %10.0f us\n", "load", now_us() - start);
+
+    printf("%-12s %10.2f us\n", "alarmQuery",
+           bench_method("alarmQuery", "{\"key\":\"key-%d\","
+                        "\"serviceName\":\"com.webos.service.bench%d\"}", 0, step));
+
+    printf("%-12s %10.2f us\n", "alarmAdd",
+           bench_method("alarmAdd", "{\"key\":\"added-%d\","
+                        "\"serviceName\":\"com.webos.service.bench%d\","
+                        "\"relative_time\":\"01:00:00\"}", 0, 1));
+
+    /* Even alarms are removed, odd ones expire */
+    printf("%-12s %10.2f us\n", "alarmRemove",
+           bench_method("alarmRemove", "{\"alarmId\":%d}", 0, 2 * step));
+
+    start = now_us();
+
+    for (i = 0; i < BENCH_CALLS; i++)
+    {
+        snprintf(params, sizeof(params), "{\"alarmId\":%d}", 1 + 2 * step * i);
+
+        if (!alarm_timeout_fired(params))
+        {
+            fprintf(stderr, "alarm %d not found\n", 1 + 2 * step * i);
+            return 1;
+        }
+    }
+
+    printf("%-12s %10.2f us\n", "expiry", (now_us() - start) / BENCH_CALLS);
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file bench_expiry.c
+ *
+ * @brief Cost of expiring the due timeouts of the timeout table, against the
+ * number of timeouts queued.
+ *
+ * The table is the one of timeout_alarm.c, opened with the same pragmas. The
+ * due rows are found as _expire_timeouts() finds them and deleted as
+ * _delete_delivered() deletes them, in one transaction. The deletes with one
+ * autocommit statement per row and a scan of the whole table are timed next
+ * to them. Run by hand: the expiry should cost about the same for every
+ * queue size, and grow with the number of rows due.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sqlite3.h>
+
+/* Runs of each measure, the mean is printed */
+#define BENCH_RUNS          5
+
+/* Expiry of the due rows, the others are due later */
+#define BENCH_NOW           1000
+
+static const char *kCreateSchema = "\
+CREATE TABLE AlarmTimeout (t1key INTEGER PRIMARY KEY AUTOINCREMENT,\
+                           app_id TEXT,\
+                           key TEXT,\
+                           uri TEXT,\
+                           params TEXT,\
+                           public_bus INTEGER,\
+                           wakeup   INTEGER,\
+                           calendar INTEGER,\
+                           expiry DATE,\
+                           activity_id TEXT,\
+                           activity_duration_ms INTEGER);";
+
+static const char *kCreateIndex = "\
+CREATE INDEX expiry_index on AlarmTimeout (expiry);";
+
+static char sPath[] = "/tmp/bench_expiry-XXXXXX";
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+exec_or_die(sqlite3 *db, const char *sql)
+{
+    char *errmsg = NULL;
+
+    if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", sql, errmsg);
+        exit(1);
+    }
+}
+
+/**
+ * @brief Open a new timeout table of queued rows, due of them already due.
+ */
+static sqlite3 *
+open_table(int queued, int due)
+{
+    sqlite3 *db = NULL;
+    sqlite3_stmt *st = NULL;
+    char key[32];
+    int i;
+
+    unlink(sPath);
+
+    if (sqlite3_open(sPath, &db) != SQLITE_OK)
+    {
+        fprintf(stderr, "cannot open %s\n", sPath);
+        exit(1);
+    }
+
+    exec_or_die(db, "PRAGMA temp_store = MEMORY;");
+    exec_or_die(db, "PRAGMA synchronous = 0");
+    exec_or_die(db, kCreateSchema);
+    exec_or_die(db, kCreateIndex);
+
+    exec_or_die(db, "BEGIN TRANSACTION;");
+
+    sqlite3_prepare_v2(db, "INSERT INTO AlarmTimeout "
+                       "(app_id,key,uri,params,public_bus,wakeup,calendar,expiry,"
+                       "activity_id,activity_duration_ms) VALUES "
+                       "('com.webos.service.bench',$1,'luna://com.webos.service.bench/fire',"
+                       "'{}',0,1,0,$2,'',0)", -1, &st, NULL);
+
+    for (i = 0; i < queued; i++)
+    {
+        snprintf(key, sizeof(key), "bench-%d", i);
+        sqlite3_bind_text(st, 1, key, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(st, 2, i < due ? BENCH_NOW : BENCH_NOW + 1 + i);
+        sqlite3_step(st);
+        sqlite3_reset(st);
+    }
+
+    sqlite3_finalize(st);
+
+    exec_or_die(db, "COMMIT;");
+
+    return db;
+}
+
+/**
+ * @brief Count the due rows walking the whole table.
+ */
+static int
+scan_table(sqlite3 *db)
+{
+    char **table;
+    int noRows, noCols;
+    int i, found = 0;
+
+    sqlite3_get_table(db, "SELECT t1key,expiry FROM AlarmTimeout",
+                      &table, &noRows, &noCols, NULL);
+
+    for (i = 1; i <= noRows; i++)
+    {
+        if (atol(table[i * noCols + 1]) <= BENCH_NOW)
+        {
+            found++;
+        }
+    }
+
+    sqlite3_free_table(table);
+
+    return found;
+}
+
+/**
+ * @brief Find the due rows along expiry_index and delete them, in one
+ * transaction when batched.
+ */
+static int
+expire_table(sqlite3 *db, int batched)
+{
+    sqlite3_stmt *st = NULL;
+    char **table;
+    char query[256];
+    int noRows, noCols;
+    int i;
+
+    snprintf(query, sizeof(query),
+             "SELECT t1key,app_id,key,uri,params,public_bus,activity_id,activity_duration_ms FROM AlarmTimeout "
+             "WHERE expiry<=%d ORDER BY expiry", BENCH_NOW);
+
+    sqlite3_get_table(db, query, &table, &noRows, &noCols, NULL);
+
+    if (batched)
+    {
+        sqlite3_prepare_v2(db, "DELETE FROM AlarmTimeout WHERE t1key=$1", -1,
+                           &st, NULL);
+        exec_or_die(db, "BEGIN TRANSACTION;");
+
+        for (i = 1; i <= noRows; i++)
+        {
+            sqlite3_bind_int(st, 1, atoi(table[i * noCols]));
+            sqlite3_step(st);
+            sqlite3_reset(st);
+        }
+
+        exec_or_die(db, "COMMIT;");
+        sqlite3_finalize(st);
+    }
+    else
+    {
+        for (i = 1; i <= noRows; i++)
+        {
+            sqlite3_prepare_v2(db, "DELETE FROM AlarmTimeout WHERE t1key=$1", -1,
+                               &st, NULL);
+            sqlite3_bind_int(st, 1, atoi(table[i * noCols]));
+            sqlite3_step(st);
+            sqlite3_finalize(st);
+        }
+    }
+
+    sqlite3_free_table(table);
+
+    return noRows;
+}
+
+static int
+count_rows(sqlite3 *db)
+{
+    sqlite3_stmt *st = NULL;
+    int rows;
+
+    sqlite3_prepare_v2(db, "SELECT count(*) FROM AlarmTimeout", -1, &st, NULL);
+    sqlite3_step(st);
+    rows = sqlite3_column_int(st, 0);
+    sqlite3_finalize(st);
+
+    return rows;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int queued[] = { 100, 1000, 10000, 100000 };
+    static const int due[] = { 1, 10, 100 };
+    unsigned int q, d;
+    int run, fd;
+
+    fd = mkstemp(sPath);
+
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+
+    close(fd);
+
+    printf("%8s %5s %12s %12s %12s\n", "queued", "due", "scan_us", "per_row_us",
+           "batched_us");
+
+    for (q = 0; q < sizeof(queued) / sizeof(queued[0]); q++)
+    {
+        for (d = 0; d < sizeof(due) / sizeof(due[0]); d++)
+        {
+            double scan_us = 0, per_row_us = 0, batched_us = 0;
+            double start;
+            sqlite3 *db;
+
+            for (run = 0; run < BENCH_RUNS; run++)
+            {
+                db = open_table(queued[q], due[d]);
+
+                start = now_us();
+
+                if (scan_table(db) != due[d])
+                {
+                    goto fail;
+                }
+
+                scan_us += now_us() - start;
+
+                start = now_us();
+
+                if (expire_table(db, 0) != due[d])
+                {
+                    goto fail;
+                }
+
+                per_row_us += now_us() - start;
+
+                sqlite3_close(db);
+
+                db = open_table(queued[q], due[d]);
+
+                start = now_us();
+
+                if (expire_table(db, 1) != due[d])
+                {
+                    goto fail;
+                }
+
+                batched_us += now_us() - start;
+
+                if (count_rows(db) != queued[q] - due[d])
+                {
+                    goto fail;
+                }
+
+                sqlite3_close(db);
+            }
+
+            printf("%8d %5d %12.0f %12.0f %12.0f\n", queued[q], due[d],
+                   scan_us / BENCH_RUNS, per_row_us / BENCH_RUNS,
+                   batched_us / BENCH_RUNS);
+            continue;
+
+fail:
+            fprintf(stderr, "%d queued, %d due: wrong rows expired\n", queued[q],
+                    due[d]);
+            sqlite3_close(db);
+            unlink(sPath);
+            return 1;
+        }
+    }
+
+    unlink(sPath);
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file bench_json.c
+ *
+ * @brief Cost of reading the ack and activity payloads with json_flat_parse()
+ * against json-c.
+ *
+ * Each payload is read the way suspend_ipc.c reads it: the flat parser with
+ * the fields of its handler, and json_tokener_parse() with the get_json_*
+ * helpers it falls back to. Run by hand: the flat parser should be several
+ * times cheaper on every payload it handles.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <json.h>
+
+#include "json_utils.h"
+
+/* Parses of each payload per measure */
+#define BENCH_PARSES        200000
+
+typedef struct
+{
+    const char *name;
+    const char *payload;
+    const char *str_key;    /*< string field the handler reads */
+    const char *other_key;  /*< boolean or int field, or NULL */
+    JsonFlatType other_type;
+} BenchPayload;
+
+static const BenchPayload kPayloads[] =
+{
+    {
+        "suspendRequestAck", "{\"clientId\":\"1234567-abcdef\",\"ack\":true}",
+        "clientId", "ack", kJsonFlatBoolean
+    },
+    {
+        "prepareSuspendAck", "{\"ack\":false,\"clientId\":\"1234567-abcdef\"}",
+        "clientId", "ack", kJsonFlatBoolean
+    },
+    {
+        "activityStart", "{\"id\":\"com.webos.service.bench-42\",\"duration_ms\":5000}",
+        "id", "duration_ms", kJsonFlatInt
+    },
+    {
+        "activityEnd", "{\"id\":\"com.webos.service.bench-42\"}",
+        "id", NULL, kJsonFlatInt
+    },
+    {
+        "spaced", " { \"clientId\" : \"1234567-abcdef\" ,\n\t\"ack\" : true } ",
+        "clientId", "ack", kJsonFlatBoolean
+    },
+};
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool
+parse_flat(const BenchPayload *p)
+{
+    char buf[JSON_FLAT_STRING_MAX];
+    JsonFlatField fields[2] =
+    {
+        JSON_FLAT_STRING(p->str_key, buf),
+        { .key = p->other_key, .type = p->other_type },
+    };
+
+    return json_flat_parse(p->payload, fields, p->other_key ? 2 : 1) &&
+           fields[0].found;
+}
+
+static bool
+parse_json_c(const BenchPayload *p)
+{
+    struct json_object *object = json_tokener_parse(p->payload);
+    const char *str = NULL;
+    bool boolean;
+    int num;
+    bool ret;
+
+    if (!object)
+    {
+        return false;
+    }
+
+    ret = get_json_string(object, p->str_key, &str);
+
+    if (ret && p->other_key)
+    {
+        ret = p->other_type == kJsonFlatBoolean ?
+              get_json_boolean(object, p->other_key, &boolean) :
+              get_json_int(object, p->other_key, &num);
+    }
+
+    json_object_put(object);
+
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int i;
+    int n;
+
+    printf("%-20s %10s %10s %8s\n", "payload", "flat_ns", "json-c_ns", "ratio");
+
+    for (i = 0; i < sizeof(kPayloads) / sizeof(kPayloads[0]); i++)
+    {
+        const BenchPayload *p = &kPayloads[i];
+        double start, flat_us, json_c_us;
+
+        if (!parse_flat(p) || !parse_json_c(p))
+        {
+            fprintf(stderr, "%s: not parsed\n", p->name);
+            return 1;
+        }
+
+        start = now_us();
+
+        for (n = 0; n < BENCH_PARSES; n++)
+        {
+            parse_flat(p);
+        }
+
+        flat_us = now_us() - start;
+
+        start = now_us();
+
+        for (n = 0; n < BENCH_PARSES; n++)
+        {
+            parse_json_c(p);
+        }
+
+        json_c_us = now_us() - start;
+
+        printf("%-20s %10.0f %10.0f %8.1f\n", p->name,
+               flat_us * 1000 / BENCH_PARSES, json_c_us * 1000 / BENCH_PARSES,
+               json_c_us / flat_us);
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file bench_timerwheel.c
+ *
+ * @brief Cost of one main loop iteration against the number of pending timers,
+ * with the timer wheel and with one GSource per timer.
+ *
+ * None of the timers is due while the iterations are timed, so an iteration
+ * only prepares, polls and checks the sources of the context. Run by hand:
+ * with the wheel the cost should stay about the same for every timer count,
+ * with one GSource per timer it grows with the count.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <glib.h>
+
+#include "timerwheel.h"
+#include "sleepd_config.h"
+
+/* Non blocking iterations of the main context per measure */
+#define BENCH_ITERATIONS    20000
+
+/* The timers are due well after the measure ends */
+#define BENCH_INTERVAL_MS   (60 * 60 * 1000)
+
+SleepConfiguration gSleepConfig =
+{
+    .timer_coalesce_ms = 100,
+};
+
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static gboolean
+bench_timer_fired(gpointer data)
+{
+    fprintf(stderr, "timer fired during the measure\n");
+    return FALSE;
+}
+
+static double
+iteration_us(GMainContext *context)
+{
+    double start = now_us();
+    int i;
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        g_main_context_iteration(context, FALSE);
+    }
+
+    return (now_us() - start) / BENCH_ITERATIONS;
+}
+
+/**
+ * @brief Time the iterations with num timers on the wheel, spread one
+ * millisecond apart.
+ */
+static double
+bench_wheel(int num)
+{
+    GMainContext *context = g_main_context_new();
+    TimerWheelTimer **timers = g_new(TimerWheelTimer *, num);
+    double us;
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        timers[i] = TimerWheelAdd(context, BENCH_INTERVAL_MS + i, 0,
+                                  bench_timer_fired, NULL);
+    }
+
+    us = iteration_us(context);
+
+    for (i = 0; i < num; i++)
+    {
+        TimerWheelRemove(timers[i]);
+    }
+
+    g_free(timers);
+    g_main_context_unref(context);
+
+    return us;
+}
+
+/**
+ * @brief Time the iterations with num timeout sources, as the timers were
+ * added before the wheel.
+ */
+static double
+bench_sources(int num)
+{
+    GMainContext *context = g_main_context_new();
+    GSource **sources = g_new(GSource *, num);
+    double us;
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        sources[i] = g_timeout_source_new(BENCH_INTERVAL_MS + i);
+        g_source_set_callback(sources[i], bench_timer_fired, NULL, NULL);
+        g_source_attach(sources[i], context);
+    }
+
+    us = iteration_us(context);
+
+    for (i = 0; i < num; i++)
+    {
+        g_source_destroy(sources[i]);
+        g_source_unref(sources[i]);
+    }
+
+    g_free(sources);
+    g_main_context_unref(context);
+
+    return us;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int timers[] = { 1, 10, 100, 1000, 10000 };
+    unsigned int i;
+
+    printf("%8s %12s %12s\n", "timers", "wheel_us", "sources_us");
+
+    for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+    {
+        printf("%8d %12.2f %12.2f\n", timers[i], bench_wheel(timers[i]),
+               bench_sources(timers[i]));
+    }
+
+    return 0;
+}
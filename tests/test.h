@@ -0,0 +1,46 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test.h
+ *
+ * @brief Minimal checks for the unit tests, a failed check is reported and the
+ * test goes on so that one run shows every failure.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+static int sTestFailures = 0;
+
+#define TEST_CHECK(cond, ...)                                           \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__,      \
+                    __LINE__, #cond);                                   \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fprintf(stderr, "\n");                                      \
+            sTestFailures++;                                            \
+        }                                                               \
+    } while (0)
+
+#define TEST_RESULT() (sTestFailures ? 1 : 0)
+
+#endif // _TEST_H_
@@ -0,0 +1,157 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test_json_flat.c
+ *
+ * @brief json_flat_parse() against json-c.
+ *
+ * Every payload of the corpus is read with both parsers, asking for the fields
+ * of an ack payload. json_flat_parse() must either give up, so that the caller
+ * falls back to json-c, or find exactly what the get_json_* helpers find.
+ * Each payload also says whether the fast path is expected to handle it.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <json.h>
+
+#include "json_utils.h"
+#include "test.h"
+
+typedef struct
+{
+    const char *payload;
+    bool        flat;       /*< json_flat_parse() is expected to handle it */
+} JsonFlatCase;
+
+static const JsonFlatCase kCorpus[] =
+{
+    /* plain */
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":3}", true },
+    { " { \"clientId\" : \"abc\" ,\n\t\"ack\" : false , \"count\" : -12 } ", true },
+    { "{\"count\":0,\"ack\":false,\"clientId\":\"x\"}", true },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":123456789}", true },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":-123456789}", true },
+    { "{\"x\":null,\"clientId\":\"abc\",\"y\":\"z\",\"ack\":true,\"count\":0,\"w\":5}", true },
+
+    /* escapes */
+    { "{\"clientId\":\"a\\\"b\",\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":\"\\u0041bc\",\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":\"a\\\\b\",\"ack\":true,\"count\":1}", false },
+    { "{\"note\":\"a\\nb\",\"clientId\":\"abc\",\"ack\":true,\"count\":1}", false },
+    { "{\"cli\\u0065ntId\":\"abc\",\"ack\":true,\"count\":1}", false },
+
+    /* nesting */
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1,\"extra\":{\"a\":1}}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1,\"extra\":[1,2]}", false },
+    { "{\"clientId\":{\"id\":\"abc\"},\"ack\":true,\"count\":1}", false },
+    { "[{\"clientId\":\"abc\",\"ack\":true,\"count\":1}]", false },
+
+    /* duplicate keys, json-c keeps the last one */
+    { "{\"clientId\":\"abc\",\"clientId\":\"def\",\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1,\"ack\":false}", false },
+    { "{\"x\":1,\"x\":2,\"clientId\":\"abc\",\"ack\":true,\"count\":1}", true },
+
+    /* truncated */
+    { "", false },
+    { "{", false },
+    { "{\"clientId\"", false },
+    { "{\"clientId\":", false },
+    { "{\"clientId\":\"ab", false },
+    { "{\"clientId\":\"abc\",\"ack\":tr", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1,", false },
+
+    /* malformed */
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1,}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1}x", false },
+    { "{\"clientId\":\"abc\" \"ack\":true,\"count\":1}", false },
+
+    /* values the fast path leaves to json-c */
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1.5}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1e3}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":01}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":1234567890}", false },
+    { "{\"clientId\":\"abc\",\"ack\":true,\"count\":-}", false },
+
+    /* missing fields and wrong types */
+    { "{\"clientId\":\"abc\",\"ack\":true}", false },
+    { "{\"clientId\":\"abc\",\"ack\":\"true\",\"count\":1}", false },
+    { "{\"clientId\":\"abc\",\"ack\":1,\"count\":1}", false },
+    { "{\"clientId\":7,\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":null,\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":\"\",\"ack\":true,\"count\":1}", false },
+    { "{\"clientId\":\"0123456789abcdef0123456789abcdef\",\"ack\":true,\"count\":1}", false },
+};
+
+/**
+ * @brief Check one payload of the corpus.
+ */
+static void
+test_json_flat_case(const JsonFlatCase *test)
+{
+    char clientId[32];
+    JsonFlatField fields[] =
+    {
+        JSON_FLAT_STRING("clientId", clientId),
+        JSON_FLAT_BOOLEAN("ack"),
+        JSON_FLAT_INT("count"),
+    };
+    bool flat = json_flat_parse(test->payload, fields, G_N_ELEMENTS(fields));
+    struct json_object *object = json_tokener_parse(test->payload);
+
+    TEST_CHECK(flat == test->flat, "%s", test->payload);
+
+    if (flat)
+    {
+        const char *str = NULL;
+        bool ack = false;
+        int count = 0;
+
+        TEST_CHECK(object != NULL, "%s", test->payload);
+
+        if (object)
+        {
+            TEST_CHECK(get_json_string(object, "clientId", &str) &&
+                       !strcmp(str, fields[0].str), "%s", test->payload);
+            TEST_CHECK(get_json_boolean(object, "ack", &ack) &&
+                       ack == fields[1].boolean, "%s", test->payload);
+            TEST_CHECK(get_json_int(object, "count", &count) &&
+                       count == fields[2].num, "%s", test->payload);
+        }
+    }
+
+    if (object)
+    {
+        json_object_put(object);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(kCorpus); i++)
+    {
+        test_json_flat_case(&kCorpus[i]);
+    }
+
+    TEST_CHECK(!json_flat_parse(NULL, NULL, 0), "NULL payload");
+
+    return TEST_RESULT();
+}
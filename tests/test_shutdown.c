@@ -0,0 +1,606 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test_shutdown.c
+ *
+ * @brief Phases of the shutdown state machine against a fake Luna layer.
+ *
+ * The luna methods of shutdown.c are called straight from shutdown_methods
+ * with fake messages. The fake records the replies, the subscription
+ * responses and the signals sent. The phase deadline is a fake timer that
+ * only fires when a test says so, so a phase that ends without it is known
+ * to have ended on the ACKs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "init.h"
+#include "machine.h"
+#include "lunabus.h"
+#include "timerwheel.h"
+#include "client_snapshot.h"
+#include "shutdown.h"
+#include "sleepd_config.h"
+#include "test.h"
+
+#define TEST_SUCCESS_REPLY  "{\"success\":true}"
+
+SleepConfiguration gSleepConfig =
+{
+    .shutdown_apps_timeout_ms = 15000,
+    .shutdown_services_timeout_ms = 15000,
+    .shutdown_client_deadline_pct = 200,
+    .shutdown_client_deadline_min_ms = 1000,
+    .shutdown_overlap_phases = false,
+};
+
+extern LSMethod shutdown_methods[];
+
+/* Fake Luna layer */
+
+struct LSMessage
+{
+    gchar  *payload;
+    gchar  *token;
+    int     refs;
+    gchar  *reply;      /* last reply */
+    gchar  *respond;    /* last subscription response */
+};
+
+static int sNumMessages = 0;
+static int sAppsSignals = 0;
+static int sServicesSignals = 0;
+
+static LSMessage *
+message_new(gchar *payload)
+{
+    LSMessage *message = g_new0(LSMessage, 1);
+
+    message->payload = payload;
+    message->token = g_strdup_printf("test.%d", ++sNumMessages);
+
+    return message;
+}
+
+static void
+message_free(LSMessage *message)
+{
+    g_free(message->payload);
+    g_free(message->token);
+    g_free(message->reply);
+    g_free(message->respond);
+    g_free(message);
+}
+
+bool
+LSErrorInit(LSError *lserror)
+{
+    memset(lserror, 0, sizeof(*lserror));
+    return true;
+}
+
+void
+LSErrorFree(LSError *lserror)
+{
+}
+
+void
+LSErrorPrint(LSError *lserror, FILE *out)
+{
+}
+
+const char *
+LSMessageGetPayload(LSMessage *message)
+{
+    return message->payload;
+}
+
+const char *
+LSMessageGetSenderServiceName(LSMessage *message)
+{
+    return "com.webos.service.test";
+}
+
+const char *
+LSMessageGetUniqueToken(LSMessage *message)
+{
+    return message->token;
+}
+
+void
+LSMessageRef(LSMessage *message)
+{
+    message->refs++;
+}
+
+void
+LSMessageUnref(LSMessage *message)
+{
+    message->refs--;
+}
+
+bool
+LSMessageReply(LSHandle *sh, LSMessage *message, const char *payload,
+               LSError *lserror)
+{
+    g_free(message->reply);
+    message->reply = g_strdup(payload);
+    return true;
+}
+
+bool
+LSMessageRespond(LSMessage *message, const char *payload, LSError *lserror)
+{
+    g_free(message->respond);
+    message->respond = g_strdup(payload);
+    return true;
+}
+
+bool
+LSSubscriptionAdd(LSHandle *sh, const char *key, LSMessage *message,
+                  LSError *lserror)
+{
+    return true;
+}
+
+bool
+LunaBusCategoryAddName(LunaBusCategory *cat, LSHandle *sh,
+                       const char *service, const char *category)
+{
+    return true;
+}
+
+bool
+LunaBusRegisterCategory(LunaBusCategory *cat, LSMethod *methods,
+                        LSSignal *signals, LSError *lserror)
+{
+    return true;
+}
+
+bool
+LunaBusSignalSend(LunaBusCategory *cat, const char *subscription_key,
+                  const char *signal, const char *payload)
+{
+    if (!strcmp(signal, "shutdownApplications"))
+    {
+        sAppsSignals++;
+    }
+    else if (!strcmp(signal, "shutdownServices"))
+    {
+        sServicesSignals++;
+    }
+
+    return true;
+}
+
+/* Fake daemon */
+
+static InitFunc sShutdownInit = NULL;
+
+void
+NamedInitFuncAdd(const char *initListName, InitFuncPriority priority,
+                 InitFunc func, const char *func_name)
+{
+    sShutdownInit = func;
+}
+
+GMainContext *
+GetMainLoopContext(void)
+{
+    return NULL;
+}
+
+LSHandle *
+GetLunaServiceHandle(void)
+{
+    return NULL;
+}
+
+LSHandle *
+GetWebosLunaServiceHandle(void)
+{
+    return NULL;
+}
+
+nyx_device_handle_t
+GetNyxSystemDevice(void)
+{
+    return NULL;
+}
+
+nyx_error_t
+nyx_system_set_alarm(nyx_device_handle_t handle, time_t time,
+                     nyx_device_callback_function_t callback, void *context)
+{
+    return NYX_ERROR_NONE;
+}
+
+void
+MachineForceShutdown(const char *reason)
+{
+}
+
+void
+MachineForceReboot(const char *reason)
+{
+}
+
+void
+ClientSnapshotSchedule(void)
+{
+}
+
+void
+ClientSnapshotAppend(GByteArray *buf, ClientSnapshotKind kind, guint flags,
+                     const char *clientName, const char *applicationName,
+                     const char *serviceName)
+{
+}
+
+/* Fake phase deadline, fired by the tests */
+
+struct _TimerWheelTimer
+{
+    GSourceFunc func;
+    gpointer    data;
+    bool        armed;
+};
+
+static TimerWheelTimer sTimer;
+
+TimerWheelTimer *
+TimerWheelAdd(GMainContext *context, guint interval_ms, guint granularity_ms,
+              GSourceFunc func, gpointer data)
+{
+    TEST_CHECK(!sTimer.armed, "a deadline is armed already");
+
+    sTimer.func = func;
+    sTimer.data = data;
+    sTimer.armed = true;
+
+    return &sTimer;
+}
+
+void
+TimerWheelRemove(TimerWheelTimer *timer)
+{
+    timer->armed = false;
+}
+
+static void
+timer_fire(void)
+{
+    TEST_CHECK(sTimer.armed, "no deadline to fire");
+
+    if (sTimer.armed)
+    {
+        sTimer.armed = false;
+        sTimer.func(sTimer.data);
+    }
+}
+
+/* Calls to shutdown.c */
+
+static void
+call(const char *method, LSMessage *message)
+{
+    LSMethod *m;
+
+    for (m = shutdown_methods; m->name; m++)
+    {
+        if (!strcmp(m->name, method))
+        {
+            m->function(NULL, message, NULL);
+            return;
+        }
+    }
+
+    TEST_CHECK(false, "no method %s", method);
+}
+
+static LSMessage *
+client_register(const char *method, const char *name, bool depends_on_apps)
+{
+    LSMessage *message;
+
+    if (depends_on_apps)
+    {
+        message = message_new(g_strdup_printf("{\"clientName\":\"%s\"}", name));
+    }
+    else
+    {
+        message = message_new(g_strdup_printf("{\"clientName\":\"%s\","
+                                              "\"dependsOnApps\":false}", name));
+    }
+
+    call(method, message);
+    TEST_CHECK(message->reply && strstr(message->reply, message->token),
+               "%s not registered", name);
+
+    return message;
+}
+
+static LSMessage *
+app_register(const char *name)
+{
+    return client_register("shutdownApplicationsRegister", name, true);
+}
+
+static LSMessage *
+service_register(const char *name, bool depends_on_apps)
+{
+    return client_register("shutdownServicesRegister", name, depends_on_apps);
+}
+
+static void
+client_ack(const char *method, LSMessage *client)
+{
+    LSMessage *message = message_new(g_strdup_printf("{\"clientId\":\"%s\"}",
+                                     client->token));
+
+    call(method, message);
+    TEST_CHECK(message->reply && strstr(message->reply, "\"returnValue\":true"),
+               "%s: ACK of %s refused: %s", method, client->token, message->reply);
+    message_free(message);
+}
+
+static void
+app_ack(LSMessage *client)
+{
+    client_ack("shutdownApplicationsAck", client);
+}
+
+static void
+service_ack(LSMessage *client)
+{
+    client_ack("shutdownServicesAck", client);
+}
+
+static LSMessage *
+shutdown_initiate(void)
+{
+    LSMessage *message = message_new(g_strdup("{}"));
+
+    sAppsSignals = 0;
+    sServicesSignals = 0;
+
+    call("initiate", message);
+
+    return message;
+}
+
+static bool
+shutdown_done(LSMessage *initiate)
+{
+    return initiate->reply && !strcmp(initiate->reply, TEST_SUCCESS_REPLY);
+}
+
+/**
+ * @brief Unregister the clients and put the state machine back to idle.
+ */
+static void
+shutdown_reset(LSMessage *initiate, LSMessage **clients, int num_clients)
+{
+    LSMessage *message = message_new(g_strdup("{}"));
+    int i;
+
+    for (i = 0; i < num_clients; i++)
+    {
+        shutdown_client_cancel_registration(clients[i]->token);
+        TEST_CHECK(clients[i]->refs == 0, "%s still referenced",
+                   clients[i]->token);
+        message_free(clients[i]);
+    }
+
+    call("TESTresetShutdownState", message);
+    message_free(message);
+
+    TEST_CHECK(initiate->refs == 0, "initiate still referenced");
+    message_free(initiate);
+
+    sTimer.armed = false;
+    gSleepConfig.shutdown_overlap_phases = false;
+}
+
+/* Tests */
+
+static void
+test_all_ack(void)
+{
+    LSMessage *clients[3];
+    LSMessage *initiate;
+
+    clients[0] = app_register("app.a");
+    clients[1] = app_register("app.b");
+    clients[2] = service_register("service.a", true);
+
+    initiate = shutdown_initiate();
+    TEST_CHECK(sAppsSignals == 1, "shutdownApplications sent %d times",
+               sAppsSignals);
+    TEST_CHECK(sServicesSignals == 0, "shutdownServices sent with the apps");
+
+    app_ack(clients[0]);
+    TEST_CHECK(sServicesSignals == 0, "apps phase over with one ACK missing");
+
+    app_ack(clients[1]);
+    TEST_CHECK(sServicesSignals == 1, "services phase not started");
+    TEST_CHECK(!shutdown_done(initiate), "done before the services ACKed");
+
+    service_ack(clients[2]);
+    TEST_CHECK(shutdown_done(initiate), "not done after every ACK");
+    TEST_CHECK(!sTimer.armed, "deadline left armed");
+
+    shutdown_reset(initiate, clients, 3);
+}
+
+static void
+test_timeout(void)
+{
+    LSMessage *clients[3];
+    LSMessage *initiate;
+
+    clients[0] = app_register("app.a");
+    clients[1] = app_register("app.b");
+    clients[2] = service_register("service.a", true);
+
+    initiate = shutdown_initiate();
+
+    app_ack(clients[0]);
+    TEST_CHECK(sServicesSignals == 0, "apps phase over with one ACK missing");
+
+    timer_fire();
+    TEST_CHECK(sServicesSignals == 1, "services phase not started on timeout");
+    TEST_CHECK(!shutdown_done(initiate), "done before the services timed out");
+
+    timer_fire();
+    TEST_CHECK(shutdown_done(initiate), "not done on timeout");
+
+    shutdown_reset(initiate, clients, 3);
+}
+
+static void
+test_late_registrant(void)
+{
+    LSMessage *clients[2];
+    LSMessage *initiate;
+
+    clients[0] = app_register("app.a");
+
+    initiate = shutdown_initiate();
+
+    clients[1] = app_register("app.late");
+    TEST_CHECK(clients[1]->respond &&
+               strstr(clients[1]->respond, "shutdownApplications"),
+               "late registrant not signalled");
+
+    app_ack(clients[0]);
+    TEST_CHECK(sServicesSignals == 0, "apps phase over without the late ACK");
+
+    app_ack(clients[1]);
+    TEST_CHECK(sServicesSignals == 1, "late ACK did not count");
+    TEST_CHECK(shutdown_done(initiate), "not done after every ACK");
+
+    shutdown_reset(initiate, clients, 2);
+}
+
+static void
+test_client_leaves(void)
+{
+    LSMessage *clients[3];
+    LSMessage *initiate;
+
+    clients[0] = app_register("app.a");
+    clients[1] = app_register("app.b");
+    clients[2] = app_register("app.c");
+
+    initiate = shutdown_initiate();
+
+    /* Its ACK leaves with it */
+    app_ack(clients[0]);
+    shutdown_client_cancel_registration(clients[0]->token);
+
+    app_ack(clients[1]);
+    TEST_CHECK(sServicesSignals == 0,
+               "apps phase over with the ACK of a client that left");
+
+    /* The last client leaving ends the phase */
+    shutdown_client_cancel_registration(clients[2]->token);
+    TEST_CHECK(sServicesSignals == 1, "apps phase not over once c left");
+    TEST_CHECK(shutdown_done(initiate), "not done once c left");
+
+    shutdown_reset(initiate, clients, 3);
+}
+
+static void
+test_overlap_phases(void)
+{
+    LSMessage *clients[2];
+    LSMessage *initiate;
+
+    gSleepConfig.shutdown_overlap_phases = true;
+
+    clients[0] = app_register("app.a");
+    clients[1] = service_register("service.early", false);
+
+    initiate = shutdown_initiate();
+    TEST_CHECK(clients[1]->respond &&
+               strstr(clients[1]->respond, "shutdownServices"),
+               "independent service not signalled early");
+
+    service_ack(clients[1]);
+    TEST_CHECK(sServicesSignals == 0, "services phase before the apps ACKed");
+
+    /* The services phase has the early ACK already */
+    app_ack(clients[0]);
+    TEST_CHECK(shutdown_done(initiate), "services phase waited for an ACK it had");
+
+    shutdown_reset(initiate, clients, 2);
+}
+
+static void
+test_restored_placeholder(void)
+{
+    LSMessage *clients[1];
+    LSMessage *initiate;
+
+    shutdown_client_restore(true, CLIENT_SNAPSHOT_RESTORED_PREFIX "app.gone",
+                            "app.gone", "com.webos.service.gone");
+    clients[0] = app_register("app.a");
+
+    initiate = shutdown_initiate();
+
+    app_ack(clients[0]);
+    TEST_CHECK(shutdown_done(initiate), "apps phase waited for a placeholder");
+
+    shutdown_client_drop(true, CLIENT_SNAPSHOT_RESTORED_PREFIX "app.gone");
+    shutdown_reset(initiate, clients, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+    char dir[] = "/tmp/test_shutdown-XXXXXX";
+    gchar *path;
+
+    if (!mkdtemp(dir))
+    {
+        return 1;
+    }
+
+    gSleepConfig.preference_dir = dir;
+
+    TEST_CHECK(sShutdownInit && sShutdownInit() == 0, "shutdown_init failed");
+
+    test_all_ack();
+    test_timeout();
+    test_late_registrant();
+    test_client_leaves();
+    test_overlap_phases();
+    test_restored_placeholder();
+
+    path = g_build_filename(dir, "shutdown_latency", NULL);
+    unlink(path);
+    g_free(path);
+    rmdir(dir);
+
+    return TEST_RESULT();
+}
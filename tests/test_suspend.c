@@ -0,0 +1,530 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test_suspend.c
+ *
+ * @brief States of the ENABLE_ASYNC_SUSPEND state machine against a fake
+ * clock.
+ *
+ * suspend.c runs on the default main context, its collaborators are faked
+ * here. The vote clients are a tristate each round is decided with, and the
+ * timers are kept on a fake clock that only moves when a test advances it, so
+ * a round times out exactly when the test says so.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "suspend.h"
+#include "clock.h"
+#include "wait.h"
+#include "machine.h"
+#include "main.h"
+#include "timerwheel.h"
+#include "activity.h"
+#include "client.h"
+#include "timesaver.h"
+#include "init.h"
+#include "timeout_alarm.h"
+#include "client_snapshot.h"
+#include "reference_time.h"
+#include "sleepd_config.h"
+#include "sawmill_logger.h"
+#include "wakeup.h"
+#include "test.h"
+
+#define TEST_SUSPEND_RESPONSE_MS    30000
+#define TEST_PREPARE_SUSPEND_MS     5000
+
+/* Long enough for the idle check never to run during a test */
+#define TEST_IDLE_MS                (24 * 60 * 60 * 1000)
+
+SleepConfiguration gSleepConfig =
+{
+    .wait_idle_ms = TEST_IDLE_MS,
+    .wait_idle_granularity_ms = 0,
+    .wait_suspend_response_ms = TEST_SUSPEND_RESPONSE_MS,
+    .wait_prepare_suspend_ms = TEST_PREPARE_SUSPEND_MS,
+    .after_resume_idle_ms = TEST_IDLE_MS,
+    .suspend_backoff_max_ms = 0,
+    .enable_idle_check_thread = true,
+};
+
+/* Fake clock */
+
+static gint64 sNowMs = 1000;
+
+struct _TimerWheelTimer
+{
+    gint64      due_ms;
+    guint       interval_ms;
+    GSourceFunc func;
+    gpointer    data;
+};
+
+static GList *sTimers = NULL;
+
+TimerWheelTimer *
+TimerWheelAdd(GMainContext *context, guint interval_ms, guint granularity_ms,
+              GSourceFunc func, gpointer data)
+{
+    TimerWheelTimer *timer = g_new0(TimerWheelTimer, 1);
+
+    timer->due_ms = sNowMs + interval_ms;
+    timer->interval_ms = interval_ms;
+    timer->func = func;
+    timer->data = data;
+
+    sTimers = g_list_append(sTimers, timer);
+
+    return timer;
+}
+
+void
+TimerWheelRemove(TimerWheelTimer *timer)
+{
+    sTimers = g_list_remove(sTimers, timer);
+    g_free(timer);
+}
+
+void
+TimerWheelSetInterval(TimerWheelTimer *timer, guint interval_ms,
+                      bool from_poll)
+{
+    timer->interval_ms = interval_ms;
+    timer->due_ms = sNowMs + interval_ms;
+}
+
+void
+ClockGetTime(struct timespec *time)
+{
+    time->tv_sec = sNowMs / 1000;
+    time->tv_nsec = (sNowMs % 1000) * 1000000;
+}
+
+void
+ClockDiff(struct timespec *diff, struct timespec *a, struct timespec *b)
+{
+    ClockNsToTimespec(ClockNsFromTimespec(a) - ClockNsFromTimespec(b), diff);
+}
+
+long
+ClockGetMs(struct timespec *ts)
+{
+    return ClockNsToMs(ClockNsFromTimespec(ts));
+}
+
+void
+ClockStr(GString *str, struct timespec *time)
+{
+    g_string_append_printf(str, "%ld ms", ClockGetMs(time));
+}
+
+void
+get_time_now(struct timespec *time)
+{
+    ClockGetTime(time);
+}
+
+time_t
+reference_time(void)
+{
+    return sNowMs / 1000;
+}
+
+/**
+ * @brief Dispatch what is ready on the main context.
+ */
+static void
+run_pending(void)
+{
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+}
+
+/**
+ * @brief Move the fake clock on by ms, firing the timers that fall due on
+ * the way in order.
+ */
+static void
+clock_advance(gint64 ms)
+{
+    gint64 until = sNowMs + ms;
+
+    run_pending();
+
+    while (true)
+    {
+        TimerWheelTimer *next = NULL;
+        GList *l;
+
+        for (l = sTimers; l; l = l->next)
+        {
+            TimerWheelTimer *timer = l->data;
+
+            if (timer->due_ms <= until && (!next || timer->due_ms < next->due_ms))
+            {
+                next = timer;
+            }
+        }
+
+        if (!next)
+        {
+            break;
+        }
+
+        sNowMs = next->due_ms;
+
+        if (next->func(next->data))
+        {
+            next->due_ms = sNowMs + next->interval_ms;
+        }
+        else
+        {
+            TimerWheelRemove(next);
+        }
+
+        run_pending();
+    }
+
+    sNowMs = until;
+}
+
+/* Fake clients */
+
+typedef enum
+{
+    kVotePending,
+    kVoteAck,
+    kVoteNack,
+} TestVote;
+
+static TestVote sSuspendRequestVote = kVotePending;
+static TestVote sPrepareSuspendVote = kVotePending;
+
+static int sSuspendRequests = 0;
+static int sPrepareSuspends = 0;
+static int sSleeps = 0;
+static int sResumes = 0;
+
+void
+PwrEventVoteInit(void)
+{
+    sSuspendRequestVote = kVotePending;
+    sPrepareSuspendVote = kVotePending;
+}
+
+bool
+PwrEventClientsApproveSuspendRequest(void)
+{
+    return sSuspendRequestVote == kVoteAck;
+}
+
+bool
+PwrEventClientsApprovePrepareSuspend(void)
+{
+    return sPrepareSuspendVote == kVoteAck;
+}
+
+int
+SendSuspendRequest(const char *message)
+{
+    sSuspendRequests++;
+    return 0;
+}
+
+int
+SendPrepareSuspend(const char *message)
+{
+    sPrepareSuspendVote = kVotePending;
+    sPrepareSuspends++;
+    return 0;
+}
+
+int
+SendSuspended(const char *message)
+{
+    return 0;
+}
+
+int
+SendResume(int resumetype, char *message)
+{
+    sResumes++;
+    return 0;
+}
+
+bool
+MachineSleep(void)
+{
+    sSleeps++;
+    return true;
+}
+
+/**
+ * @brief The clients decided the suspend request round.
+ */
+static void
+suspend_request_vote(TestVote vote)
+{
+    sSuspendRequestVote = vote;
+    SuspendRequestVotesDone();
+    run_pending();
+}
+
+/**
+ * @brief The clients decided the prepare suspend round.
+ */
+static void
+prepare_suspend_vote(TestVote vote)
+{
+    sPrepareSuspendVote = vote;
+    PrepareSuspendVotesDone();
+    run_pending();
+}
+
+/* Fake daemon */
+
+static InitFunc sSuspendInit = NULL;
+static GMainLoop *sMainLoop = NULL;
+
+void
+NamedInitFuncAdd(const char *initListName, InitFuncPriority priority,
+                 InitFunc func, const char *func_name)
+{
+    sSuspendInit = func;
+}
+
+GMainLoop *
+GetMainLoop(void)
+{
+    return sMainLoop;
+}
+
+GMainContext *
+GetMainLoopContext(void)
+{
+    return NULL;
+}
+
+LSHandle *
+GetLunaServiceHandle(void)
+{
+    return NULL;
+}
+
+bool
+LSErrorInit(LSError *lserror)
+{
+    memset(lserror, 0, sizeof(*lserror));
+    return true;
+}
+
+void
+LSErrorFree(LSError *lserror)
+{
+}
+
+bool
+LSCall(LSHandle *sh, const char *uri, const char *payload,
+       LSFilterFunc callback, void *ctx, LSMessageToken *token, LSError *lserror)
+{
+    return true;
+}
+
+const char *
+LSMessageGetPayload(LSMessage *message)
+{
+    return "{}";
+}
+
+int com_palm_suspend_lunabus_init(void) { return 0; }
+void SuspendIPCInit(void) { }
+void ClientSnapshotRestore(void) { }
+void PwrEventClientTableCreate(void) { }
+void PwrEventClientTablePrint(GLogLevelFlags lvl) { }
+void PwrEventClientPrintNACKRateLimited(void) { }
+gchar *PwrEventGetClientTable() { return g_strdup(""); }
+gchar *PwrEventGetSuspendRequestNORSPList() { return g_strdup(""); }
+gchar *PwrEventGetPrepareSuspendNORSPList() { return g_strdup(""); }
+bool MachineCanSleep(void) { return true; }
+bool MachineSupportsWakelocks(void) { return true; }
+void MachineWakeup(void) { }
+bool PwrEventActivityCanSleep(ClockNs now) { return true; }
+bool PwrEventActivityCheckActivitiesActive(ClockNs now) { return true; }
+int PwrEventActivityCount(ClockNs from) { return 0; }
+long PwrEventActivityGetMaxDuration(ClockNs now) { return 0; }
+void PwrEventActivityPrintFrom(ClockNs from) { }
+void PwrEventActivityRemoveExpired(ClockNs now) { }
+bool PwrEventFreezeActivities(ClockNs now) { return true; }
+void PwrEventThawActivities(void) { }
+void PwrEventWakeupSnapshot(time_t rtc_expiry, const char *rtc_key) { }
+void PwrEventWakeupAttribute(time_t wake_time) { }
+bool timeout_get_next_wakeup(time_t *expiry, gchar **app_id, gchar **key) { return false; }
+bool queue_next_wakeup() { return false; }
+bool update_timeouts_on_resume(void) { return true; }
+void timesaver_save() { }
+void sawmill_logger_record_sleep(struct timespec time_awake) { }
+void sawmill_logger_record_wake(struct timespec time_asleep) { }
+
+/* Tests */
+
+static void
+counts_reset(void)
+{
+    sSuspendRequests = 0;
+    sPrepareSuspends = 0;
+    sSleeps = 0;
+    sResumes = 0;
+}
+
+/**
+ * @brief Wake up from the kernel sleep the state machine is left in.
+ */
+static void
+test_resume(void)
+{
+    TEST_CHECK(IsSuspended(), "not asleep");
+
+    TriggerResume("test", kPowerEventNone);
+    run_pending();
+
+    TEST_CHECK(!IsSuspended(), "still asleep after the resume trigger");
+    TEST_CHECK(sResumes == 1, "resume sent %d times", sResumes);
+}
+
+static void
+test_all_ack(void)
+{
+    counts_reset();
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+    TEST_CHECK(sSuspendRequests == 1, "suspend request not sent");
+
+    suspend_request_vote(kVoteAck);
+    TEST_CHECK(sPrepareSuspends == 1, "prepare suspend not sent on ACK");
+
+    prepare_suspend_vote(kVoteAck);
+    TEST_CHECK(sSleeps == 1, "did not sleep on ACK");
+
+    test_resume();
+}
+
+static void
+test_timeouts(void)
+{
+    counts_reset();
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    clock_advance(TEST_SUSPEND_RESPONSE_MS - 1);
+    TEST_CHECK(sPrepareSuspends == 0, "suspend request timed out early");
+
+    clock_advance(1);
+    TEST_CHECK(sPrepareSuspends == 1, "suspend request did not time out");
+
+    /* Late completion of the round that timed out */
+    suspend_request_vote(kVoteAck);
+    TEST_CHECK(sSleeps == 0, "late suspend request ACK decided prepare suspend");
+
+    clock_advance(TEST_PREPARE_SUSPEND_MS - 1);
+    TEST_CHECK(sSleeps == 0, "prepare suspend timed out early");
+
+    clock_advance(1);
+    TEST_CHECK(sSleeps == 1, "prepare suspend did not time out");
+
+    test_resume();
+}
+
+static void
+test_nack(void)
+{
+    counts_reset();
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+
+    suspend_request_vote(kVoteNack);
+    TEST_CHECK(sPrepareSuspends == 0, "prepare suspend sent after a NACK");
+    TEST_CHECK(!IsSuspended(), "asleep after a NACK");
+
+    /* The timeout of the round is gone with it */
+    clock_advance(TEST_SUSPEND_RESPONSE_MS);
+    TEST_CHECK(sPrepareSuspends == 0, "NACKed round timed out");
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+    suspend_request_vote(kVoteAck);
+
+    prepare_suspend_vote(kVoteNack);
+    TEST_CHECK(sSleeps == 0, "slept after a prepare suspend NACK");
+    TEST_CHECK(sResumes == 1, "suspend abort not signalled");
+    TEST_CHECK(!IsSuspended(), "asleep after a NACK");
+}
+
+static void
+test_events_during_vote(void)
+{
+    counts_reset();
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+
+    /* The round in progress answers an idle event */
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+    suspend_request_vote(kVoteNack);
+    TEST_CHECK(sSuspendRequests == 1, "idle event during a round started another");
+
+    TriggerSuspend("test", kPowerEventIdleEvent);
+    run_pending();
+
+    /* A forced suspend is run once the round is over, and is not lost to a
+     * resume trigger coming after it */
+    TriggerSuspend("test", kPowerEventForceSuspend);
+    TriggerResume("test", kPowerEventNone);
+    run_pending();
+    TEST_CHECK(sSuspendRequests == 2, "forced suspend ran during a round");
+
+    suspend_request_vote(kVoteNack);
+    TEST_CHECK(sSuspendRequests == 3, "forced suspend lost during a round");
+
+    suspend_request_vote(kVoteAck);
+    prepare_suspend_vote(kVoteAck);
+    TEST_CHECK(sSleeps == 1, "forced suspend did not sleep");
+
+    test_resume();
+}
+
+int
+main(int argc, char **argv)
+{
+    sMainLoop = g_main_loop_new(NULL, FALSE);
+
+    TEST_CHECK(sSuspendInit && sSuspendInit() == 0, "SuspendInit failed");
+
+    test_all_ack();
+    test_timeouts();
+    test_nack();
+    test_events_during_vote();
+
+    g_main_loop_unref(sMainLoop);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,234 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test_timerwheel.c
+ *
+ * @brief Timers of the timer wheel against the monotonic clock.
+ *
+ * The timers run on a main context of their own. A timer must never fire
+ * before it is due, and may fire late by TIMER_SLACK_MS.
+ */
+
+#include <glib.h>
+
+#include "timerwheel.h"
+#include "clock.h"
+#include "sleepd_config.h"
+#include "test.h"
+
+#define TIMER_SLACK_MS      20
+
+#define TIMER_COALESCE_MS   100
+
+/* Longest a test runs its main context */
+#define TIMER_TEST_MAX_MS   5000
+
+SleepConfiguration gSleepConfig =
+{
+    .timer_coalesce_ms = TIMER_COALESCE_MS,
+};
+
+typedef struct
+{
+    TimerWheelTimer *timer;
+    guint            interval_ms;
+    guint            granularity_ms;
+    gint64           due_ms;       /* earliest the timer may fire */
+    gint64           fired_ms;
+    gint64           late_ms;      /* latest it fired after due_ms */
+    int              fired;
+    int              repeat;       /* number of times to fire */
+    TimerWheelTimer *remove;       /* timer to remove from the callback */
+} TestTimer;
+
+static GMainContext *sContext = NULL;
+
+static gint64
+now_ms(void)
+{
+    return ClockNsToMs(ClockNsNow());
+}
+
+static gboolean
+test_timer_fired(gpointer data)
+{
+    TestTimer *test = data;
+    gint64 now = now_ms();
+
+    TEST_CHECK(now >= test->due_ms, "%u ms timer fired %" G_GINT64_FORMAT
+               " ms early", test->interval_ms, test->due_ms - now);
+
+    test->late_ms = MAX(test->late_ms, now - test->due_ms);
+    test->fired++;
+    test->fired_ms = now;
+    test->due_ms = now + test->interval_ms;
+
+    if (test->remove)
+    {
+        TimerWheelRemove(test->remove);
+        test->remove = NULL;
+    }
+
+    return test->fired < test->repeat;
+}
+
+static void
+test_timer_add(TestTimer *test, guint interval_ms, guint granularity_ms,
+               int repeat)
+{
+    test->interval_ms = interval_ms;
+    test->granularity_ms = granularity_ms;
+    test->due_ms = now_ms() + interval_ms;
+    test->repeat = repeat;
+    test->timer = TimerWheelAdd(sContext, interval_ms, granularity_ms,
+                                test_timer_fired, test);
+}
+
+/**
+ * @brief Run the main context until every timer fired as often as it should.
+ * Timers without a granularity must have fired on time.
+ */
+static void
+test_timers_run(TestTimer *tests, int num_tests)
+{
+    gint64 deadline = now_ms() + TIMER_TEST_MAX_MS;
+    bool done = false;
+    int i;
+
+    while (!done && now_ms() < deadline)
+    {
+        g_main_context_iteration(sContext, TRUE);
+
+        done = true;
+
+        for (i = 0; i < num_tests; i++)
+        {
+            done = done && tests[i].fired >= tests[i].repeat;
+        }
+    }
+
+    for (i = 0; i < num_tests; i++)
+    {
+        TEST_CHECK(tests[i].fired == tests[i].repeat, "%u ms timer fired %d of %d times",
+                   tests[i].interval_ms, tests[i].fired, tests[i].repeat);
+        TEST_CHECK(tests[i].granularity_ms || tests[i].late_ms <= TIMER_SLACK_MS,
+                   "%u ms timer fired %" G_GINT64_FORMAT " ms late",
+                   tests[i].interval_ms, tests[i].late_ms);
+    }
+}
+
+/**
+ * @brief Timers without a granularity fire on time.
+ */
+static void
+test_timerwheel_accuracy(void)
+{
+    static const guint kIntervalsMs[] = { 1, 5, 20, 63, 64, 65, 130, 300, 1000 };
+    TestTimer tests[G_N_ELEMENTS(kIntervalsMs)] = { { 0 } };
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(kIntervalsMs); i++)
+    {
+        test_timer_add(&tests[i], kIntervalsMs[i], 0, 1);
+    }
+
+    test_timers_run(tests, G_N_ELEMENTS(tests));
+}
+
+/**
+ * @brief A repeating timer fires every interval until its callback returns FALSE.
+ */
+static void
+test_timerwheel_repeat(void)
+{
+    TestTimer test = { 0 };
+    gint64 start = now_ms();
+
+    test_timer_add(&test, 10, 0, 5);
+    test_timers_run(&test, 1);
+
+    TEST_CHECK(test.fired_ms - start >= 50 &&
+               test.fired_ms - start <= 50 + TIMER_SLACK_MS,
+               "5 x 10 ms took %" G_GINT64_FORMAT " ms", test.fired_ms - start);
+}
+
+/**
+ * @brief Tolerant timers wait for a shared slot boundary and fire together.
+ */
+static void
+test_timerwheel_coalesce(void)
+{
+    TestTimer tests[2] = { { 0 } };
+    guint granularity_ms = 2 * TIMER_COALESCE_MS;
+
+    /* Start early in a slot, so that both timers are due within it */
+    while (now_ms() % granularity_ms >= granularity_ms / 2)
+    {
+        g_usleep(1000);
+    }
+
+    test_timer_add(&tests[0], 10, granularity_ms, 1);
+    test_timer_add(&tests[1], 30, granularity_ms, 1);
+    test_timers_run(tests, G_N_ELEMENTS(tests));
+
+    TEST_CHECK(tests[0].fired_ms == tests[1].fired_ms,
+               "coalesced timers fired at %" G_GINT64_FORMAT " and %"
+               G_GINT64_FORMAT " ms", tests[0].fired_ms, tests[1].fired_ms);
+    TEST_CHECK(tests[0].fired_ms % granularity_ms <= TIMER_SLACK_MS,
+               "coalesced timers fired %" G_GINT64_FORMAT " ms past the slot",
+               tests[0].fired_ms % granularity_ms);
+}
+
+/**
+ * @brief Removed timers do not fire, also when removed by another timer, and
+ * a new interval restarts the timer.
+ */
+static void
+test_timerwheel_remove(void)
+{
+    TestTimer tests[3] = { { 0 } };
+    TestTimer removed = { 0 };
+
+    test_timer_add(&removed, 5, 0, 1);
+    TimerWheelRemove(removed.timer);
+
+    test_timer_add(&tests[0], 20, 0, 1);
+    test_timer_add(&tests[1], 40, 0, 0);
+    tests[0].remove = tests[1].timer;
+
+    test_timer_add(&tests[2], 10, 0, 1);
+    TimerWheelSetInterval(tests[2].timer, 60, true);
+    tests[2].interval_ms = 60;
+    tests[2].due_ms = now_ms() + 60;
+
+    test_timers_run(tests, G_N_ELEMENTS(tests));
+
+    TEST_CHECK(removed.fired == 0, "removed timer fired");
+}
+
+int
+main(int argc, char **argv)
+{
+    sContext = g_main_context_new();
+
+    test_timerwheel_accuracy();
+    test_timerwheel_repeat();
+    test_timerwheel_coalesce();
+    test_timerwheel_remove();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,208 @@
+// Copyright (c) 2011-2018 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+/**
+ * @file test_wait.c
+ *
+ * @brief Timeout accuracy and signalling of WaitEvent and WaitObj.
+ *
+ * A wait must never return before its timeout. It may return late by
+ * WAIT_SLACK_MS, which leaves room for a loaded build machine.
+ */
+
+#include <glib.h>
+#include <unistd.h>
+
+#include "wait.h"
+#include "clock.h"
+#include "test.h"
+
+#define WAIT_SLACK_MS   20
+
+#define SIGNAL_DELAY_MS 30
+
+static const int kTimeoutsMs[] = { 0, 1, 2, 5, 10, 50, 250, 999, 1001 };
+
+static WaitEvent sEvent;
+
+static double
+elapsed_ms(ClockNs start)
+{
+    return (ClockNsNow() - start) / (double)CLOCK_NS_PER_MS;
+}
+
+static void *
+signal_later(void *data)
+{
+    usleep(SIGNAL_DELAY_MS * 1000);
+    WaitEventSignal(&sEvent);
+
+    return NULL;
+}
+
+/**
+ * @brief WaitEventWait() times out on time, also for sub-second and just over
+ * a second timeouts.
+ */
+static void
+test_wait_event_timeouts(void)
+{
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(kTimeoutsMs); i++)
+    {
+        ClockNs start = ClockNsNow();
+        int ret = WaitEventWait(&sEvent, kTimeoutsMs[i]);
+        double elapsed = elapsed_ms(start);
+
+        TEST_CHECK(ret == 1, "%d ms wait returned %d", kTimeoutsMs[i], ret);
+        TEST_CHECK(elapsed >= kTimeoutsMs[i] &&
+                   elapsed <= kTimeoutsMs[i] + WAIT_SLACK_MS,
+                   "%d ms wait took %.3f ms", kTimeoutsMs[i], elapsed);
+    }
+}
+
+/**
+ * @brief A signal from another thread ends the wait when it is sent.
+ */
+static void
+test_wait_event_signal(void)
+{
+    pthread_t thread;
+    ClockNs start = ClockNsNow();
+    double elapsed;
+    int ret;
+
+    pthread_create(&thread, NULL, signal_later, NULL);
+    ret = WaitEventWait(&sEvent, 1000);
+    elapsed = elapsed_ms(start);
+    pthread_join(thread, NULL);
+
+    TEST_CHECK(ret == 0, "signalled wait returned %d", ret);
+    TEST_CHECK(elapsed >= SIGNAL_DELAY_MS - 1 &&
+               elapsed <= SIGNAL_DELAY_MS + WAIT_SLACK_MS,
+               "signalled wait took %.3f ms", elapsed);
+}
+
+/**
+ * @brief Signals are latched until taken, several of them count once.
+ */
+static void
+test_wait_event_latch(void)
+{
+    WaitEventSignal(&sEvent);
+    WaitEventSignal(&sEvent);
+
+    TEST_CHECK(WaitEventWait(&sEvent, 10) == 0, "latched signal lost");
+    TEST_CHECK(WaitEventWait(&sEvent, 10) == 1, "signals not reset by the wait");
+
+    WaitEventSignal(&sEvent);
+
+    TEST_CHECK(WaitEventClear(&sEvent), "clear did not see the signal");
+    TEST_CHECK(!WaitEventClear(&sEvent), "clear saw a signal twice");
+    TEST_CHECK(WaitEventWait(&sEvent, 0) == 1, "cleared signal still set");
+}
+
+static gboolean
+count_dispatch(gpointer data)
+{
+    (*(int *)data)++;
+
+    return TRUE;
+}
+
+/**
+ * @brief The event source is dispatched once per signal and resets the event.
+ */
+static void
+test_wait_event_source(void)
+{
+    GMainContext *context = g_main_context_new();
+    GSource *source = WaitEventSourceNew(&sEvent);
+    int dispatched = 0;
+
+    g_source_set_callback(source, count_dispatch, &dispatched, NULL);
+    g_source_attach(source, context);
+
+    while (g_main_context_iteration(context, FALSE));
+
+    TEST_CHECK(dispatched == 0, "dispatched %d times without a signal", dispatched);
+
+    WaitEventSignal(&sEvent);
+    WaitEventSignal(&sEvent);
+
+    while (g_main_context_iteration(context, FALSE));
+
+    TEST_CHECK(dispatched == 1, "dispatched %d times for one signal", dispatched);
+    TEST_CHECK(!WaitEventClear(&sEvent), "source did not reset the event");
+
+    g_source_destroy(source);
+    g_source_unref(source);
+    g_main_context_unref(context);
+}
+
+/**
+ * @brief WaitObjectWait() times out on time for sub-second timeouts.
+ */
+static void
+test_wait_object_timeouts(void)
+{
+    WaitObj obj;
+    int i;
+
+    WaitObjectInit(&obj);
+    WaitObjectLock(&obj);
+
+    for (i = 0; i < G_N_ELEMENTS(kTimeoutsMs); i++)
+    {
+        ClockNs start = ClockNsNow();
+        int ret = WaitObjectWait(&obj, kTimeoutsMs[i]);
+        double elapsed = elapsed_ms(start);
+
+        /* A condition variable may wake up spuriously */
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        TEST_CHECK(ret == 1, "%d ms wait returned %d", kTimeoutsMs[i], ret);
+        TEST_CHECK(elapsed >= kTimeoutsMs[i] &&
+                   elapsed <= kTimeoutsMs[i] + WAIT_SLACK_MS,
+                   "%d ms wait took %.3f ms", kTimeoutsMs[i], elapsed);
+    }
+
+    WaitObjectUnlock(&obj);
+}
+
+int
+main(int argc, char **argv)
+{
+    if (!WaitEventInit(&sEvent))
+    {
+        fprintf(stderr, "no eventfd\n");
+        return 1;
+    }
+
+    test_wait_event_timeouts();
+    test_wait_event_signal();
+    test_wait_event_latch();
+    test_wait_event_source();
+    test_wait_object_timeouts();
+
+    WaitEventDestroy(&sEvent);
+
+    return TEST_RESULT();
+}